@@ -4,32 +4,310 @@
 
 #include "Renderer.hpp"
 
+#include <ppl.h>
+
 
 using namespace scme;
+namespace conc = concurrency;
+
+
+
+void SculptMesh::_removeVertexFromAABB(uint32_t vertex_idx)
+{
+	Vertex& vertex = verts[vertex_idx];
+	VertexBoundingBox& aabb = aabbs[vertex.aabb];
+
+	// fill the hole with the last vertex so that the leaf range stays without gaps
+	uint32_t last_idx = aabb.verts_end - 1;
+	uint32_t last_vertex_idx = aabb_vert_indexes[last_idx];
+
+	aabb_vert_indexes[vertex.idx_in_aabb] = last_vertex_idx;
+	verts[last_vertex_idx].idx_in_aabb = vertex.idx_in_aabb;
+
+	aabb.verts_end = last_idx;
+
+	// the leaf may now be merged with its siblings,
+	// it is listed once however many vertices leave it so the list stays bounded without a refit
+	if (_refit_marks.size() < aabbs.size()) {
+		_refit_marks.resize(aabbs.size(), 0);
+	}
+
+	if (_refit_marks[vertex.aabb] != _refit_epoch) {
+		_refit_marks[vertex.aabb] = _refit_epoch;
+		_refit_aabbs.push_back(vertex.aabb);
+	}
+
+	vertex.aabb = 0xFFFF'FFFF;
+}
 
+void SculptMesh::_growAABB_VertexRange(uint32_t aabb_idx)
+{
+	VertexBoundingBox& aabb = aabbs[aabb_idx];
+
+	uint32_t count = aabb.vertexCount();
+	uint32_t capacity = std::max(count * 2, 8u);
+
+	// the last range can grow in place
+	if (aabb.verts_capacity_end == aabb_vert_indexes.size()) {
+
+		aabb_vert_indexes.resize(aabb.verts_begin + capacity);
+		aabb.verts_capacity_end = aabb.verts_begin + capacity;
+		return;
+	}
+
+	uint32_t new_begin = aabb_vert_indexes.size();
+	aabb_vert_indexes.resize(new_begin + capacity);
+
+	unused_aabb_vert_count += aabb.verts_capacity_end - aabb.verts_begin;
+
+	for (uint32_t i = 0; i < count; i++) {
 
+		uint32_t vertex_idx = aabb_vert_indexes[aabb.verts_begin + i];
+
+		aabb_vert_indexes[new_begin + i] = vertex_idx;
+		verts[vertex_idx].idx_in_aabb = new_begin + i;
+	}
+
+	aabb.verts_begin = new_begin;
+	aabb.verts_end = new_begin + count;
+	aabb.verts_capacity_end = new_begin + capacity;
+}
+
+void SculptMesh::_clearRefitAABBs()
+{
+	_refit_aabbs.clear();
+	_refit_epoch++;
+
+	// marks left from the last wrap around would look current
+	if (_refit_epoch == 0) {
+		std::fill(_refit_marks.begin(), _refit_marks.end(), 0);
+		_refit_epoch = 1;
+	}
+}
+
+uint32_t SculptMesh::_allocAABB_Block()
+{
+	if (_free_aabb_blocks.size()) {
+
+		uint32_t base_idx = _free_aabb_blocks.back();
+		_free_aabb_blocks.pop_back();
+		return base_idx;
+	}
+
+	uint32_t base_idx = aabbs.size();
+	aabbs.resize(aabbs.size() + 8);
+
+	return base_idx;
+}
+
+void SculptMesh::_freeAABBs(std::array<uint32_t, 8>& aabb_idxs)
+{
+	for (uint32_t aabb_idx : aabb_idxs) {
+
+		VertexBoundingBox& aabb = aabbs[aabb_idx];
+		aabb.parent = 0xFFFF'FFFF;
+		aabb.children[0] = 0xFFFF'FFFE;
+		aabb.verts_begin = 0;
+		aabb.verts_end = 0;
+		aabb.verts_capacity_end = 0;
+	}
+
+	// children of a subdivision are consecutive, children around a grown root are not
+	std::array<uint32_t, 8> sorted = aabb_idxs;
+	std::sort(sorted.begin(), sorted.end());
+
+	if (sorted[7] - sorted[0] == 7) {
+		_free_aabb_blocks.push_back(sorted[0]);
+	}
+}
+
+void SculptMesh::_subdivideAABB(uint32_t aabb_idx)
+{
+	uint32_t base_idx = _allocAABB_Block();
+
+	VertexBoundingBox& aabb = aabbs[aabb_idx];
+
+	aabb.aabb.subdivide(
+		aabbs[base_idx + 0].aabb, aabbs[base_idx + 1].aabb,
+		aabbs[base_idx + 2].aabb, aabbs[base_idx + 3].aabb,
+
+		aabbs[base_idx + 4].aabb, aabbs[base_idx + 5].aabb,
+		aabbs[base_idx + 6].aabb, aabbs[base_idx + 7].aabb,
+		aabb.mid
+	);
+
+	// count the vertices of each child to give them ranges that fit exactly
+	std::array<uint32_t, 8> child_counts = {};
+
+	for (uint32_t i = aabb.verts_begin; i < aabb.verts_end; i++) {
+		child_counts[aabb.octantOf(vert_positions[aabb_vert_indexes[i]])]++;
+	}
+
+	uint32_t child_begin = aabb_vert_indexes.size();
+	aabb_vert_indexes.resize(child_begin + aabb.vertexCount());
+
+	for (uint32_t i = 0; i < 8; i++) {
+
+		uint32_t child_aabb_idx = base_idx + i;
+		aabb.children[i] = child_aabb_idx;
+
+		VertexBoundingBox& child_aabb = aabbs[child_aabb_idx];
+		child_aabb.parent = aabb_idx;
+		child_aabb.children[0] = 0xFFFF'FFFF;
+		child_aabb.mid = { child_aabb.aabb.midX(), child_aabb.aabb.midY(), child_aabb.aabb.midZ() };
+		child_aabb.verts_begin = child_begin;
+		child_aabb.verts_end = child_begin;
+		child_aabb.verts_capacity_end = child_begin + child_counts[i];
+
+		child_begin += child_counts[i];
+	}
+
+	// transfer the vertices of the parent to children
+	for (uint32_t i = aabb.verts_begin; i < aabb.verts_end; i++) {
+
+		uint32_t vertex_idx = aabb_vert_indexes[i];
+		uint32_t child_aabb_idx = aabb.inWhichChildDoesPositionReside(vert_positions[vertex_idx]);
+		VertexBoundingBox& child_aabb = aabbs[child_aabb_idx];
+
+		Vertex& vertex = verts[vertex_idx];
+		vertex.aabb = child_aabb_idx;
+		vertex.idx_in_aabb = child_aabb.verts_end;
+
+		aabb_vert_indexes[child_aabb.verts_end] = vertex_idx;
+		child_aabb.verts_end++;
+	}
+
+	// the parent range is left unused
+	unused_aabb_vert_count += aabb.verts_capacity_end - aabb.verts_begin;
+
+	aabb.verts_begin = 0;
+	aabb.verts_end = 0;
+	aabb.verts_capacity_end = 0;
+}
+
+bool SculptMesh::_mergeAABB_Children(uint32_t aabb_idx)
+{
+	VertexBoundingBox& aabb = aabbs[aabb_idx];
+
+	if (aabb.isLeaf() || aabb.isFree()) {
+		return false;
+	}
+
+	uint32_t count = 0;
+
+	for (uint32_t child_idx : aabb.children) {
+
+		VertexBoundingBox& child_aabb = aabbs[child_idx];
+
+		if (child_aabb.isLeaf() == false) {
+			return false;
+		}
+
+		count += child_aabb.vertexCount();
+	}
+
+	// a leaf is split when it has more than max_vertices_in_AABB so merging at half
+	// avoids merging back a leaf that was just subdivided
+	if (count > max_vertices_in_AABB / 2) {
+		return false;
+	}
+
+	uint32_t begin = aabb_vert_indexes.size();
+	aabb_vert_indexes.resize(begin + count);
+
+	uint32_t end = begin;
+
+	for (uint32_t child_idx : aabb.children) {
+
+		VertexBoundingBox& child_aabb = aabbs[child_idx];
+
+		for (uint32_t i = child_aabb.verts_begin; i < child_aabb.verts_end; i++) {
+
+			uint32_t vertex_idx = aabb_vert_indexes[i];
+
+			Vertex& vertex = verts[vertex_idx];
+			vertex.aabb = aabb_idx;
+			vertex.idx_in_aabb = end;
+
+			aabb_vert_indexes[end] = vertex_idx;
+			end++;
+		}
+
+		unused_aabb_vert_count += child_aabb.verts_capacity_end - child_aabb.verts_begin;
+	}
+
+	std::array<uint32_t, 8> children;
+	std::copy(std::begin(aabb.children), std::end(aabb.children), children.begin());
+
+	aabb.children[0] = 0xFFFF'FFFF;
+	aabb.verts_begin = begin;
+	aabb.verts_end = end;
+	aabb.verts_capacity_end = end;
+
+	_freeAABBs(children);
+	return true;
+}
+
+void SculptMesh::_compactAABB_VertexRanges()
+{
+	uint32_t aabb_count = aabbs.size();
+
+	// only leafs have vertices, the others have empty ranges
+	std::vector<uint32_t> new_begins(aabb_count);
+
+	uint32_t offset = 0;
+	for (uint32_t aabb_idx = 0; aabb_idx < aabb_count; aabb_idx++) {
+
+		new_begins[aabb_idx] = offset;
+		offset += aabbs[aabb_idx].vertexCount();
+	}
+
+	std::vector<uint32_t> new_vert_indexes(offset);
+
+	conc::parallel_for(0u, aabb_count, [&](uint32_t aabb_idx) {
+
+		VertexBoundingBox& aabb = aabbs[aabb_idx];
+
+		uint32_t count = aabb.vertexCount();
+		uint32_t new_begin = new_begins[aabb_idx];
+
+		for (uint32_t i = 0; i < count; i++) {
+
+			uint32_t vertex_idx = aabb_vert_indexes[aabb.verts_begin + i];
+
+			new_vert_indexes[new_begin + i] = vertex_idx;
+			verts[vertex_idx].idx_in_aabb = new_begin + i;
+		}
+
+		aabb.verts_begin = new_begin;
+		aabb.verts_end = new_begin + count;
+		aabb.verts_capacity_end = new_begin + count;
+	});
+
+	aabb_vert_indexes.swap(new_vert_indexes);
+	unused_aabb_vert_count = 0;
+}
 
 void SculptMesh::_transferVertexToAABB(uint32_t v, uint32_t dest_aabb)
 {
-	Vertex* vertex = &verts[v];
-	VertexBoundingBox& destination_aabb = aabbs[dest_aabb];
+	Vertex& vertex = verts[v];
 
 	// remove from old AABB
-	if (vertex->aabb != 0xFFFF'FFFF) {
+	if (vertex.aabb != 0xFFFF'FFFF) {
+		_removeVertexFromAABB(v);
+	}
 
-		VertexBoundingBox& source_aabb = aabbs[vertex->aabb];
+	if (aabbs[dest_aabb].verts_end == aabbs[dest_aabb].verts_capacity_end) {
+		_growAABB_VertexRange(dest_aabb);
+	}
 
-		source_aabb.verts_deleted_count -= 1;
-		source_aabb.verts[vertex->idx_in_aabb] = 0xFFFF'FFFF;
+	VertexBoundingBox& destination_aabb = aabbs[dest_aabb];
 
-		// NOTE: the process of merging empty leafs or under ocupied leafs into parent AABB has been deliberatly omited
-		// it is expected that the AABB graph will be recreated overy so often
-		// making merging not be worth while in terms of execution speed/time/lag
-	}
+	vertex.aabb = dest_aabb;
+	vertex.idx_in_aabb = destination_aabb.verts_end;
 
-	vertex->aabb = dest_aabb;
-	vertex->idx_in_aabb = destination_aabb.verts.size();
-	destination_aabb.verts.push_back(v);
+	aabb_vert_indexes[destination_aabb.verts_end] = v;
+	destination_aabb.verts_end++;
 }
 
 void SculptMesh::_recreateAABBs()
@@ -37,49 +315,32 @@ void SculptMesh::_recreateAABBs()
 	aabbs.resize(1);
 	root_aabb_idx = 0;
 
+	unused_aabb_vert_count = 0;
+	_clearRefitAABBs();
+	_free_aabb_blocks.clear();
+
 	VertexBoundingBox& root = aabbs[root_aabb_idx];
 	root.parent = 0xFFFF'FFFF;
 	root.children[0] = 0xFFFF'FFFF;
 	root.aabb.max = { 0, 0, 0 };
 	root.aabb.min = { FLT_MAX, FLT_MAX, FLT_MAX };
-	root.verts_deleted_count = 0;
-	root.verts.clear();
 
 #undef max
 #undef min
 
-	auto& max = root.aabb.max;
-	auto& min = root.aabb.min;
-
-	for (auto iter = verts.begin(); iter != verts.end(); iter.next()) {
+	root.aabb = verts.parallelReduce(root.aabb,
+		[&](AxisBoundingBox3D<>& bounds, Vertex& vert, uint32_t vertex_idx) {
 
-		Vertex& vert = iter.get();
-		vert.aabb = 0xFFFF'FFFF;
-
-		if (vert.pos.x > max.x) {
-			max.x = vert.pos.x;
-		}
-
-		if (vert.pos.y > max.y) {
-			max.y = vert.pos.y;
-		}
+			vert.aabb = 0xFFFF'FFFF;
 
-		if (vert.pos.z > max.z) {
-			max.z = vert.pos.z;
-		}
-
-		if (vert.pos.x < min.x) {
-			min.x = vert.pos.x;
-		}
-
-		if (vert.pos.y < min.y) {
-			min.y = vert.pos.y;
-		}
-
-		if (vert.pos.z < min.z) {
-			min.z = vert.pos.z;
-		}
-	}
+			glm::vec3& pos = vert_positions[vertex_idx];
+			bounds.max = glm::max(bounds.max, pos);
+			bounds.min = glm::min(bounds.min, pos);
+		},
+		[](AxisBoundingBox3D<>& bounds, const AxisBoundingBox3D<>& other) {
+			bounds.max = glm::max(bounds.max, other.max);
+			bounds.min = glm::min(bounds.min, other.min);
+		});
 
 	float size_x = root.aabb.sizeX();
 	float size_y = root.aabb.sizeY();
@@ -111,172 +372,217 @@ void SculptMesh::_recreateAABBs()
 		root.mid.z + grow_size
 	};
 
-	for (auto iter = verts.begin(); iter != verts.end(); iter.next()) {
-		moveVertexInAABBs(iter.index());
-	}
-}
+	// Morton Codes
+	// each level takes 3 bits ordered like the octants of VertexBoundingBox::octantOf,
+	// so sorting by code places the vertices of every octree node next to each other
+	constexpr uint32_t morton_levels = 21;
 
-void SculptMesh::moveVertexInAABBs(uint32_t vertex_idx)
-{
-	Vertex& vertex = verts[vertex_idx];
+	struct MortonVertex {
+		uint64_t code;
+		uint32_t vertex_idx;
+	};
 
-	// did it even leave the original AABB heuristic
-	if (vertex.aabb != 0xFFFF'FFFF) {
+	uint32_t vertex_count = verts.size();
+	glm::vec3 root_min = root.aabb.min;
+	float scale = grow_size > 0 ? (1 << morton_levels) / (2 * grow_size) : 0;
 
-		VertexBoundingBox& original_aabb = aabbs[vertex.aabb];
+	std::vector<MortonVertex> sorted(vertex_count);
 
-		// no significant change in position
-		if (original_aabb.aabb.isPositionInside(vertex.pos)) {
-			return;
-		}
-	}
+	verts.parallelForEachRanked([&](Vertex&, uint32_t vertex_idx, uint32_t rank) {
 
-	// TODO: refactor using spatial split planes
-	uint32_t now_count = 1;
-	std::array<uint32_t, 8> now_aabbs = {
-		root_aabb_idx
-	};
+		glm::vec3 cell = (vert_positions[vertex_idx] - root_min) * scale;
+		cell = glm::clamp(cell, 0.f, (float)((1 << morton_levels) - 1));
 
-	uint32_t next_count = 0;
-	std::array<uint32_t, 8> next_aabbs;
+		// octants below, back are the ones with the bit set
+		uint64_t below = ~(uint32_t)cell.y;
+		uint64_t back = ~(uint32_t)cell.z;
+		uint64_t right = (uint32_t)cell.x;
 
-	while (now_count) {
+		MortonVertex& morton_vertex = sorted[rank];
+		morton_vertex.code = (spreadMortonBits(below) << 2) | (spreadMortonBits(back) << 1) | spreadMortonBits(right);
+		morton_vertex.vertex_idx = vertex_idx;
+	});
 
-		for (uint32_t i = 0; i < now_count; i++) {
+	conc::parallel_radixsort(sorted.begin(), sorted.end(), [](const MortonVertex& morton_vertex) {
+		return (size_t)morton_vertex.code;
+	});
 
-			uint32_t aabb_idx = now_aabbs[i];
-			VertexBoundingBox* aabb = &aabbs[aabb_idx];
+	aabb_vert_indexes.resize(vertex_count);
 
-			if (aabb->aabb.isPositionInside(vertex.pos)) {
+	conc::parallel_for(0u, vertex_count, [&](uint32_t i) {
+		aabb_vert_indexes[i] = sorted[i].vertex_idx;
+	});
 
-				// Leaf
-				if (aabb->isLeaf()) {
+	// Hierarchy
+	// built one level at a time, all the nodes of a level are done in parallel,
+	// a node over max_vertices_in_AABB is split into the runs of vertices that share the next 3 bits of code
+	struct PendingAABB {
+		uint32_t aabb_idx;
+		uint32_t begin;
+		uint32_t end;
+	};
 
-					uint32_t child_vertex_count = aabb->verts.size() - aabb->verts_deleted_count;
+	std::vector<PendingAABB> level_aabbs = {
+		{ root_aabb_idx, 0, vertex_count }
+	};
+	std::vector<PendingAABB> next_level_aabbs;
+	std::vector<uint32_t> split_ranks;
 
-					// leaf not full
-					if (child_vertex_count < max_vertices_in_AABB) {
+	for (uint32_t level = 0; level_aabbs.size(); level++) {
 
-						_transferVertexToAABB(vertex_idx, aabb_idx);
-						return;
-					}
-					// Subdivide
-					else {
-						uint32_t base_idx = aabbs.size();
-						aabbs.resize(aabbs.size() + 8);
+		uint32_t level_count = level_aabbs.size();
 
-						aabb = &aabbs[aabb_idx];  // old AABB pointer invalidated because octrees resize
+		// where the children of each split node go
+		split_ranks.resize(level_count);
 
-						aabb->aabb.subdivide(
-							aabbs[base_idx + 0].aabb, aabbs[base_idx + 1].aabb,
-							aabbs[base_idx + 2].aabb, aabbs[base_idx + 3].aabb,
+		uint32_t split_count = 0;
+		for (uint32_t i = 0; i < level_count; i++) {
 
-							aabbs[base_idx + 4].aabb, aabbs[base_idx + 5].aabb,
-							aabbs[base_idx + 6].aabb, aabbs[base_idx + 7].aabb,
-							aabb->mid
-						);
+			PendingAABB& node = level_aabbs[i];
 
-						bool found = false;
+			if (node.end - node.begin > max_vertices_in_AABB && level < morton_levels) {
+				split_ranks[i] = split_count;
+				split_count++;
+			}
+			else {
+				split_ranks[i] = 0xFFFF'FFFF;
+			}
+		}
 
-						for (i = 0; i < 8; i++) {
+		uint32_t base_idx = aabbs.size();
+		aabbs.resize(aabbs.size() + split_count * 8);
 
-							uint32_t child_aabb_idx = base_idx + i;
-							aabb->children[i] = child_aabb_idx;
+		next_level_aabbs.resize(split_count * 8);
 
-							VertexBoundingBox& child_aabb = aabbs[child_aabb_idx];
-							child_aabb.parent = aabb_idx;
-							child_aabb.children[0] = 0xFFFF'FFFF;
-							child_aabb.verts_deleted_count = 0;
-							child_aabb.verts.reserve(max_vertices_in_AABB / 4);  // just a guess
+		uint32_t shift = (morton_levels - 1 - level) * 3;
 
-							// transfer the excess vertex to one of child AABBs
-							if (!found && child_aabb.aabb.isPositionInside(vertex.pos)) {
-								_transferVertexToAABB(vertex_idx, child_aabb_idx);
-								found = true;
-							}
-						}
+		conc::parallel_for(0u, level_count, [&](uint32_t i) {
 
-						assert_cond(found == true, "vertex was not found in subdivided leaf");
+			PendingAABB& node = level_aabbs[i];
+			VertexBoundingBox& aabb = aabbs[node.aabb_idx];
 
-						// transfer the rest of vertices of the parent to children
-						for (uint32_t aabb_vertex_idx : aabb->verts) {
+			// Leaf
+			if (split_ranks[i] == 0xFFFF'FFFF) {
 
-							// skip deleted vertex index from AABB
-							if (aabb_vertex_idx == 0xFFFF'FFFF) {
-								continue;
-							}
+				aabb.children[0] = 0xFFFF'FFFF;
+				aabb.verts_begin = node.begin;
+				aabb.verts_end = node.end;
+				aabb.verts_capacity_end = node.end;
 
-							Vertex& aabb_vertex = verts[aabb_vertex_idx];
+				for (uint32_t j = node.begin; j < node.end; j++) {
 
-							for (i = 0; i < 8; i++) {
+					Vertex& vertex = verts[aabb_vert_indexes[j]];
+					vertex.aabb = node.aabb_idx;
+					vertex.idx_in_aabb = j;
+				}
+				return;
+			}
 
-								uint32_t child_aabb_idx = base_idx + i;
-								VertexBoundingBox& child_aabb = aabbs[child_aabb_idx];
+			uint32_t children_idx = base_idx + split_ranks[i] * 8;
 
-								if (child_aabb.aabb.isPositionInside(aabb_vertex.pos)) {
+			aabb.aabb.subdivide(
+				aabbs[children_idx + 0].aabb, aabbs[children_idx + 1].aabb,
+				aabbs[children_idx + 2].aabb, aabbs[children_idx + 3].aabb,
 
-									aabb_vertex.aabb = child_aabb_idx;
-									aabb_vertex.idx_in_aabb = child_aabb.verts.size();
+				aabbs[children_idx + 4].aabb, aabbs[children_idx + 5].aabb,
+				aabbs[children_idx + 6].aabb, aabbs[children_idx + 7].aabb,
+				aabb.mid
+			);
+			aabb.verts_begin = 0;
+			aabb.verts_end = 0;
+			aabb.verts_capacity_end = 0;
 
-									child_aabb.verts.push_back(aabb_vertex_idx);
-									break;
-								}
-							}
-						}
+			uint32_t child_begin = node.begin;
 
-						// remove vertices from parent
-						aabb->verts_deleted_count = 0;
-						aabb->verts.clear();
-						return;
-					}
-				}
-				// Schedule going down the graph call
-				else {
-					uint32_t child_idx = aabb->inWhichChildDoesPositionReside(vertex.pos);
-
-					// unlikelly only float point errors
-					if (child_idx == 0xFFFF'FFFF) {
-
-						for (i = 0; i < 8; i++) {
-							next_aabbs[next_count] = aabb->children[i];
-							next_count++;
-						}
-					}
-					else {
-						next_aabbs[next_count] = child_idx;
-						next_count++;
-					}
-					break;
-				}
+			for (uint32_t j = 0; j < 8; j++) {
+
+				uint32_t child_aabb_idx = children_idx + j;
+				aabb.children[j] = child_aabb_idx;
+
+				VertexBoundingBox& child_aabb = aabbs[child_aabb_idx];
+				child_aabb.parent = node.aabb_idx;
+				child_aabb.mid = { child_aabb.aabb.midX(), child_aabb.aabb.midY(), child_aabb.aabb.midZ() };
+
+				uint32_t child_end = (uint32_t)(std::partition_point(
+					sorted.begin() + child_begin, sorted.begin() + node.end, [&](MortonVertex& morton_vertex) {
+						return ((morton_vertex.code >> shift) & 7) <= j;
+					}) - sorted.begin());
+
+				next_level_aabbs[split_ranks[i] * 8 + j] = { child_aabb_idx, child_begin, child_end };
+				child_begin = child_end;
 			}
+		});
+
+		level_aabbs.swap(next_level_aabbs);
+	}
+}
+
+void SculptMesh::moveVertexInAABBs(uint32_t vertex_idx)
+{
+	Vertex& vertex = verts[vertex_idx];
+	glm::vec3& pos = vert_positions[vertex_idx];
+
+	// did it even leave the original AABB heuristic
+	if (vertex.aabb != 0xFFFF'FFFF) {
+
+		VertexBoundingBox& original_aabb = aabbs[vertex.aabb];
+
+		// no significant change in position
+		if (original_aabb.aabb.isPositionInside(pos)) {
+			return;
+		}
+	}
+
+	if (aabbs[root_aabb_idx].aabb.isPositionInside(pos)) {
+
+		// the octants cover the whole parent so going down always ends in a leaf
+		uint32_t aabb_idx = root_aabb_idx;
+
+		while (aabbs[aabb_idx].isLeaf() == false) {
+			aabb_idx = aabbs[aabb_idx].inWhichChildDoesPositionReside(pos);
+		}
+
+		if (aabb_idx == vertex.aabb) {
+			return;
 		}
 
-		now_aabbs.swap(next_aabbs);
-		now_count = next_count;
-		next_count = 0;
+		// Subdivide
+		if (aabbs[aabb_idx].vertexCount() >= max_vertices_in_AABB) {
+
+			_subdivideAABB(aabb_idx);
+			aabb_idx = aabbs[aabb_idx].inWhichChildDoesPositionReside(pos);
+		}
+
+		_transferVertexToAABB(vertex_idx, aabb_idx);
+		return;
 	}
 
 	// At this point position is not found in the AABB graph
 
-	VertexBoundingBox& old_root = aabbs[root_aabb_idx];
-	float root_size = old_root.aabb.sizeX();
+	uint32_t old_root_idx = root_aabb_idx;
+	AxisBoundingBox3D<> old_root_aabb = aabbs[old_root_idx].aabb;
+	float root_size = old_root_aabb.sizeX();
 
 	// would the position fit inside the graph if it would be enlarged by one level up
-	if (old_root.aabb.min.x - root_size < vertex.pos.x &&
-		vertex.pos.x < old_root.aabb.max.x + root_size &&
+	if (old_root_aabb.min.x - root_size < pos.x &&
+		pos.x < old_root_aabb.max.x + root_size &&
 		// Y
-		old_root.aabb.min.y - root_size < vertex.pos.y &&
-		vertex.pos.y < old_root.aabb.max.y + root_size &&
+		old_root_aabb.min.y - root_size < pos.y &&
+		pos.y < old_root_aabb.max.y + root_size &&
 		// Z
-		old_root.aabb.min.z - root_size < vertex.pos.z &&
-		vertex.pos.z < old_root.aabb.max.z + root_size)
+		old_root_aabb.min.z - root_size < pos.z &&
+		pos.z < old_root_aabb.max.z + root_size)
 	{
 		// NOTE: taking this path is quicker but increases the graph traversal cost for all vertices by one level
 
-		uint32_t new_root_idx = aabbs.size();
-		VertexBoundingBox& new_root = aabbs.emplace_back();
+		// the new root and the 7 siblings of the old root
+		uint32_t new_root_idx = _allocAABB_Block();
+
+		VertexBoundingBox& new_root = aabbs[new_root_idx];
 		new_root.parent = 0xFFFF'FFFF;
-		new_root.verts_deleted_count = 0;
+		new_root.verts_begin = 0;
+		new_root.verts_end = 0;
+		new_root.verts_capacity_end = 0;
 
 		/* create a new AABB that is twice as big and is positioned so that
 		  it contains the vertex
@@ -290,33 +596,32 @@ void SculptMesh::moveVertexInAABBs(uint32_t vertex_idx)
 
 		  O is the old root AABB
 		*/
-		old_root.parent = new_root_idx;
 		{
-			if (vertex.pos.y > old_root.aabb.max.y) {
-				new_root.aabb.min.y = old_root.aabb.min.y;
-				new_root.aabb.max.y = new_root.aabb.min.y + root_size;
+			if (pos.y > old_root_aabb.max.y) {
+				new_root.aabb.min.y = old_root_aabb.min.y;
+				new_root.aabb.max.y = new_root.aabb.min.y + 2 * root_size;
 			}
 			else {
-				new_root.aabb.max.y = old_root.aabb.max.y;
-				new_root.aabb.min.y = new_root.aabb.max.y - root_size;
+				new_root.aabb.max.y = old_root_aabb.max.y;
+				new_root.aabb.min.y = new_root.aabb.max.y - 2 * root_size;
 			}
 
-			if (vertex.pos.z > old_root.aabb.max.z) {
-				new_root.aabb.min.z = old_root.aabb.min.z;
-				new_root.aabb.max.z = new_root.aabb.min.z + root_size;
+			if (pos.z > old_root_aabb.max.z) {
+				new_root.aabb.min.z = old_root_aabb.min.z;
+				new_root.aabb.max.z = new_root.aabb.min.z + 2 * root_size;
 			}
 			else {
-				new_root.aabb.max.z = old_root.aabb.max.z;
-				new_root.aabb.min.z = new_root.aabb.max.z - root_size;;
+				new_root.aabb.max.z = old_root_aabb.max.z;
+				new_root.aabb.min.z = new_root.aabb.max.z - 2 * root_size;
 			}
 
-			if (vertex.pos.x > old_root.aabb.max.x) {
-				new_root.aabb.min.x = old_root.aabb.min.x;
-				new_root.aabb.max.x = new_root.aabb.min.x + root_size;
+			if (pos.x > old_root_aabb.max.x) {
+				new_root.aabb.min.x = old_root_aabb.min.x;
+				new_root.aabb.max.x = new_root.aabb.min.x + 2 * root_size;
 			}
 			else {
-				new_root.aabb.max.x = old_root.aabb.max.x;
-				new_root.aabb.min.x = new_root.aabb.max.x - root_size;
+				new_root.aabb.max.x = old_root_aabb.max.x;
+				new_root.aabb.min.x = new_root.aabb.max.x - 2 * root_size;
 			}
 		}
 
@@ -326,48 +631,47 @@ void SculptMesh::moveVertexInAABBs(uint32_t vertex_idx)
 			boxes[4], boxes[5], boxes[6], boxes[7],
 			new_root.mid);
 
-		// it's cheaper to check for a bool than is position inside
-		bool aabb_placed = false;
-		bool vertex_placed = false;
+		glm::vec3 old_root_mid = aabbs[old_root_idx].mid;
+		uint32_t old_root_octant = new_root.octantOf(old_root_mid);
 
 		// create and link children
+		uint32_t sibling_idx = new_root_idx + 1;
+
 		for (uint32_t i = 0; i < 8; i++) {
 
 			uint32_t child_idx;
 
-			if (aabb_placed == false &&
-				boxes[i].isPositionInside(old_root.mid))
-			{
-				child_idx = root_aabb_idx;
-
-				aabb_placed = true;
+			if (i == old_root_octant) {
+				child_idx = old_root_idx;
 			}
 			else {
-				child_idx = aabbs.size();
+				child_idx = sibling_idx;
+				sibling_idx++;
 
-				VertexBoundingBox& child_aabb = aabbs.emplace_back();
-				child_aabb.parent = new_root_idx;
+				VertexBoundingBox& child_aabb = aabbs[child_idx];
 				child_aabb.children[0] = 0xFFFF'FFFF;
 				child_aabb.aabb = boxes[i];
-				child_aabb.mid = { boxes->midX(), boxes->midY(), boxes->midZ() };
-				child_aabb.verts_deleted_count = 0;
-
-				if (vertex_placed == false &&
-					child_aabb.aabb.isPositionInside(vertex.pos))
-				{
-					child_aabb.verts.push_back(vertex_idx);
-
-					vertex.aabb = child_idx;
-					vertex.idx_in_aabb = 0;
-
-					vertex_placed = true;
-				}
+				child_aabb.mid = { boxes[i].midX(), boxes[i].midY(), boxes[i].midZ() };
+				child_aabb.verts_begin = 0;
+				child_aabb.verts_end = 0;
+				child_aabb.verts_capacity_end = 0;
 			}
 
+			aabbs[child_idx].parent = new_root_idx;
 			new_root.children[i] = child_idx;
 		}
 
 		root_aabb_idx = new_root_idx;
+
+		uint32_t dest_aabb_idx = new_root.inWhichChildDoesPositionReside(pos);
+
+		// only float point errors would send the vertex back into the old root
+		if (dest_aabb_idx == old_root_idx) {
+			_recreateAABBs();
+			return;
+		}
+
+		_transferVertexToAABB(vertex_idx, dest_aabb_idx);
 	}
 	// recreate the graph big enough to fit the vertex and a bit more
 	else {
@@ -375,6 +679,74 @@ void SculptMesh::moveVertexInAABBs(uint32_t vertex_idx)
 	}
 }
 
+void SculptMesh::refitAABBs()
+{
+	// Merge Leafs
+	// merging can make the parent mergeable as well so keep going up
+	std::sort(_refit_aabbs.begin(), _refit_aabbs.end());
+
+	for (uint32_t aabb_idx : _refit_aabbs) {
+
+		// already merged into its parent
+		if (aabbs[aabb_idx].isFree()) {
+			continue;
+		}
+
+		uint32_t parent_idx = aabbs[aabb_idx].parent;
+
+		while (parent_idx != 0xFFFF'FFFF && _mergeAABB_Children(parent_idx)) {
+			parent_idx = aabbs[parent_idx].parent;
+		}
+	}
+
+	_clearRefitAABBs();
+
+	// Collapse Root
+	// levels added by moveVertexInAABBs for vertices that came back are removed
+	while (aabbs[root_aabb_idx].isLeaf() == false) {
+
+		VertexBoundingBox& root = aabbs[root_aabb_idx];
+
+		uint32_t used_child_idx = 0xFFFF'FFFF;
+		uint32_t used_count = 0;
+
+		for (uint32_t child_idx : root.children) {
+
+			VertexBoundingBox& child_aabb = aabbs[child_idx];
+
+			if (child_aabb.isLeaf() == false || child_aabb.hasVertices()) {
+				used_child_idx = child_idx;
+				used_count++;
+			}
+		}
+
+		if (used_count != 1) {
+			break;
+		}
+
+		std::array<uint32_t, 8> freed;
+		uint32_t freed_count = 0;
+
+		freed[freed_count++] = root_aabb_idx;
+
+		for (uint32_t child_idx : root.children) {
+			if (child_idx != used_child_idx) {
+				freed[freed_count++] = child_idx;
+			}
+		}
+
+		aabbs[used_child_idx].parent = 0xFFFF'FFFF;
+		root_aabb_idx = used_child_idx;
+
+		_freeAABBs(freed);
+	}
+
+	// Reclaim
+	if (unused_aabb_vert_count > aabb_vert_indexes.size() / 2) {
+		_compactAABB_VertexRanges();
+	}
+}
+
 void SculptMesh::recreateAABBs(uint32_t new_max_vertices_in_AABB)
 {
 	if (new_max_vertices_in_AABB) {
@@ -385,8 +757,3 @@ void SculptMesh::recreateAABBs(uint32_t new_max_vertices_in_AABB)
 
 	_recreateAABBs();
 }
-
-void SculptMesh::standardBrush(StandardBrushInfo&)
-{
-
-}
@@ -0,0 +1,127 @@
+
+// Header
+#include "SculptMesh.hpp"
+
+#include <ppl.h>
+
+
+using namespace scme;
+namespace conc = concurrency;
+
+
+// turns per vertex counts into the start of each vertex range, the last element becomes the total
+static void countsToOffsets(std::vector<uint32_t>& counts)
+{
+	uint32_t offset = 0;
+
+	for (uint32_t& count : counts) {
+		uint32_t vertex_count = count;
+		count = offset;
+		offset += vertex_count;
+	}
+}
+
+void SculptMesh::buildAdjacency()
+{
+	if (adjacency.is_valid) {
+		return;
+	}
+
+	uint32_t vertex_count = verts.size() ? verts.lastIndex() + 1 : 0;
+
+	std::vector<uint32_t>& poly_offsets = adjacency.poly_offsets;
+	std::vector<uint32_t>& vert_offsets = adjacency.vert_offsets;
+
+	// deleted vertices are left with empty ranges
+	poly_offsets.assign(vertex_count + 1, 0);
+	vert_offsets.assign(vertex_count + 1, 0);
+
+	// unique polys around the current vertex, one list per worker thread
+	conc::combinable<std::vector<uint32_t>> scratches;
+
+	auto gather_polys = [&](uint32_t vertex_idx, Vertex& vertex, std::vector<uint32_t>& r_polys) {
+
+		r_polys.clear();
+
+		uint32_t edge_idx = vertex.edge;
+		Edge* edge = &edges[edge_idx];
+
+		do {
+			for (uint32_t poly_idx : { edge->p0, edge->p1 }) {
+
+				if (poly_idx != 0xFFFF'FFFF &&
+					std::find(r_polys.begin(), r_polys.end(), poly_idx) == r_polys.end())
+				{
+					r_polys.push_back(poly_idx);
+				}
+			}
+
+			// Iter
+			edge_idx = edge->nextEdgeOf(vertex_idx);
+			edge = &edges[edge_idx];
+		}
+		while (edge_idx != vertex.edge);
+	};
+
+	// Counting
+	verts.parallelForEach([&](Vertex& vertex, uint32_t vertex_idx) {
+
+		if (vertex.edge == 0xFFFF'FFFF) {
+			return;
+		}
+
+		std::vector<uint32_t>& polys_around = scratches.local();
+		gather_polys(vertex_idx, vertex, polys_around);
+
+		uint32_t edge_count = 0;
+		uint32_t edge_idx = vertex.edge;
+
+		do {
+			edge_count++;
+			edge_idx = edges[edge_idx].nextEdgeOf(vertex_idx);
+		}
+		while (edge_idx != vertex.edge);
+
+		poly_offsets[vertex_idx] = polys_around.size();
+		vert_offsets[vertex_idx] = edge_count;
+	});
+
+	countsToOffsets(poly_offsets);
+	countsToOffsets(vert_offsets);
+
+	adjacency.polys.resize(poly_offsets.back());
+	adjacency.verts.resize(vert_offsets.back());
+
+	// Filling
+	verts.parallelForEach([&](Vertex& vertex, uint32_t vertex_idx) {
+
+		if (vertex.edge == 0xFFFF'FFFF) {
+			return;
+		}
+
+		std::vector<uint32_t>& polys_around = scratches.local();
+		gather_polys(vertex_idx, vertex, polys_around);
+
+		std::copy(polys_around.begin(), polys_around.end(),
+			adjacency.polys.begin() + poly_offsets[vertex_idx]);
+
+		uint32_t vert_idx = vert_offsets[vertex_idx];
+		uint32_t edge_idx = vertex.edge;
+
+		do {
+			Edge& edge = edges[edge_idx];
+			adjacency.verts[vert_idx] = edge.v0 == vertex_idx ? edge.v1 : edge.v0;
+			vert_idx++;
+
+			edge_idx = edge.nextEdgeOf(vertex_idx);
+		}
+		while (edge_idx != vertex.edge);
+	});
+
+	adjacency.is_valid = true;
+}
+
+void SculptMesh::invalidateAdjacency()
+{
+	adjacency.is_valid = false;
+}
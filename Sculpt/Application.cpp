@@ -534,6 +534,11 @@ ErrStack Application::importMeshesFromGLTF_File(io::FilePath& path, GLTF_Importe
 
 			if (gltf_prim.indexes.size()) {
 				if (gltf_prim.normals.size()) {
+
+					// GLTF splits vertices along UV and normal seams, they are rejoined before building topology
+					scme::SculptMesh::weldByDistance(settings.weld_distance, gltf_prim.indexes,
+						gltf_prim.positions, gltf_prim.normals);
+
 					sculpt_mesh.createFromLists(gltf_prim.indexes, gltf_prim.positions, gltf_prim.normals,
 						1024);
 				}
@@ -693,9 +698,9 @@ void Application::joinMeshes(std::vector<MeshInstanceRef>& sources, uint32_t des
 			poly_count += child_mesh.polys.lastIndex() + 1;
 		}
 
-		dest_mesh.verts.resize(vertex_count);
-		dest_mesh.edges.resize(edge_count);
-		dest_mesh.polys.resize(poly_count);
+		dest_mesh._resizeVertexMemory(vertex_count);
+		dest_mesh._resizeEdgeMemory(edge_count);
+		dest_mesh._resizePolyMemory(poly_count);
 	}
 
 	uint32_t vertex_idx_offset = 0;
@@ -711,89 +716,78 @@ void Application::joinMeshes(std::vector<MeshInstanceRef>& sources, uint32_t des
 		glm::vec3 position_offset = child_inst->transform.pos - dest_inst->transform.pos;
 		// TODO: account for rotation on position and normal
 
-		for (uint32_t i = 0; i <= child_mesh.verts.lastIndex(); i++) {
+		// copy in parallel, erasing is not thread safe so it's done afterwards
+		child_mesh.verts.parallelForEach([&](scme::Vertex& src_vertex, uint32_t i) {
+
+			uint32_t dest_vertex_idx = vertex_idx_offset + i;
+			scme::Vertex& dest_vertex = dest_mesh.verts[dest_vertex_idx];
+			dest_mesh.vert_positions[dest_vertex_idx] = child_mesh.vert_positions[i] + position_offset;
+			dest_mesh.vert_normals[dest_vertex_idx] = child_mesh.vert_normals[i];
+			dest_vertex.edge = edge_idx_offset + src_vertex.edge;
+		});
 
-			if (child_mesh.verts.isDeleted(i) == false) {
+		child_mesh.edges.parallelForEach([&](scme::Edge& src_edge, uint32_t i) {
 
-				scme::Vertex& src_vertex = child_mesh.verts[i];
+			scme::Edge& dest_edge = dest_mesh.edges[edge_idx_offset + i];
+			dest_edge.v0 = vertex_idx_offset + src_edge.v0;
+			dest_edge.v0_next_edge = edge_idx_offset + src_edge.v0_next_edge;
+			dest_edge.v0_prev_edge = edge_idx_offset + src_edge.v0_prev_edge;
 
-				uint32_t dest_vertex_idx = vertex_idx_offset + i;
-				scme::Vertex& dest_vertex = dest_mesh.verts[dest_vertex_idx];
-				dest_vertex.pos = src_vertex.pos + position_offset;
-				dest_vertex.normal = src_vertex.normal;
-				dest_vertex.edge = edge_idx_offset + src_vertex.edge;
+			dest_edge.v1 = vertex_idx_offset + src_edge.v1;
+			dest_edge.v1_next_edge = edge_idx_offset + src_edge.v1_next_edge;
+			dest_edge.v1_prev_edge = edge_idx_offset + src_edge.v1_prev_edge;
 
-				dest_mesh.markVertexFullUpdate(dest_vertex_idx);
+			if (src_edge.p0 != 0xFFFF'FFFF) {
+				dest_edge.p0 = src_edge.p0 + poly_idx_offset;
 			}
 			else {
-				dest_mesh.verts.erase(i);
+				dest_edge.p0 = src_edge.p0;
 			}
-		}
-
-		for (uint32_t i = 0; i <= child_mesh.edges.lastIndex(); i++) {
-
-			if (child_mesh.edges.isDeleted(i) == false) {
 
-				scme::Edge& src_edge = child_mesh.edges[i];
-
-				scme::Edge& dest_edge = dest_mesh.edges[edge_idx_offset + i];
-				dest_edge.v0 = vertex_idx_offset + src_edge.v0;
-				dest_edge.v0_next_edge = edge_idx_offset + src_edge.v0_next_edge;
-				dest_edge.v0_prev_edge = edge_idx_offset + src_edge.v0_prev_edge;
-
-				dest_edge.v1 = vertex_idx_offset + src_edge.v1;
-				dest_edge.v1_next_edge = edge_idx_offset + src_edge.v1_next_edge;
-				dest_edge.v1_prev_edge = edge_idx_offset + src_edge.v1_prev_edge;
-
-				if (src_edge.p0 != 0xFFFF'FFFF) {
-					dest_edge.p0 = src_edge.p0 + poly_idx_offset;
-				}
-				else {
-					dest_edge.p0 = src_edge.p0;
-				}
-
-				if (src_edge.p1 != 0xFFFF'FFFF) {
-					dest_edge.p1 = src_edge.p1 + poly_idx_offset;
-				}
-				else {
-					dest_edge.p1 = src_edge.p1;
-				}
+			if (src_edge.p1 != 0xFFFF'FFFF) {
+				dest_edge.p1 = src_edge.p1 + poly_idx_offset;
 			}
 			else {
-				dest_mesh.edges.erase(i);
+				dest_edge.p1 = src_edge.p1;
 			}
-		}
-
-		for (uint32_t i = 0; i <= child_mesh.polys.lastIndex(); i++) {
+		});
 
-			if (child_mesh.polys.isDeleted(i) == false) {
+		child_mesh.polys.parallelForEach([&](scme::Poly& src_poly, uint32_t i) {
 
-				scme::Poly& src_poly = child_mesh.polys[i];
+			uint32_t dest_poly_idx = poly_idx_offset + i;
+			scme::Poly& dest_poly = dest_mesh.polys[dest_poly_idx];
+			dest_mesh.poly_normals[dest_poly_idx] = child_mesh.poly_normals[i];
+			dest_poly.edges[0] = edge_idx_offset + src_poly.edges[0];
+			dest_poly.edges[1] = edge_idx_offset + src_poly.edges[1];
+			dest_poly.edges[2] = edge_idx_offset + src_poly.edges[2];
 
-				uint32_t dest_poly_idx = poly_idx_offset + i;
-				scme::Poly& dest_poly = dest_mesh.polys[dest_poly_idx];
-				dest_poly.normal = src_poly.normal;
-				dest_poly.tess_normals[0] = src_poly.tess_normals[0];
-				dest_poly.tess_normals[2] = src_poly.tess_normals[1];
-				dest_poly.edges[0] = edge_idx_offset + src_poly.edges[0];
-				dest_poly.edges[1] = edge_idx_offset + src_poly.edges[1];
-				dest_poly.edges[2] = edge_idx_offset + src_poly.edges[2];
+			if (src_poly.is_tris == false) {
+				dest_poly.edges[3] = edge_idx_offset + src_poly.edges[3];
+			}
 
-				if (src_poly.is_tris == false) {
-					dest_poly.edges[3] = edge_idx_offset + src_poly.edges[3];
-				}
+			dest_poly.tesselation_type = src_poly.tesselation_type;
+			dest_poly.is_tris = src_poly.is_tris;
+			dest_poly.flip_edge_0 = src_poly.flip_edge_0;
+			dest_poly.flip_edge_1 = src_poly.flip_edge_1;
+			dest_poly.flip_edge_2 = src_poly.flip_edge_2;
+			dest_poly.flip_edge_3 = src_poly.flip_edge_3;
+		});
 
-				dest_poly.tesselation_type = src_poly.tesselation_type;
-				dest_poly.is_tris = src_poly.is_tris;
-				dest_poly.flip_edge_0 = src_poly.flip_edge_0;
-				dest_poly.flip_edge_1 = src_poly.flip_edge_1;
-				dest_poly.flip_edge_2 = src_poly.flip_edge_2;
-				dest_poly.flip_edge_3 = src_poly.flip_edge_3;
+		for (uint32_t i = 0; i <= child_mesh.verts.lastIndex(); i++) {
+			if (child_mesh.verts.isDeleted(i)) {
+				dest_mesh.verts.erase(vertex_idx_offset + i);
+			}
+		}
 
-				dest_mesh.markPolyFullUpdate(dest_poly_idx);
+		for (uint32_t i = 0; i <= child_mesh.edges.lastIndex(); i++) {
+			if (child_mesh.edges.isDeleted(i)) {
+				dest_mesh.edges.erase(edge_idx_offset + i);
 			}
-			else {
-				dest_mesh.polys.erase(i);
+		}
+
+		for (uint32_t i = 0; i <= child_mesh.polys.lastIndex(); i++) {
+			if (child_mesh.polys.isDeleted(i)) {
+				dest_mesh.polys.erase(poly_idx_offset + i);
 			}
 		}
 
@@ -806,6 +800,9 @@ void Application::joinMeshes(std::vector<MeshInstanceRef>& sources, uint32_t des
 		}
 	}
 
+	dest_mesh.markAllVerticesFullUpdate();
+	dest_mesh.markAllPolysFullUpdate();
+
 	scme::SculptMesh& source_mesh = dest_inst->instance_set->parent_mesh->mesh;
 	dest_mesh.recreateAABBs(source_mesh.max_vertices_in_AABB);
 
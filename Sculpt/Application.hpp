@@ -290,6 +290,9 @@ struct CreateUV_SphereInfo {
 struct GLTF_ImporterSettings {
 	MeshLayer* dest_layer = nullptr;
 	MeshDrawcall* dest_drawcall = nullptr;
+
+	// vertices closer than this are merged on import, 0 disables welding
+	float weld_distance = 1e-5f;
 };
 
 struct CreateLineInfo {
@@ -0,0 +1,128 @@
+#pragma once
+
+#include "RayKernels.hpp"
+
+
+// the sculpt brushes as kernels over the vertices of a dab gathered into lanes,
+// each kernel returns the displacement of F::lanes vertices from their positions, normals and falloff weights,
+// the brush type picks the kernel at compile time so the loop over the dab is instantiated once per brush
+
+namespace scme {
+
+	// values that are the same for every vertex of the dab, broadcast once per dab
+	template<typename F>
+	struct WideDab {
+		WideVec3<F> center;
+		WideVec3<F> area_normal;  // unit length, out of the surface under the dab
+		WideVec3<F> plane_point;  // center of the vertices weighted by their falloff, the area plane goes through it
+		F radius;
+		F strength;
+	};
+
+	// the vector from pos to the center of the dab without its part along the area normal
+	template<typename F>
+	WideVec3<F> tangentToCenter(const WideDab<F>& dab, const WideVec3<F>& pos)
+	{
+		WideVec3<F> to_center = dab.center - pos;
+		return to_center - dab.area_normal * dot(to_center, dab.area_normal);
+	}
+
+	// height of pos above the area plane
+	template<typename F>
+	F planeHeight(const WideDab<F>& dab, const WideVec3<F>& pos)
+	{
+		return dot(pos - dab.plane_point, dab.area_normal);
+	}
+
+	// moves every vertex of the dab along the area normal so the surface under the dab rises as a whole,
+	// strength is the displacement in multiples of the radius
+	struct StandardKernel {
+		static constexpr bool needs_area_normal = true;
+		static constexpr bool needs_vertex_normals = false;
+		static constexpr bool needs_plane = false;
+
+		template<typename F>
+		static WideVec3<F> displace(const WideDab<F>& dab, const WideVec3<F>&, const WideVec3<F>&, F weight)
+		{
+			return dab.area_normal * (dab.strength * dab.radius * weight);
+		}
+	};
+
+	// pushes each vertex along its own normal so the surface swells instead of moving as a whole,
+	// strength is the displacement in multiples of the radius
+	struct InflateKernel {
+		static constexpr bool needs_area_normal = false;
+		static constexpr bool needs_vertex_normals = true;
+		static constexpr bool needs_plane = false;
+
+		template<typename F>
+		static WideVec3<F> displace(const WideDab<F>& dab, const WideVec3<F>&, const WideVec3<F>& normal, F weight)
+		{
+			return normal * (dab.strength * dab.radius * weight);
+		}
+	};
+
+	// pulls the vertices toward the center of the dab along the surface,
+	// strength is the fraction of the way moved
+	struct PinchKernel {
+		static constexpr bool needs_area_normal = true;
+		static constexpr bool needs_vertex_normals = false;
+		static constexpr bool needs_plane = false;
+
+		template<typename F>
+		static WideVec3<F> displace(const WideDab<F>& dab, const WideVec3<F>& pos, const WideVec3<F>&, F weight)
+		{
+			return tangentToCenter(dab, pos) * (dab.strength * weight);
+		}
+	};
+
+	// carves into the surface along the area normal and pinches the sides of the groove together so it stays sharp,
+	// strength is the depth in multiples of the radius
+	struct CreaseKernel {
+		static constexpr bool needs_area_normal = true;
+		static constexpr bool needs_vertex_normals = false;
+		static constexpr bool needs_plane = false;
+
+		static constexpr float pinch = 0.5f;  // fraction of the way to the center moved at full strength
+
+		template<typename F>
+		static WideVec3<F> displace(const WideDab<F>& dab, const WideVec3<F>& pos, const WideVec3<F>&, F weight)
+		{
+			F scale = dab.strength * weight;
+
+			return tangentToCenter(dab, pos) * (scale * F::set1(pinch)) -
+				dab.area_normal * (scale * dab.radius);
+		}
+	};
+
+	// moves the vertices toward the area plane, a strength of 1 flattens the center in one dab
+	struct FlattenKernel {
+		static constexpr bool needs_area_normal = true;
+		static constexpr bool needs_vertex_normals = false;
+		static constexpr bool needs_plane = true;
+
+		template<typename F>
+		static WideVec3<F> displace(const WideDab<F>& dab, const WideVec3<F>& pos, const WideVec3<F>&, F weight)
+		{
+			return dab.area_normal * (F::set1(0.f) - planeHeight(dab, pos) * dab.strength * weight);
+		}
+	};
+
+	// fills up to the area plane raised by strength in multiples of the radius,
+	// the vertices above it are left alone so clay builds up flat layers
+	struct ClayKernel {
+		static constexpr bool needs_area_normal = true;
+		static constexpr bool needs_vertex_normals = false;
+		static constexpr bool needs_plane = true;
+
+		template<typename F>
+		static WideVec3<F> displace(const WideDab<F>& dab, const WideVec3<F>& pos, const WideVec3<F>&, F weight)
+		{
+			F zero = F::set1(0.f);
+			F height = planeHeight(dab, pos) - dab.strength * dab.radius;
+
+			F lift = select(height < zero, (zero - height) * weight, zero);
+			return dab.area_normal * lift;
+		}
+	};
+}
@@ -0,0 +1,771 @@
+
+// Header
+#include "SculptMesh.hpp"
+
+#include <ppl.h>
+
+#include "RayKernels.hpp"
+#include "BrushKernels.hpp"
+
+
+using namespace scme;
+namespace conc = concurrency;
+
+
+// vertices and polys of a dab are processed in parallel in groups of this size
+static constexpr uint32_t brush_batch_size = 2048;
+
+// calls func(begin, end) in parallel for the groups of brush_batch_size that cover [0, count)
+template<typename Func>
+static void parallelForBatches(uint32_t count, Func func)
+{
+	uint32_t batch_count = (count + brush_batch_size - 1) / brush_batch_size;
+
+	conc::parallel_for(0u, batch_count, [&](uint32_t batch_idx) {
+
+		uint32_t begin = batch_idx * brush_batch_size;
+		func(begin, std::min(begin + brush_batch_size, count));
+	});
+}
+
+// 1 up to focus * radius then a smoothstep down to 0 at the radius
+template<typename F>
+static F falloffWide(F dist_sqr, F inv_radius, F focus, F inv_falloff_span)
+{
+	F zero = F::set1(0.f);
+	F one = F::set1(1.f);
+
+	F s = (sqrtLanes(dist_sqr) * inv_radius - focus) * inv_falloff_span;
+	s = minLanes(maxLanes(s, zero), one);
+
+	return one - s * s * (F::set1(3.f) - (s + s));
+}
+
+static void calcFalloffWeights(const std::vector<float>& dist_sqrs, float radius, float focus,
+	std::vector<float>& r_weights)
+{
+	using F = FloatWide;
+
+	uint32_t count = dist_sqrs.size();
+	r_weights.resize(count);
+
+	F inv_radius = F::set1(1.f / radius);
+	F wide_focus = F::set1(focus);
+	F inv_falloff_span = F::set1(1.f / std::max(1.f - focus, 1e-6f));
+
+	uint32_t wide_count = count - count % F::lanes;
+
+	// the batch size is a multiple of the lanes
+	parallelForBatches(wide_count, [&](uint32_t begin, uint32_t end) {
+
+		for (uint32_t i = begin; i < end; i += F::lanes) {
+
+			F dist_sqr = F::loadUnaligned(dist_sqrs.data() + i);
+			falloffWide(dist_sqr, inv_radius, wide_focus, inv_falloff_span).storeUnaligned(r_weights.data() + i);
+		}
+	});
+
+	// the last partial group of lanes goes through a padded copy
+	if (wide_count < count) {
+
+		alignas(32) float tail[F::lanes] = {};
+		std::copy(dist_sqrs.begin() + wide_count, dist_sqrs.end(), tail);
+
+		falloffWide(F::load(tail), inv_radius, wide_focus, inv_falloff_span).store(tail);
+		std::copy(tail, tail + (count - wide_count), r_weights.begin() + wide_count);
+	}
+}
+
+// gathers the polys around the vertices under the brush, each one once
+static void gatherBrushPolys(SculptMesh& mesh, BrushScratch& scratch)
+{
+	mesh.buildAdjacency();
+
+	QueryContext& context = scratch.query;
+	context.beginQuery(mesh.verts.capacity(), mesh.polys.capacity());
+
+	scratch.polys.clear();
+
+	for (uint32_t vertex_idx : scratch.verts) {
+
+		mesh.forEachVertexPoly(vertex_idx, [&](uint32_t poly_idx) {
+
+			if (context.visitPoly(poly_idx)) {
+				scratch.polys.push_back(poly_idx);
+			}
+		});
+	}
+}
+
+// position of the vertex with the displacements of the earlier dabs of the frame,
+// so that every dab of a frame sees the surface the dabs before it left, after mergeDabVerts
+static glm::vec3 dabPosition(const SculptMesh& mesh, const BrushScratch& scratch, uint32_t vertex_idx)
+{
+	uint32_t slot = scratch.vert_slots[vertex_idx];
+
+	if (slot == 0xFFFF'FFFF) {
+		return mesh.vert_positions[vertex_idx];
+	}
+	return mesh.vert_positions[vertex_idx] + scratch.merged_displacements[slot];
+}
+
+// the normal of the poly scaled by twice its area from the cross product of a triangle's edges
+// or a quad's diagonals, negated to match calcWindingNormal
+static glm::vec3 calcPolyAreaNormal(SculptMesh& mesh, const BrushScratch& scratch, uint32_t poly_idx)
+{
+	Poly* poly = &mesh.polys[poly_idx];
+
+	if (poly->is_tris) {
+
+		std::array<uint32_t, 3> vs;
+		mesh.getTrisPrimitives(poly, vs);
+
+		glm::vec3 v0 = dabPosition(mesh, scratch, vs[0]);
+
+		return -glm::cross(dabPosition(mesh, scratch, vs[1]) - v0, dabPosition(mesh, scratch, vs[2]) - v0);
+	}
+
+	std::array<uint32_t, 4> vs;
+	mesh.getQuadPrimitives(poly, vs);
+
+	return -glm::cross(dabPosition(mesh, scratch, vs[2]) - dabPosition(mesh, scratch, vs[0]),
+		dabPosition(mesh, scratch, vs[3]) - dabPosition(mesh, scratch, vs[1]));
+}
+
+// sum of the poly normals scaled by their areas, so small or sliver polys don't tilt it,
+// the scaled normal of each poly of the dab is kept for the vertex normals
+static glm::vec3 calcAreaNormal(SculptMesh& mesh, BrushScratch& scratch)
+{
+	if (scratch.poly_area_normals.size() < mesh.polys.capacity()) {
+		scratch.poly_area_normals.resize(mesh.polys.capacity());
+	}
+
+	conc::combinable<glm::vec3> sums([]() { return glm::vec3(0); });
+
+	parallelForBatches(scratch.polys.size(), [&](uint32_t begin, uint32_t end) {
+
+		glm::vec3 sum = { 0, 0, 0 };
+
+		for (uint32_t i = begin; i < end; i++) {
+
+			uint32_t poly_idx = scratch.polys[i];
+
+			glm::vec3 area_normal = calcPolyAreaNormal(mesh, scratch, poly_idx);
+			scratch.poly_area_normals[poly_idx] = area_normal;
+
+			sum += area_normal;
+		}
+
+		sums.local() += sum;
+	});
+
+	glm::vec3 normal = { 0, 0, 0 };
+	sums.combine_each([&](const glm::vec3& sum) {
+		normal += sum;
+	});
+
+	float length = glm::length(normal);
+
+	return length > 0 ? normal / length : normal;
+}
+
+// adds the vertices of the dab to the merged vertices if they are not already there
+static void mergeDabVerts(SculptMesh& mesh, BrushScratch& scratch)
+{
+	if (scratch.vert_slots.size() < mesh.verts.capacity()) {
+		scratch.vert_slots.resize(mesh.verts.capacity(), 0xFFFF'FFFF);
+	}
+
+	scratch.slots.resize(scratch.verts.size());
+
+	for (uint32_t i = 0; i < scratch.verts.size(); i++) {
+
+		uint32_t& slot = scratch.vert_slots[scratch.verts[i]];
+
+		if (slot == 0xFFFF'FFFF) {
+			slot = scratch.merged_verts.size();
+			scratch.merged_verts.push_back(scratch.verts[i]);
+			scratch.merged_displacements.push_back({ 0, 0, 0 });
+		}
+
+		scratch.slots[i] = slot;
+	}
+}
+
+// gathers the vertices of the dab into the lanes of the batch, after mergeDabVerts,
+// positions include the earlier dabs of the frame and the normals are averaged from the poly normals
+// of calcAreaNormal scaled by their areas
+static void gatherBrushBatch(SculptMesh& mesh, BrushScratch& scratch, bool gather_normals)
+{
+	BrushBatch& batch = scratch.batch;
+
+	uint32_t count = scratch.verts.size();
+	uint32_t padded_count = (count + FloatWide::lanes - 1) / FloatWide::lanes * FloatWide::lanes;
+
+	batch.xs.resize(padded_count);
+	batch.ys.resize(padded_count);
+	batch.zs.resize(padded_count);
+	batch.normal_xs.resize(padded_count);
+	batch.normal_ys.resize(padded_count);
+	batch.normal_zs.resize(padded_count);
+	batch.weights.resize(padded_count);
+
+	parallelForBatches(padded_count, [&](uint32_t begin, uint32_t end) {
+		for (uint32_t i = begin; i < end; i++) {
+
+			glm::vec3 pos = { 0, 0, 0 };
+			glm::vec3 normal = { 0, 0, 0 };
+			float weight = 0;
+
+			if (i < count) {
+
+				uint32_t vertex_idx = scratch.verts[i];
+
+				pos = mesh.vert_positions[vertex_idx] + scratch.merged_displacements[scratch.slots[i]];
+				weight = scratch.weights[i];
+
+				if (gather_normals) {
+
+					mesh.forEachVertexPoly(vertex_idx, [&](uint32_t poly_idx) {
+						normal += scratch.poly_area_normals[poly_idx];
+					});
+
+					float length = glm::length(normal);
+					normal = length > 0 ? normal / length : normal;
+				}
+			}
+
+			batch.xs[i] = pos.x;
+			batch.ys[i] = pos.y;
+			batch.zs[i] = pos.z;
+			batch.normal_xs[i] = normal.x;
+			batch.normal_ys[i] = normal.y;
+			batch.normal_zs[i] = normal.z;
+			batch.weights[i] = weight;
+		}
+	});
+}
+
+template<typename F>
+static float sumLanes(F values)
+{
+	alignas(32) float lanes[F::lanes];
+	values.store(lanes);
+
+	float sum = 0;
+	for (float value : lanes) {
+		sum += value;
+	}
+	return sum;
+}
+
+// center of the batch weighted by the falloff, reduced per group of lanes then across the groups
+static glm::vec3 calcPlanePoint(const BrushBatch& batch)
+{
+	using F = FloatWide;
+
+	struct WeightedSum {
+		glm::vec3 pos;
+		float weight;
+	};
+
+	conc::combinable<WeightedSum> sums([]() { return WeightedSum{ { 0, 0, 0 }, 0 }; });
+
+	// the batch size is a multiple of the lanes
+	parallelForBatches(batch.weights.size(), [&](uint32_t begin, uint32_t end) {
+
+		WideVec3<F> pos_sum = WideVec3<F>::set1({ 0, 0, 0 });
+		F weight_sum = F::set1(0.f);
+
+		for (uint32_t i = begin; i < end; i += F::lanes) {
+
+			F weight = F::loadUnaligned(batch.weights.data() + i);
+			WideVec3<F> pos = WideVec3<F>::loadUnaligned(batch.xs.data() + i, batch.ys.data() + i, batch.zs.data() + i);
+
+			pos_sum = pos_sum + pos * weight;
+			weight_sum = weight_sum + weight;
+		}
+
+		WeightedSum& sum = sums.local();
+		sum.pos += glm::vec3(sumLanes(pos_sum.x), sumLanes(pos_sum.y), sumLanes(pos_sum.z));
+		sum.weight += sumLanes(weight_sum);
+	});
+
+	WeightedSum total = { { 0, 0, 0 }, 0 };
+	sums.combine_each([&](const WeightedSum& sum) {
+		total.pos += sum.pos;
+		total.weight += sum.weight;
+	});
+
+	return total.weight > 0 ? total.pos / total.weight : total.pos;
+}
+
+// adds the displacements of one dab of a brush kernel to the merged displacements
+template<typename Kernel>
+static void addKernelDab(SculptMesh& mesh, BrushScratch& scratch, const StandardBrushInfo& info)
+{
+	using F = FloatWide;
+
+	float radius = info.diameter / 2;
+
+	mesh.sphereQuery(scratch.query, info.end_pos, radius, scratch.verts, scratch.dist_sqrs);
+
+	if (scratch.verts.empty()) {
+		return;
+	}
+
+	mesh.buildAdjacency();
+
+	calcFalloffWeights(scratch.dist_sqrs, radius, info.focus, scratch.weights);
+	mergeDabVerts(mesh, scratch);
+
+	WideDab<F> dab;
+	dab.center = WideVec3<F>::set1(info.end_pos);
+	dab.area_normal = WideVec3<F>::set1({ 0, 0, 0 });
+	dab.plane_point = WideVec3<F>::set1({ 0, 0, 0 });
+	dab.radius = F::set1(radius);
+	dab.strength = F::set1(info.strength);
+
+	// the vertex normals come from the same poly normals as the area normal
+	if constexpr (Kernel::needs_area_normal || Kernel::needs_vertex_normals) {
+		gatherBrushPolys(mesh, scratch);
+		dab.area_normal = WideVec3<F>::set1(calcAreaNormal(mesh, scratch));
+	}
+
+	gatherBrushBatch(mesh, scratch, Kernel::needs_vertex_normals);
+
+	BrushBatch& batch = scratch.batch;
+
+	if constexpr (Kernel::needs_plane) {
+		dab.plane_point = WideVec3<F>::set1(calcPlanePoint(batch));
+	}
+
+	uint32_t count = scratch.verts.size();
+
+	// the batch size is a multiple of the lanes,
+	// a vertex is only once in a dab so the slots of a dab are all different
+	parallelForBatches(batch.weights.size(), [&](uint32_t begin, uint32_t end) {
+
+		alignas(32) float xs[F::lanes];
+		alignas(32) float ys[F::lanes];
+		alignas(32) float zs[F::lanes];
+
+		for (uint32_t i = begin; i < end; i += F::lanes) {
+
+			WideVec3<F> pos = WideVec3<F>::loadUnaligned(batch.xs.data() + i, batch.ys.data() + i, batch.zs.data() + i);
+			WideVec3<F> normal = WideVec3<F>::loadUnaligned(
+				batch.normal_xs.data() + i, batch.normal_ys.data() + i, batch.normal_zs.data() + i);
+			F weight = F::loadUnaligned(batch.weights.data() + i);
+
+			Kernel::displace(dab, pos, normal, weight).store(xs, ys, zs);
+
+			uint32_t lanes_end = std::min(F::lanes, count - i);
+
+			for (uint32_t lane = 0; lane < lanes_end; lane++) {
+				scratch.merged_displacements[scratch.slots[i + lane]] += glm::vec3(xs[lane], ys[lane], zs[lane]);
+			}
+		}
+	});
+}
+
+// calls func with the kernel of the brush type so that each brush gets its own instantiation
+template<typename Func>
+static void dispatchKernel(BrushKernelType type, Func func)
+{
+	switch (type) {
+	case BrushKernelType::INFLATE: {
+		func(InflateKernel());
+		break;
+	}
+	case BrushKernelType::PINCH: {
+		func(PinchKernel());
+		break;
+	}
+	case BrushKernelType::CREASE: {
+		func(CreaseKernel());
+		break;
+	}
+	case BrushKernelType::FLATTEN: {
+		func(FlattenKernel());
+		break;
+	}
+	case BrushKernelType::CLAY: {
+		func(ClayKernel());
+		break;
+	}
+	}
+}
+
+// moves the merged vertices then brings the octree and the GPU update lists up to date,
+// the poly and vertex normals are recomputed when the updates are uploaded
+static void commitMergedDabs(SculptMesh& mesh, BrushScratch& scratch)
+{
+	if (scratch.merged_verts.empty()) {
+		return;
+	}
+
+	parallelForBatches(scratch.merged_verts.size(), [&](uint32_t begin, uint32_t end) {
+		for (uint32_t i = begin; i < end; i++) {
+			mesh.vert_positions[scratch.merged_verts[i]] += scratch.merged_displacements[i];
+		}
+	});
+
+	// the octree is rebalanced by moves so they go one at a time,
+	// vertices that stayed in their leaf return right away
+	for (uint32_t vertex_idx : scratch.merged_verts) {
+		mesh.moveVertexInAABBs(vertex_idx);
+		scratch.vert_slots[vertex_idx] = 0xFFFF'FFFF;
+	}
+
+	scratch.verts.swap(scratch.merged_verts);
+	gatherBrushPolys(mesh, scratch);
+
+	mesh.markVerticesFullUpdate(scratch.verts);
+	mesh.markPolysFullUpdate(scratch.polys);
+
+	scratch.merged_verts.clear();
+	scratch.merged_displacements.clear();
+}
+
+// moves the vertex toward the average of its neighbours by factor,
+// position_of(vertex) gives the positions of the previous step
+template<typename PositionOf>
+static glm::vec3 laplacianStep(SculptMesh& mesh, uint32_t vertex_idx, float factor, PositionOf position_of)
+{
+	glm::vec3 pos = position_of(vertex_idx);
+	glm::vec3 sum = { 0, 0, 0 };
+	uint32_t count = 0;
+
+	mesh.forEachVertexNeighbour(vertex_idx, [&](uint32_t neighbour_idx) {
+		sum += position_of(neighbour_idx);
+		count++;
+	});
+
+	if (count == 0) {
+		return pos;
+	}
+
+	return pos + factor * (sum / (float)count - pos);
+}
+
+// the factors of the steps of one smoothing iteration
+static uint32_t smoothSteps(const SmoothSettings& settings, std::array<float, 2>& r_factors)
+{
+	r_factors = { settings.lambda, settings.mu };
+	return settings.taubin ? 2 : 1;
+}
+
+// smooths the vertices of one dab, the result is kept as merged displacements
+static void addSmoothDab(SculptMesh& mesh, BrushScratch& scratch, const StandardBrushInfo& info,
+	const SmoothSettings& settings)
+{
+	float radius = info.diameter / 2;
+
+	mesh.sphereQuery(scratch.query, info.end_pos, radius, scratch.verts, scratch.dist_sqrs);
+
+	if (scratch.verts.empty()) {
+		return;
+	}
+
+	mesh.buildAdjacency();
+
+	calcFalloffWeights(scratch.dist_sqrs, radius, info.focus, scratch.weights);
+	mergeDabVerts(mesh, scratch);
+
+	// earlier dabs of the frame are included so the dab smooths the surface as it is after them
+	auto position_of = [&](uint32_t vertex_idx) {
+		return dabPosition(mesh, scratch, vertex_idx);
+	};
+
+	std::array<float, 2> factors;
+	uint32_t step_count = smoothSteps(settings, factors);
+
+	scratch.smoothed.resize(scratch.verts.size());
+
+	for (uint32_t iteration = 0; iteration < settings.iterations; iteration++) {
+		for (uint32_t step = 0; step < step_count; step++) {
+
+			float factor = factors[step] * info.strength;
+
+			parallelForBatches(scratch.verts.size(), [&](uint32_t begin, uint32_t end) {
+				for (uint32_t i = begin; i < end; i++) {
+					scratch.smoothed[i] = laplacianStep(mesh, scratch.verts[i], factor * scratch.weights[i], position_of);
+				}
+			});
+
+			parallelForBatches(scratch.verts.size(), [&](uint32_t begin, uint32_t end) {
+				for (uint32_t i = begin; i < end; i++) {
+					scratch.merged_displacements[scratch.slots[i]] =
+						scratch.smoothed[i] - mesh.vert_positions[scratch.verts[i]];
+				}
+			});
+		}
+	}
+}
+
+// samples the stroke then adds a dab for each sample with add_dab(info) and updates the mesh once
+template<typename AddDab>
+static void applyStroke(SculptMesh& mesh, BrushStroke& stroke, StandardBrushInfo& info,
+	const std::vector<Ray>& cursor_rays, AddDab add_dab)
+{
+	mesh.buildPolyBVH();
+
+	std::vector<glm::vec3> dab_centers;
+	mesh.sampleStroke(stroke, info.diameter, cursor_rays, dab_centers);
+
+	for (glm::vec3& dab_center : dab_centers) {
+
+		info.last_pos = info.end_pos;
+		info.end_pos = dab_center;
+
+		add_dab(info);
+	}
+
+	commitMergedDabs(mesh, mesh.brush_scratch);
+}
+
+void SculptMesh::standardBrush(StandardBrushInfo& info)
+{
+	addKernelDab<StandardKernel>(*this, brush_scratch, info);
+	commitMergedDabs(*this, brush_scratch);
+}
+
+void SculptMesh::standardBrushStroke(BrushStroke& stroke, StandardBrushInfo& info,
+	const std::vector<Ray>& cursor_rays)
+{
+	applyStroke(*this, stroke, info, cursor_rays, [&](const StandardBrushInfo& dab) {
+		addKernelDab<StandardKernel>(*this, brush_scratch, dab);
+	});
+}
+
+void SculptMesh::kernelBrush(BrushKernelType type, StandardBrushInfo& info)
+{
+	dispatchKernel(type, [&](auto kernel) {
+		addKernelDab<decltype(kernel)>(*this, brush_scratch, info);
+	});
+
+	commitMergedDabs(*this, brush_scratch);
+}
+
+void SculptMesh::kernelBrushStroke(BrushKernelType type, BrushStroke& stroke, StandardBrushInfo& info,
+	const std::vector<Ray>& cursor_rays)
+{
+	dispatchKernel(type, [&](auto kernel) {
+
+		using Kernel = decltype(kernel);
+
+		applyStroke(*this, stroke, info, cursor_rays, [&](const StandardBrushInfo& dab) {
+			addKernelDab<Kernel>(*this, brush_scratch, dab);
+		});
+	});
+}
+
+void SculptMesh::smoothBrush(StandardBrushInfo& info, const SmoothSettings& settings)
+{
+	addSmoothDab(*this, brush_scratch, info, settings);
+	commitMergedDabs(*this, brush_scratch);
+}
+
+void SculptMesh::smoothBrushStroke(BrushStroke& stroke, StandardBrushInfo& info, const SmoothSettings& settings,
+	const std::vector<Ray>& cursor_rays)
+{
+	applyStroke(*this, stroke, info, cursor_rays, [&](const StandardBrushInfo& dab) {
+		addSmoothDab(*this, brush_scratch, dab, settings);
+	});
+}
+
+void SculptMesh::relax(const SmoothSettings& settings)
+{
+	buildAdjacency();
+
+	std::vector<glm::vec3>& relaxed = brush_scratch.relaxed;
+	relaxed = vert_positions;
+
+	std::array<float, 2> factors;
+	uint32_t step_count = smoothSteps(settings, factors);
+
+	auto position_of = [&](uint32_t vertex_idx) {
+		return vert_positions[vertex_idx];
+	};
+
+	for (uint32_t iteration = 0; iteration < settings.iterations; iteration++) {
+		for (uint32_t step = 0; step < step_count; step++) {
+
+			verts.parallelForEach([&](Vertex&, uint32_t vertex_idx) {
+				relaxed[vertex_idx] = laplacianStep(*this, vertex_idx, factors[step], position_of);
+			});
+
+			// the positions that were read become the buffer of the next step
+			vert_positions.swap(relaxed);
+		}
+	}
+
+	// every vertex moved so the octree is rebuilt in parallel instead of moving them one at a time,
+	// and the poly BVH is rebuilt on demand instead of refitting every node
+	recreateAABBs();
+	invalidatePolyBVH();
+
+	markAllVerticesFullUpdate();
+	markAllPolysFullUpdate();
+}
+
+void SculptMesh::beginGrab(GrabBrush& grab, const StandardBrushInfo& info)
+{
+	using F = FloatWide;
+
+	BrushScratch& scratch = brush_scratch;
+
+	float radius = info.diameter / 2;
+
+	sphereQuery(scratch.query, info.end_pos, radius, scratch.verts, scratch.dist_sqrs);
+	calcFalloffWeights(scratch.dist_sqrs, radius, info.focus, scratch.weights);
+	gatherBrushPolys(*this, scratch);
+
+	uint32_t count = scratch.verts.size();
+	uint32_t padded_count = (count + F::lanes - 1) / F::lanes * F::lanes;
+
+	grab.start_pos = info.end_pos;
+	grab.verts = scratch.verts;
+	grab.polys = scratch.polys;
+
+	grab.weights.resize(padded_count);
+	grab.start_xs.resize(padded_count);
+	grab.start_ys.resize(padded_count);
+	grab.start_zs.resize(padded_count);
+
+	parallelForBatches(padded_count, [&](uint32_t begin, uint32_t end) {
+		for (uint32_t i = begin; i < end; i++) {
+
+			if (i < count) {
+				glm::vec3& pos = vert_positions[grab.verts[i]];
+				grab.weights[i] = scratch.weights[i];
+				grab.start_xs[i] = pos.x;
+				grab.start_ys[i] = pos.y;
+				grab.start_zs[i] = pos.z;
+			}
+			else {
+				grab.weights[i] = 0;
+				grab.start_xs[i] = 0;
+				grab.start_ys[i] = 0;
+				grab.start_zs[i] = 0;
+			}
+		}
+	});
+}
+
+void SculptMesh::grabBrush(GrabBrush& grab, const glm::vec3& grab_pos)
+{
+	using F = FloatWide;
+
+	uint32_t count = grab.verts.size();
+
+	if (count == 0) {
+		return;
+	}
+
+	// positions are computed from the start of the stroke so moves don't accumulate rounding errors
+	WideVec3<F> delta = WideVec3<F>::set1(grab_pos - grab.start_pos);
+
+	// the batch size is a multiple of the lanes
+	parallelForBatches(grab.weights.size(), [&](uint32_t begin, uint32_t end) {
+
+		alignas(32) float xs[F::lanes];
+		alignas(32) float ys[F::lanes];
+		alignas(32) float zs[F::lanes];
+
+		for (uint32_t i = begin; i < end; i += F::lanes) {
+
+			F weight = F::loadUnaligned(grab.weights.data() + i);
+
+			(F::loadUnaligned(grab.start_xs.data() + i) + delta.x * weight).store(xs);
+			(F::loadUnaligned(grab.start_ys.data() + i) + delta.y * weight).store(ys);
+			(F::loadUnaligned(grab.start_zs.data() + i) + delta.z * weight).store(zs);
+
+			uint32_t lanes_end = std::min(F::lanes, count - i);
+
+			for (uint32_t lane = 0; lane < lanes_end; lane++) {
+				vert_positions[grab.verts[i + lane]] = { xs[lane], ys[lane], zs[lane] };
+			}
+		}
+	});
+
+	// the octree is rebalanced by moves so they go one at a time
+	for (uint32_t vertex_idx : grab.verts) {
+		moveVertexInAABBs(vertex_idx);
+	}
+
+	markVerticesFullUpdate(grab.verts);
+	markPolysFullUpdate(grab.polys);
+}
+
+void SculptMesh::sampleStroke(BrushStroke& stroke, float diameter, const std::vector<Ray>& cursor_rays,
+	std::vector<glm::vec3>& r_dab_centers) const
+{
+	r_dab_centers.clear();
+
+	float spacing = std::max(stroke.spacing * diameter, 1e-6f);
+
+	// Cursor Path
+	// the cursor samples are raycast to measure how far along the surface the cursor went
+	raycastBatch(cursor_rays, stroke.cursor_hits);
+
+	stroke.dab_rays.clear();
+
+	for (uint32_t i = 0; i < cursor_rays.size(); i++) {
+
+		const Ray& ray = cursor_rays[i];
+		const RayHit& hit = stroke.cursor_hits[i];
+
+		// the path breaks where the cursor leaves the mesh and starts again with a dab where it comes back
+		if (hit.poly == 0xFFFF'FFFF) {
+			stroke.has_last_sample = false;
+			continue;
+		}
+
+		glm::vec3 pos = ray.origin + ray.direction * hit.distance;
+
+		if (stroke.has_last_sample == false) {
+
+			stroke.dab_rays.push_back(ray);
+
+			stroke.has_last_sample = true;
+			stroke.last_ray = ray;
+			stroke.last_pos = pos;
+			stroke.travelled = 0;
+			continue;
+		}
+
+		// Resample
+		// dabs go every spacing along the path, in between the cursor rays are interpolated
+		float length = glm::distance(stroke.last_pos, pos);
+		float dab_dist = spacing - stroke.travelled;
+
+		for (; dab_dist <= length; dab_dist += spacing) {
+
+			float t = dab_dist / length;
+
+			Ray& dab_ray = stroke.dab_rays.emplace_back();
+			dab_ray.origin = glm::mix(stroke.last_ray.origin, ray.origin, t);
+			dab_ray.direction = glm::normalize(glm::mix(stroke.last_ray.direction, ray.direction, t));
+		}
+
+		stroke.travelled = length - (dab_dist - spacing);
+		stroke.last_ray = ray;
+		stroke.last_pos = pos;
+	}
+
+	// Dabs
+	// all the dabs of the frame are raycast in one batch before any of them changes the mesh
+	raycastBatch(stroke.dab_rays, stroke.dab_hits);
+
+	for (uint32_t i = 0; i < stroke.dab_rays.size(); i++) {
+
+		const Ray& ray = stroke.dab_rays[i];
+		const RayHit& hit = stroke.dab_hits[i];
+
+		if (hit.poly != 0xFFFF'FFFF) {
+			r_dab_centers.push_back(ray.origin + ray.direction * hit.distance);
+		}
+	}
+}
+
@@ -119,3 +119,15 @@ public:
 float toRad(float degree);
 
 glm::vec3 toNormal(float nord, float east);
+
+// spreads the lower 21 bits so that there are 2 zero bits between each of them
+inline uint64_t spreadMortonBits(uint64_t x)
+{
+	x &= 0x1F'FFFF;
+	x = (x | x << 32) & 0x001F'0000'0000'FFFF;
+	x = (x | x << 16) & 0x001F'0000'FF00'00FF;
+	x = (x | x << 8) & 0x100F'00F0'0F00'F00F;
+	x = (x | x << 4) & 0x10C3'0C30'C30C'30C3;
+	x = (x | x << 2) & 0x1249'2492'4924'9249;
+	return x;
+}
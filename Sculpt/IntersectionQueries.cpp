@@ -2,8 +2,14 @@
 // Header
 #include "SculptMesh.hpp"
 
+#include <immintrin.h>
+#include <ppl.h>
+
+#include "RayKernels.hpp"
+
 
 using namespace scme;
+namespace conc = concurrency;
 
 ///* Geometry Solution
 //* https://www.scratchapixel.com/lessons/3d-basic-rendering/ray-tracing-rendering-a-triangle/ray-triangle-intersection-geometric-solution
@@ -111,14 +117,14 @@ bool SculptMesh::raycastPoly(glm::vec3& ray_origin, glm::vec3& ray_direction, ui
 
 	if (poly->is_tris) {
 
-		std::array<Vertex*, 3> vs;
+		std::array<glm::vec3, 3> vs;
 		getTrisPrimitives(poly, vs);
 
 		return raycastTrisMollerTrumbore(ray_origin, ray_direction,
-			vs[0]->pos, vs[1]->pos, vs[2]->pos, r_point);
+			vs[0], vs[1], vs[2], r_point);
 	}
 	else {
-		std::array<Vertex*, 4> vs;
+		std::array<glm::vec3, 4> vs;
 		getQuadPrimitives(poly, vs);
 
 		if (poly->tesselation_type == 0) {
@@ -132,13 +138,13 @@ bool SculptMesh::raycastPoly(glm::vec3& ray_origin, glm::vec3& ray_direction, ui
 			//  |         \ |
 			//  3-----------2
 			if (raycastTrisMollerTrumbore(ray_origin, ray_direction,
-				vs[0]->pos, vs[1]->pos, vs[2]->pos, r_point))
+				vs[0], vs[1], vs[2], r_point))
 			{
 				return true;
 			}
 
 			return raycastTrisMollerTrumbore(ray_origin, ray_direction,
-				vs[0]->pos, vs[2]->pos, vs[3]->pos, r_point);
+				vs[0], vs[2], vs[3], r_point);
 		}
 		else {
 
@@ -151,13 +157,13 @@ bool SculptMesh::raycastPoly(glm::vec3& ray_origin, glm::vec3& ray_direction, ui
 			//  | /         |
 			//  3-----------2
 			if (raycastTrisMollerTrumbore(ray_origin, ray_direction,
-				vs[0]->pos, vs[1]->pos, vs[3]->pos, r_point))
+				vs[0], vs[1], vs[3], r_point))
 			{
 				return true;
 			}
 
 			return raycastTrisMollerTrumbore(ray_origin, ray_direction,
-				vs[1]->pos, vs[2]->pos, vs[3]->pos, r_point);
+				vs[1], vs[2], vs[3], r_point);
 		}
 	}
 
@@ -166,124 +172,1386 @@ bool SculptMesh::raycastPoly(glm::vec3& ray_origin, glm::vec3& ray_direction, ui
 }
 #pragma warning(default : 4702)
 
+// finds the closest triangle of the block hit nearer than r_closest_t,
+// returns its lane or 0xFFFF'FFFF if there is none
+static uint32_t raycastTrisBlock(WideVec3<FloatWide>& orig, WideVec3<FloatWide>& dir,
+	const PolyBVH_TrisBlock& block, uint32_t tris_count, float& r_closest_t, glm::vec2& r_barycentric)
+{
+	using F = FloatWide;
+
+	alignas(32) float ts[8];
+	alignas(32) float us[8];
+	alignas(32) float vs[8];
+
+	F max_t = F::set1(r_closest_t);
+
+	// quads take 2 lanes so a block is sometimes only half full
+	uint32_t lanes_end = 0;
+
+	for (; lanes_end < tris_count; lanes_end += F::lanes) {
+
+		WideVec3<F> v0 = WideVec3<F>::load(block.v0_x + lanes_end, block.v0_y + lanes_end, block.v0_z + lanes_end);
+		WideVec3<F> v0v1 = WideVec3<F>::load(block.v0v1_x + lanes_end, block.v0v1_y + lanes_end, block.v0v1_z + lanes_end);
+		WideVec3<F> v0v2 = WideVec3<F>::load(block.v0v2_x + lanes_end, block.v0v2_y + lanes_end, block.v0v2_z + lanes_end);
+
+		F u;
+		F v;
+		raycastTrisWide(orig, dir, v0, v0v1, v0v2, max_t, u, v).store(ts + lanes_end);
+		u.store(us + lanes_end);
+		v.store(vs + lanes_end);
+	}
+
+	uint32_t closest_lane = 0xFFFF'FFFF;
+
+	for (uint32_t lane = 0; lane < lanes_end; lane++) {
+
+		if (ts[lane] < r_closest_t) {
+			r_closest_t = ts[lane];
+			closest_lane = lane;
+		}
+	}
+
+	if (closest_lane != 0xFFFF'FFFF) {
+		r_barycentric = { us[closest_lane], vs[closest_lane] };
+	}
+
+	return closest_lane;
+}
+
+void QueryContext::beginQuery(uint32_t vertex_count, uint32_t poly_count)
+{
+	epoch++;
+
+	// the marks overflowed so old marks could look current
+	if (epoch == 0) {
+		std::fill(vert_marks.begin(), vert_marks.end(), 0);
+		std::fill(poly_marks.begin(), poly_marks.end(), 0);
+		epoch = 1;
+	}
+
+	if (vert_marks.size() < vertex_count) {
+		vert_marks.resize(vertex_count, 0);
+	}
+
+	if (poly_marks.size() < poly_count) {
+		poly_marks.resize(poly_count, 0);
+	}
+
+	stack.clear();
+}
+
+bool SculptMesh::raycastPolys(QueryContext& context, const glm::vec3& ray_origin, const glm::vec3& ray_direction,
+	uint32_t& r_isect_poly, glm::vec3& r_isect_position) const
+{
+	assert_cond(poly_bvh.is_valid, "poly BVH must be built before querying");
+
+	if (poly_bvh.nodes.empty()) {
+		return false;
+	}
+
+	glm::vec3 inv_dir = 1.f / ray_direction;
+
+	WideVec3<FloatWide> wide_origin = WideVec3<FloatWide>::set1(ray_origin);
+	WideVec3<FloatWide> wide_direction = WideVec3<FloatWide>::set1(ray_direction);
+
+	__m128 origin_x = _mm_set1_ps(ray_origin.x);
+	__m128 origin_y = _mm_set1_ps(ray_origin.y);
+	__m128 origin_z = _mm_set1_ps(ray_origin.z);
+	__m128 inv_dir_x = _mm_set1_ps(inv_dir.x);
+	__m128 inv_dir_y = _mm_set1_ps(inv_dir.y);
+	__m128 inv_dir_z = _mm_set1_ps(inv_dir.z);
+
+	// which of min/max is the near plane for each axis
+	bool neg_x = inv_dir.x < 0;
+	bool neg_y = inv_dir.y < 0;
+	bool neg_z = inv_dir.z < 0;
+
+	// distance along the ray in multiples of the direction, the same as the slab distances
+	float closest_t = FLT_MAX;
+	uint32_t closest_poly = 0xFFFF'FFFF;
+
+	std::vector<uint32_t>& stack = context.stack;
+	stack.clear();
+	stack.push_back(0);
+
+	while (stack.size()) {
+
+		const PolyBVH_Node& node = poly_bvh.nodes[stack.back()];
+		stack.pop_back();
+
+		// slab test of the 4 children at once
+		__m128 near_x = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(neg_x ? node.max_x : node.min_x), origin_x), inv_dir_x);
+		__m128 near_y = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(neg_y ? node.max_y : node.min_y), origin_y), inv_dir_y);
+		__m128 near_z = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(neg_z ? node.max_z : node.min_z), origin_z), inv_dir_z);
+		__m128 far_x = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(neg_x ? node.min_x : node.max_x), origin_x), inv_dir_x);
+		__m128 far_y = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(neg_y ? node.min_y : node.max_y), origin_y), inv_dir_y);
+		__m128 far_z = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(neg_z ? node.min_z : node.max_z), origin_z), inv_dir_z);
+
+		// min/max return the second operand for NaN (0 * inf on an axis parallel ray)
+		// so the running value is always second
+		__m128 t_near = _mm_max_ps(near_x, _mm_setzero_ps());
+		t_near = _mm_max_ps(near_y, t_near);
+		t_near = _mm_max_ps(near_z, t_near);
+
+		__m128 t_far = _mm_min_ps(far_x, _mm_set1_ps(closest_t));
+		t_far = _mm_min_ps(far_y, t_far);
+		t_far = _mm_min_ps(far_z, t_far);
+
+		uint32_t hit_mask = _mm_movemask_ps(_mm_cmple_ps(t_near, t_far));
+
+		if (hit_mask == 0) {
+			continue;
+		}
+
+		alignas(16) float child_t[4];
+		_mm_store_ps(child_t, t_near);
+
+		// order the hit children from near to far
+		uint32_t hits[4];
+		uint32_t hit_count = 0;
+
+		for (uint32_t i = 0; i < 4; i++) {
+
+			if ((hit_mask & (1 << i)) == 0 || node.children[i] == 0xFFFF'FFFF) {
+				continue;
+			}
+
+			uint32_t j = hit_count++;
+			for (; j > 0 && child_t[hits[j - 1]] > child_t[i]; j--) {
+				hits[j] = hits[j - 1];
+			}
+			hits[j] = i;
+		}
+
+		// leafs are tested right away, inner nodes are pushed far first so the near one is popped next
+		for (uint32_t i = 0; i < hit_count; i++) {
+
+			uint32_t child = hits[i];
+
+			if (node.counts[child] == 0 || child_t[child] > closest_t) {
+				continue;
+			}
+
+			const PolyBVH_TrisBlock& block = poly_bvh.tris_blocks[node.children[child]];
+
+			glm::vec2 barycentric;
+			uint32_t lane = raycastTrisBlock(wide_origin, wide_direction, block, node.counts[child],
+				closest_t, barycentric);
+
+			if (lane != 0xFFFF'FFFF) {
+				closest_poly = block.polys[lane];
+			}
+		}
+
+		for (uint32_t i = hit_count; i-- > 0;) {
+
+			uint32_t child = hits[i];
+
+			if (node.counts[child] == 0 && child_t[child] <= closest_t) {
+				stack.push_back(node.children[child]);
+			}
+		}
+	}
+
+	if (closest_poly == 0xFFFF'FFFF) {
+		return false;
+	}
+
+	r_isect_poly = closest_poly;
+	r_isect_position = ray_origin + ray_direction * closest_t;
+	return true;
+}
+
 bool SculptMesh::raycastPolys(glm::vec3& ray_origin, glm::vec3& ray_direction,
 	uint32_t& r_isect_poly, glm::vec3& r_isect_position)
 {
-	std::vector<VertexBoundingBox*>& now_aabbs = _now_aabbs;
-	std::vector<VertexBoundingBox*>& next_aabbs = _next_aabbs;
-	std::vector<VertexBoundingBox*>& traced_aabbs = _traced_aabbs;
+	buildPolyBVH();
+
+	QueryContext context;
+	return raycastPolys(context, ray_origin, ray_direction, r_isect_poly, r_isect_position);
+}
+
+// traces the rays of the packet through the BVH together, a node is entered if any of the rays
+// in the mask reaches it, all the rays of the packet must have directions in the same octant
+static void raycastPacket(const PolyBVH& bvh, RayPacket& packet, uint32_t active_mask,
+	bool neg_x, bool neg_y, bool neg_z, std::vector<uint32_t>& stack)
+{
+	using F = FloatWide;
+	constexpr uint32_t lane_groups = 8 / F::lanes;
+
+	WideVec3<F> origins[lane_groups];
+	WideVec3<F> inv_dirs[lane_groups];
+
+	for (uint32_t group = 0; group < lane_groups; group++) {
+
+		uint32_t lane = group * F::lanes;
+
+		origins[group] = WideVec3<F>::load(packet.origin_x + lane, packet.origin_y + lane, packet.origin_z + lane);
+
+		WideVec3<F> dir = WideVec3<F>::load(packet.dir_x + lane, packet.dir_y + lane, packet.dir_z + lane);
+		inv_dirs[group] = { F::set1(1.f) / dir.x, F::set1(1.f) / dir.y, F::set1(1.f) / dir.z };
+	}
+
+	// node and ray mask pairs
+	stack.clear();
+	stack.push_back(0);
+	stack.push_back(active_mask);
+
+	while (stack.size()) {
+
+		uint32_t mask = stack.back();
+		stack.pop_back();
+
+		const PolyBVH_Node& node = bvh.nodes[stack.back()];
+		stack.pop_back();
+
+		// inner children ordered from near to far by the nearest ray that enters them
+		uint32_t hits[4];
+		uint32_t hit_masks[4];
+		float hit_ts[4];
+		uint32_t hit_count = 0;
+
+		for (uint32_t i = 0; i < 4; i++) {
+
+			if (node.children[i] == 0xFFFF'FFFF) {
+				continue;
+			}
 
-	now_aabbs.resize(1);
-	now_aabbs[0] = &aabbs[root_aabb_idx];
+			F near_x = F::set1(neg_x ? node.max_x[i] : node.min_x[i]);
+			F near_y = F::set1(neg_y ? node.max_y[i] : node.min_y[i]);
+			F near_z = F::set1(neg_z ? node.max_z[i] : node.min_z[i]);
+			F far_x = F::set1(neg_x ? node.min_x[i] : node.max_x[i]);
+			F far_y = F::set1(neg_y ? node.min_y[i] : node.max_y[i]);
+			F far_z = F::set1(neg_z ? node.min_z[i] : node.max_z[i]);
 
-	traced_aabbs.clear();
+			alignas(32) float t_nears[8];
+			uint32_t child_mask = 0;
 
-	// gather AABBs that intersect with ray
-	while (now_aabbs.size()) {
-		next_aabbs.clear();
+			for (uint32_t group = 0; group < lane_groups; group++) {
 
-		for (VertexBoundingBox* now_aabb : now_aabbs) {
+				uint32_t lane = group * F::lanes;
+				WideVec3<F>& origin = origins[group];
+				WideVec3<F>& inv_dir = inv_dirs[group];
 
-			if (now_aabb->aabb.isRayIsect(ray_origin, ray_direction)) {
+				// same NaN handling as the single ray slab test, the running value is second
+				F t_near = maxLanes((near_x - origin.x) * inv_dir.x, F::set1(0.f));
+				t_near = maxLanes((near_y - origin.y) * inv_dir.y, t_near);
+				t_near = maxLanes((near_z - origin.z) * inv_dir.z, t_near);
 
-				if (now_aabb->isLeaf()) {
-					traced_aabbs.push_back(now_aabb);
+				F t_far = minLanes((far_x - origin.x) * inv_dir.x, F::load(packet.closest_t + lane));
+				t_far = minLanes((far_y - origin.y) * inv_dir.y, t_far);
+				t_far = minLanes((far_z - origin.z) * inv_dir.z, t_far);
+
+				child_mask |= moveMask(t_near <= t_far) << lane;
+				t_near.store(t_nears + lane);
+			}
+
+			child_mask &= mask;
+
+			if (child_mask == 0) {
+				continue;
+			}
+
+			// leafs are tested right away
+			if (node.counts[i]) {
+
+				const PolyBVH_TrisBlock& block = bvh.tris_blocks[node.children[i]];
+				uint32_t tris_count = node.counts[i];
+
+				uint32_t ray_count = 0;
+				for (uint32_t lane = 0; lane < 8; lane++) {
+					ray_count += (child_mask >> lane) & 1;
 				}
-				else {
-					// Schedule next
-					for (uint32_t child_idx : now_aabb->children) {
-						next_aabbs.push_back(&aabbs[child_idx]);
+
+				// a packet call tests all rays against 1 triangle and a block call 1 ray against all triangles,
+				// when few rays are left it is cheaper to test them one by one
+				if (ray_count < tris_count) {
+
+					for (uint32_t lane = 0; lane < 8; lane++) {
+
+						if ((child_mask & (1 << lane)) == 0) {
+							continue;
+						}
+
+						WideVec3<F> origin = WideVec3<F>::set1({ packet.origin_x[lane], packet.origin_y[lane], packet.origin_z[lane] });
+						WideVec3<F> dir = WideVec3<F>::set1({ packet.dir_x[lane], packet.dir_y[lane], packet.dir_z[lane] });
+
+						glm::vec2 barycentric;
+						uint32_t tris_lane = raycastTrisBlock(origin, dir, block, tris_count,
+							packet.closest_t[lane], barycentric);
+
+						if (tris_lane != 0xFFFF'FFFF) {
+
+							uint32_t poly_idx = block.polys[tris_lane];
+
+							packet.polys[lane] = poly_idx;
+							packet.poly_tris[lane] = tris_lane > 0 && block.polys[tris_lane - 1] == poly_idx ? 1 : 0;
+							packet.u[lane] = barycentric.x;
+							packet.v[lane] = barycentric.y;
+						}
 					}
+					continue;
+				}
+
+				for (uint32_t lane = 0; lane < tris_count; lane++) {
+
+					uint32_t poly_idx = block.polys[lane];
+					uint32_t poly_tris = lane > 0 && block.polys[lane - 1] == poly_idx ? 1 : 0;
+
+					raycastTrisPacket(packet,
+						{ block.v0_x[lane], block.v0_y[lane], block.v0_z[lane] },
+						{ block.v0v1_x[lane], block.v0v1_y[lane], block.v0v1_z[lane] },
+						{ block.v0v2_x[lane], block.v0v2_y[lane], block.v0v2_z[lane] },
+						poly_idx, poly_tris);
+				}
+				continue;
+			}
+
+			float min_t = FLT_MAX;
+
+			for (uint32_t lane = 0; lane < 8; lane++) {
+				if (child_mask & (1 << lane)) {
+					min_t = std::min(min_t, t_nears[lane]);
 				}
 			}
+
+			uint32_t j = hit_count++;
+			for (; j > 0 && hit_ts[j - 1] > min_t; j--) {
+				hits[j] = hits[j - 1];
+				hit_masks[j] = hit_masks[j - 1];
+				hit_ts[j] = hit_ts[j - 1];
+			}
+			hits[j] = node.children[i];
+			hit_masks[j] = child_mask;
+			hit_ts[j] = min_t;
+		}
+
+		// far first so that the near one is popped next
+		for (uint32_t i = hit_count; i-- > 0;) {
+			stack.push_back(hits[i]);
+			stack.push_back(hit_masks[i]);
+		}
+	}
+}
+
+// Morton codes of positions inside a box with 10 bits per axis,
+// positions close to each other get close codes
+struct MortonGrid {
+	static constexpr uint32_t bits = 10;
+
+	glm::vec3 min;
+	glm::vec3 scale;
+
+	MortonGrid(const AxisBoundingBox3D<>& bounds)
+	{
+		min = bounds.min;
+
+		glm::vec3 extent = bounds.max - bounds.min;
+
+		for (uint32_t axis = 0; axis < 3; axis++) {
+			scale[axis] = extent[axis] > 0 ? ((1 << bits) - 1) / extent[axis] : 0;
+		}
+	}
+
+	uint64_t code(const glm::vec3& position) const
+	{
+		glm::vec3 cell = (position - min) * scale;
+
+		return (spreadMortonBits((uint32_t)cell.z) << 2) | (spreadMortonBits((uint32_t)cell.y) << 1) |
+			spreadMortonBits((uint32_t)cell.x);
+	}
+};
+
+void SculptMesh::raycastBatch(const std::vector<Ray>& rays, std::vector<RayHit>& r_hits) const
+{
+	assert_cond(poly_bvh.is_valid, "poly BVH must be built before querying");
+
+	uint32_t ray_count = rays.size();
+	r_hits.resize(ray_count);
+
+	if (poly_bvh.nodes.empty()) {
+
+		for (RayHit& hit : r_hits) {
+			hit.poly = 0xFFFF'FFFF;
 		}
+		return;
+	}
+
+	// Sort
+	// by direction octant then by the Morton code of the origin so that rays next to each other
+	// go through the same nodes
+	constexpr uint32_t morton_bits = 3 * MortonGrid::bits;
+
+	AxisBoundingBox3D<> origin_bounds;
+	origin_bounds.min = { FLT_MAX, FLT_MAX, FLT_MAX };
+	origin_bounds.max = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
 
-		now_aabbs.swap(next_aabbs);
+	for (const Ray& ray : rays) {
+		origin_bounds.min = glm::min(origin_bounds.min, ray.origin);
+		origin_bounds.max = glm::max(origin_bounds.max, ray.origin);
 	}
 
-	// Depth sort traced AABBs
-	std::sort(traced_aabbs.begin(), traced_aabbs.end(), [&](VertexBoundingBox* a, VertexBoundingBox* b) {
-		float dist_a = glm::distance(ray_origin, a->aabb.max);
-		float dist_b = glm::distance(ray_origin, b->aabb.max);
-		return dist_a < dist_b;
+	MortonGrid grid(origin_bounds);
+
+	struct SortedRay {
+		uint64_t key;
+		uint32_t ray_idx;
+	};
+
+	std::vector<SortedRay> sorted(ray_count);
+
+	auto octant_of = [](const glm::vec3& direction) {
+		return (uint32_t)std::signbit(direction.x) | (uint32_t)std::signbit(direction.y) << 1 |
+			(uint32_t)std::signbit(direction.z) << 2;
+	};
+
+	conc::parallel_for(0u, ray_count, [&](uint32_t ray_idx) {
+
+		const Ray& ray = rays[ray_idx];
+
+		SortedRay& sorted_ray = sorted[ray_idx];
+		sorted_ray.key = (uint64_t)octant_of(ray.direction) << morton_bits | grid.code(ray.origin);
+		sorted_ray.ray_idx = ray_idx;
 	});
 
-	// Find the closest triangle in the closest AABB
-	for (VertexBoundingBox* aabb : traced_aabbs) {
+	conc::parallel_radixsort(sorted.begin(), sorted.end(), [](const SortedRay& sorted_ray) {
+		return (size_t)sorted_ray.key;
+	});
 
-		_tested_edges.clear();
+	// Packets
+	// up to 8 consecutive rays with the same octant
+	std::vector<uint32_t> packet_begins;
+	{
+		uint32_t i = 0;
 
-		uint32_t closest_poly;
-		float closest_distance = FLT_MAX;
-		glm::vec3 closest_isect_position;
+		while (i < ray_count) {
 
-		for (uint32_t v_idx : aabb->verts) {
+			packet_begins.push_back(i);
 
-			if (v_idx != 0xFFFF'FFFF) {
+			uint64_t octant = sorted[i].key >> morton_bits;
+			uint32_t end = std::min(i + 8, ray_count);
 
-				Vertex* vertex = &verts[v_idx];
-				
-				// vertex -> edges -> polys[2]
-				if (vertex->isPoint() == false) {
+			i++;
+			while (i < end && (sorted[i].key >> morton_bits) == octant) {
+				i++;
+			}
+		}
+		packet_begins.push_back(ray_count);
+	}
 
-					uint32_t edge_idx = vertex->edge;
-					Edge* edge = &edges[edge_idx];
+	conc::combinable<QueryContext> contexts;
 
-					do {
-						if (edge->p0 !=  0xFFFF'FFFF) {
+	// packets are handed out in groups so that the context is looked up once per group
+	constexpr uint32_t packets_per_task = 32;
 
-							glm::vec3 isect_position;
-							if (raycastPoly(ray_origin, ray_direction, edge->p0, isect_position)) {
+	uint32_t packet_count = packet_begins.size() - 1;
+	uint32_t task_count = (packet_count + packets_per_task - 1) / packets_per_task;
 
-								float dist = glm::distance(ray_origin, isect_position);
-								if (dist < closest_distance) {
-									closest_distance = dist;
-									closest_poly = edge->p0;
-									closest_isect_position = isect_position;
-								}
-							}
-						}
+	conc::parallel_for(0u, task_count, [&](uint32_t task_idx) {
 
-						if (edge->p1 != 0xFFFF'FFFF) {
+		std::vector<uint32_t>& stack = contexts.local().stack;
 
-							glm::vec3 isect_position;
-							if (raycastPoly(ray_origin, ray_direction, edge->p1, isect_position)) {
+		uint32_t packets_end = std::min((task_idx + 1) * packets_per_task, packet_count);
 
-								float dist = glm::distance(ray_origin, isect_position);
-								if (dist < closest_distance) {
-									closest_distance = dist;
-									closest_poly = edge->p1;
-									closest_isect_position = isect_position;
-								}
-							}
-						}
+		for (uint32_t packet_idx = task_idx * packets_per_task; packet_idx < packets_end; packet_idx++) {
 
-						// mark edge as tested
-						edge->was_raycast_tested = true;
-						_tested_edges.push_back(edge_idx);
+			uint32_t begin = packet_begins[packet_idx];
+			uint32_t count = packet_begins[packet_idx + 1] - begin;
 
-						// Iter
-						edge_idx = edge->nextEdgeOf(v_idx);
-						edge = &edges[edge_idx];
-					}
-					while (edge_idx != vertex->edge);
+			RayPacket packet;
+
+			for (uint32_t lane = 0; lane < 8; lane++) {
+
+				Ray ray = {};
+				if (lane < count) {
+					ray = rays[sorted[begin + lane].ray_idx];
 				}
+
+				packet.origin_x[lane] = ray.origin.x;
+				packet.origin_y[lane] = ray.origin.y;
+				packet.origin_z[lane] = ray.origin.z;
+				packet.dir_x[lane] = ray.direction.x;
+				packet.dir_y[lane] = ray.direction.y;
+				packet.dir_z[lane] = ray.direction.z;
+				packet.closest_t[lane] = FLT_MAX;
+				packet.polys[lane] = 0xFFFF'FFFF;
+				packet.poly_tris[lane] = 0;
+				packet.u[lane] = 0;
+				packet.v[lane] = 0;
+			}
+
+			uint32_t octant = octant_of(rays[sorted[begin].ray_idx].direction);
+
+			raycastPacket(poly_bvh, packet, (1 << count) - 1, octant & 1, octant & 2, octant & 4, stack);
+
+			for (uint32_t lane = 0; lane < count; lane++) {
+
+				RayHit& hit = r_hits[sorted[begin + lane].ray_idx];
+				hit.poly = packet.polys[lane];
+				hit.poly_tris = packet.poly_tris[lane];
+				hit.barycentric = { packet.u[lane], packet.v[lane] };
+				hit.distance = packet.closest_t[lane];
 			}
 		}
+	});
+}
+
+// finds the triangle of the block closest to the position if it is closer than r_closest_dist_sqr,
+// returns its lane or 0xFFFF'FFFF if there is none
+static uint32_t closestPointTrisBlock(const WideVec3<FloatWide>& pos, const PolyBVH_TrisBlock& block,
+	uint32_t tris_count, float& r_closest_dist_sqr, glm::vec2& r_barycentric)
+{
+	using F = FloatWide;
+
+	alignas(32) float dist_sqrs[8];
+	alignas(32) float us[8];
+	alignas(32) float vs[8];
+
+	for (uint32_t lane = 0; lane < tris_count; lane += F::lanes) {
+
+		WideVec3<F> v0 = WideVec3<F>::load(block.v0_x + lane, block.v0_y + lane, block.v0_z + lane);
+		WideVec3<F> v0v1 = WideVec3<F>::load(block.v0v1_x + lane, block.v0v1_y + lane, block.v0v1_z + lane);
+		WideVec3<F> v0v2 = WideVec3<F>::load(block.v0v2_x + lane, block.v0v2_y + lane, block.v0v2_z + lane);
+
+		F u;
+		F v;
+		closestPointTrisWide(pos, v0, v0v1, v0v2, u, v).store(dist_sqrs + lane);
+		u.store(us + lane);
+		v.store(vs + lane);
+	}
+
+	// the unused lanes are zero sized triangles at the origin so they are skipped here
+	uint32_t closest_lane = 0xFFFF'FFFF;
+
+	for (uint32_t lane = 0; lane < tris_count; lane++) {
+
+		if (dist_sqrs[lane] < r_closest_dist_sqr) {
+			r_closest_dist_sqr = dist_sqrs[lane];
+			closest_lane = lane;
+		}
+	}
+
+	if (closest_lane != 0xFFFF'FFFF) {
+		r_barycentric = { us[closest_lane], vs[closest_lane] };
+	}
+
+	return closest_lane;
+}
+
+bool SculptMesh::closestPoint(QueryContext& context, const glm::vec3& position, float max_distance,
+	ClosestPoint& r_closest) const
+{
+	assert_cond(poly_bvh.is_valid, "poly BVH must be built before querying");
+
+	r_closest.poly = 0xFFFF'FFFF;
+
+	if (poly_bvh.nodes.empty()) {
+		return false;
+	}
+
+	WideVec3<FloatWide> wide_position = WideVec3<FloatWide>::set1(position);
+
+	__m128 pos_x = _mm_set1_ps(position.x);
+	__m128 pos_y = _mm_set1_ps(position.y);
+	__m128 pos_z = _mm_set1_ps(position.z);
+
+	float closest_dist_sqr = std::min(max_distance * max_distance, FLT_MAX);
+	const PolyBVH_TrisBlock* closest_block = nullptr;
+	uint32_t closest_lane = 0;
+	glm::vec2 closest_barycentric;
+
+	// min heap on the distance to the node bounds, once the closest node is farther than the closest
+	// triangle found so far no other node can hold a closer one
+	std::vector<std::pair<float, uint32_t>>& queue = context.node_queue;
+	queue.clear();
+	queue.push_back({ 0.f, 0 });
+
+	auto farther = [](const std::pair<float, uint32_t>& a, const std::pair<float, uint32_t>& b) {
+		return a.first > b.first;
+	};
+
+	while (queue.size()) {
+
+		std::pop_heap(queue.begin(), queue.end(), farther);
+		auto [node_dist_sqr, node_idx] = queue.back();
+		queue.pop_back();
 
-		// mark all tested edges as untested for next function call
-		for (uint32_t edge_idx : _tested_edges) {
-			edges[edge_idx].was_raycast_tested = false;
+		if (node_dist_sqr >= closest_dist_sqr) {
+			break;
 		}
 
-		// stop at the first (closest) AABB for hit
-		if (closest_distance != FLT_MAX) {
-			
-			r_isect_poly = closest_poly;
-			r_isect_position = closest_isect_position;
-			return true;
+		const PolyBVH_Node& node = poly_bvh.nodes[node_idx];
+
+		// distance to the bounds of the 4 children at once, zero on the axes where the position is inside,
+		// unused children have inverted bounds that are infinitely far
+		__m128 delta_x = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_load_ps(node.min_x), pos_x),
+			_mm_sub_ps(pos_x, _mm_load_ps(node.max_x))), _mm_setzero_ps());
+		__m128 delta_y = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_load_ps(node.min_y), pos_y),
+			_mm_sub_ps(pos_y, _mm_load_ps(node.max_y))), _mm_setzero_ps());
+		__m128 delta_z = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_load_ps(node.min_z), pos_z),
+			_mm_sub_ps(pos_z, _mm_load_ps(node.max_z))), _mm_setzero_ps());
+
+		__m128 dist_sqr = _mm_add_ps(_mm_add_ps(_mm_mul_ps(delta_x, delta_x), _mm_mul_ps(delta_y, delta_y)),
+			_mm_mul_ps(delta_z, delta_z));
+
+		alignas(16) float child_dist_sqrs[4];
+		_mm_store_ps(child_dist_sqrs, dist_sqr);
+
+		// leafs are tested right away so that the bound shrinks before more nodes are queued
+		for (uint32_t i = 0; i < 4; i++) {
+
+			if (node.children[i] == 0xFFFF'FFFF || child_dist_sqrs[i] >= closest_dist_sqr) {
+				continue;
+			}
+
+			if (node.counts[i] == 0) {
+				queue.push_back({ child_dist_sqrs[i], node.children[i] });
+				std::push_heap(queue.begin(), queue.end(), farther);
+				continue;
+			}
+
+			const PolyBVH_TrisBlock& block = poly_bvh.tris_blocks[node.children[i]];
+
+			glm::vec2 barycentric;
+			uint32_t lane = closestPointTrisBlock(wide_position, block, node.counts[i],
+				closest_dist_sqr, barycentric);
+
+			if (lane != 0xFFFF'FFFF) {
+				closest_block = &block;
+				closest_lane = lane;
+				closest_barycentric = barycentric;
+			}
 		}
 	}
 
-	return false;
+	if (closest_block == nullptr) {
+		return false;
+	}
+
+	const PolyBVH_TrisBlock& block = *closest_block;
+	uint32_t lane = closest_lane;
+
+	glm::vec3 v0 = { block.v0_x[lane], block.v0_y[lane], block.v0_z[lane] };
+	glm::vec3 v0v1 = { block.v0v1_x[lane], block.v0v1_y[lane], block.v0v1_z[lane] };
+	glm::vec3 v0v2 = { block.v0v2_x[lane], block.v0v2_y[lane], block.v0v2_z[lane] };
+
+	r_closest.poly = block.polys[lane];
+	r_closest.poly_tris = lane > 0 && block.polys[lane - 1] == block.polys[lane] ? 1 : 0;
+	r_closest.barycentric = closest_barycentric;
+	r_closest.position = v0 + v0v1 * closest_barycentric.x + v0v2 * closest_barycentric.y;
+	r_closest.distance = std::sqrt(closest_dist_sqr);
+	return true;
+}
+
+void SculptMesh::closestPointBatch(const std::vector<glm::vec3>& positions, float max_distance,
+	std::vector<ClosestPoint>& r_closest) const
+{
+	uint32_t position_count = positions.size();
+	r_closest.resize(position_count);
+
+	// Sort
+	// by Morton code so that consecutive queries visit the same nodes while they are in cache
+	AxisBoundingBox3D<> bounds;
+	bounds.min = { FLT_MAX, FLT_MAX, FLT_MAX };
+	bounds.max = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+
+	for (const glm::vec3& position : positions) {
+		bounds.min = glm::min(bounds.min, position);
+		bounds.max = glm::max(bounds.max, position);
+	}
+
+	MortonGrid grid(bounds);
+
+	struct SortedPosition {
+		uint64_t key;
+		uint32_t position_idx;
+	};
+
+	std::vector<SortedPosition> sorted(position_count);
+
+	conc::parallel_for(0u, position_count, [&](uint32_t position_idx) {
+		sorted[position_idx] = { grid.code(positions[position_idx]), position_idx };
+	});
+
+	conc::parallel_radixsort(sorted.begin(), sorted.end(), [](const SortedPosition& sorted_position) {
+		return (size_t)sorted_position.key;
+	});
+
+	conc::combinable<QueryContext> contexts;
+
+	// positions are handed out in groups so that the context is looked up once per group
+	constexpr uint32_t positions_per_task = 256;
+
+	uint32_t task_count = (position_count + positions_per_task - 1) / positions_per_task;
+
+	conc::parallel_for(0u, task_count, [&](uint32_t task_idx) {
+
+		QueryContext& context = contexts.local();
+
+		uint32_t positions_end = std::min((task_idx + 1) * positions_per_task, position_count);
+
+		for (uint32_t i = task_idx * positions_per_task; i < positions_end; i++) {
+
+			uint32_t position_idx = sorted[i].position_idx;
+			closestPoint(context, positions[position_idx], max_distance, r_closest[position_idx]);
+		}
+	});
+}
+
+enum class Overlap {
+	OUTSIDE,
+	PARTIAL,
+	INSIDE
+};
+
+// sorts the octree leafs touched by a range into the ones fully inside it and the ones crossing its border,
+// classify(aabb) must only return INSIDE if every point of the box is in the range
+template<typename Classify>
+static void gatherOctreeLeafs(const SculptMesh& mesh, QueryContext& context, Classify classify)
+{
+	// children of an inside node are inside without classifying them
+	constexpr uint32_t inside_bit = 0x8000'0000;
+
+	std::vector<uint32_t>& stack = context.stack;
+	stack.clear();
+	stack.push_back(mesh.root_aabb_idx);
+
+	context.inside_leafs.clear();
+	context.partial_leafs.clear();
+
+	while (stack.size()) {
+
+		uint32_t entry = stack.back();
+		stack.pop_back();
+
+		uint32_t aabb_idx = entry & ~inside_bit;
+		const VertexBoundingBox& aabb = mesh.aabbs[aabb_idx];
+
+		Overlap overlap = entry & inside_bit ? Overlap::INSIDE : classify(aabb.aabb);
+
+		if (overlap == Overlap::OUTSIDE) {
+			continue;
+		}
+
+		if (aabb.isLeaf()) {
+
+			if (aabb.hasVertices()) {
+
+				if (overlap == Overlap::INSIDE) {
+					context.inside_leafs.push_back(aabb_idx);
+				}
+				else {
+					context.partial_leafs.push_back(aabb_idx);
+				}
+			}
+		}
+		else {
+			for (uint32_t child_idx : aabb.children) {
+				stack.push_back(overlap == Overlap::INSIDE ? child_idx | inside_bit : child_idx);
+			}
+		}
+	}
+}
+
+// writes the vertices of the gathered leafs that dist_sqr_of(position) puts within radius_sqr,
+// the vertices of inside leafs are copied as a block with only their distance computed
+template<typename DistSqr>
+static void gatherLeafVerts(const SculptMesh& mesh, QueryContext& context, float radius_sqr, DistSqr dist_sqr_of,
+	std::vector<uint32_t>& r_verts, std::vector<float>& r_dist_sqrs)
+{
+	std::vector<uint32_t>& inside_leafs = context.inside_leafs;
+	std::vector<uint32_t>& partial_leafs = context.partial_leafs;
+	std::vector<uint32_t>& offsets = context.leaf_offsets;
+
+	uint32_t inside_count = inside_leafs.size();
+	uint32_t leaf_count = inside_count + partial_leafs.size();
+
+	auto leaf_of = [&](uint32_t i) -> const VertexBoundingBox& {
+		return mesh.aabbs[i < inside_count ? inside_leafs[i] : partial_leafs[i - inside_count]];
+	};
+
+	// big ranges are split between threads by leaf
+	uint32_t candidate_count = 0;
+
+	for (uint32_t i = 0; i < leaf_count; i++) {
+		candidate_count += leaf_of(i).vertexCount();
+	}
+
+	auto for_each_leaf = [&](auto func) {
+
+		if (candidate_count > 16384) {
+			conc::parallel_for(0u, leaf_count, func);
+		}
+		else {
+			for (uint32_t i = 0; i < leaf_count; i++) {
+				func(i);
+			}
+		}
+	};
+
+	// Counting
+	offsets.resize(leaf_count + 1);
+
+	for_each_leaf([&](uint32_t i) {
+
+		const VertexBoundingBox& leaf = leaf_of(i);
+
+		if (i < inside_count) {
+			offsets[i] = leaf.vertexCount();
+			return;
+		}
+
+		uint32_t count = 0;
+
+		for (uint32_t j = leaf.verts_begin; j < leaf.verts_end; j++) {
+			count += dist_sqr_of(mesh.vert_positions[mesh.aabb_vert_indexes[j]]) <= radius_sqr;
+		}
+		offsets[i] = count;
+	});
+
+	uint32_t offset = 0;
+
+	for (uint32_t i = 0; i < leaf_count; i++) {
+		uint32_t count = offsets[i];
+		offsets[i] = offset;
+		offset += count;
+	}
+	offsets[leaf_count] = offset;
+
+	r_verts.resize(offset);
+	r_dist_sqrs.resize(offset);
+
+	// Filling
+	for_each_leaf([&](uint32_t i) {
+
+		const VertexBoundingBox& leaf = leaf_of(i);
+		uint32_t out = offsets[i];
+
+		if (i < inside_count) {
+
+			std::copy(mesh.aabb_vert_indexes.begin() + leaf.verts_begin, mesh.aabb_vert_indexes.begin() + leaf.verts_end,
+				r_verts.begin() + out);
+
+			for (uint32_t j = leaf.verts_begin; j < leaf.verts_end; j++, out++) {
+				r_dist_sqrs[out] = dist_sqr_of(mesh.vert_positions[mesh.aabb_vert_indexes[j]]);
+			}
+			return;
+		}
+
+		for (uint32_t j = leaf.verts_begin; j < leaf.verts_end; j++) {
+
+			uint32_t vertex_idx = mesh.aabb_vert_indexes[j];
+			float dist_sqr = dist_sqr_of(mesh.vert_positions[vertex_idx]);
+
+			if (dist_sqr <= radius_sqr) {
+				r_verts[out] = vertex_idx;
+				r_dist_sqrs[out] = dist_sqr;
+				out++;
+			}
+		}
+	});
+}
+
+// vertices can sit a few ULP outside of their leaf after the Morton rebuild, so node tests leave some room
+static float octreeMargin(const SculptMesh& mesh)
+{
+	AxisBoundingBox3D<> root = mesh.aabbs[mesh.root_aabb_idx].aabb;
+	return root.sizeX() * 1e-5f;
+}
+
+void SculptMesh::sphereQuery(QueryContext& context, const glm::vec3& center, float radius,
+	std::vector<uint32_t>& r_verts, std::vector<float>& r_dist_sqrs) const
+{
+	float margin = octreeMargin(*this);
+	float radius_sqr = radius * radius;
+	float inside_radius = std::max(radius - margin, 0.f);
+
+	gatherOctreeLeafs(*this, context, [&](const AxisBoundingBox3D<>& aabb) {
+
+		glm::vec3 closest = glm::clamp(center, aabb.min - margin, aabb.max + margin);
+		glm::vec3 to_closest = closest - center;
+
+		if (glm::dot(to_closest, to_closest) > radius_sqr) {
+			return Overlap::OUTSIDE;
+		}
+
+		glm::vec3 to_farthest = glm::max(glm::abs(center - aabb.min), glm::abs(center - aabb.max));
+
+		if (glm::dot(to_farthest, to_farthest) <= inside_radius * inside_radius) {
+			return Overlap::INSIDE;
+		}
+		return Overlap::PARTIAL;
+	});
+
+	gatherLeafVerts(*this, context, radius_sqr,
+		[&](const glm::vec3& pos) {
+			glm::vec3 delta = pos - center;
+			return glm::dot(delta, delta);
+		},
+		r_verts, r_dist_sqrs);
+}
+
+void SculptMesh::capsuleQuery(QueryContext& context, const glm::vec3& start, const glm::vec3& end, float radius,
+	std::vector<uint32_t>& r_verts, std::vector<float>& r_dist_sqrs) const
+{
+	float margin = octreeMargin(*this);
+	float radius_sqr = radius * radius;
+	float inside_radius = std::max(radius - margin, 0.f);
+
+	glm::vec3 segment = end - start;
+	float segment_length_sqr = glm::dot(segment, segment);
+
+	auto dist_sqr_of = [&](const glm::vec3& pos) {
+
+		float t = 0;
+		if (segment_length_sqr > 0) {
+			t = glm::clamp(glm::dot(pos - start, segment) / segment_length_sqr, 0.f, 1.f);
+		}
+
+		glm::vec3 delta = pos - (start + segment * t);
+		return glm::dot(delta, delta);
+	};
+
+	glm::vec3 capsule_min = glm::min(start, end) - radius;
+	glm::vec3 capsule_max = glm::max(start, end) + radius;
+
+	gatherOctreeLeafs(*this, context, [&](const AxisBoundingBox3D<>& aabb) {
+
+		if (glm::any(glm::greaterThan(aabb.min - margin, capsule_max)) ||
+			glm::any(glm::lessThan(aabb.max + margin, capsule_min)))
+		{
+			return Overlap::OUTSIDE;
+		}
+
+		// the nodes are cubes so their bounding sphere is tight enough to cull with
+		glm::vec3 half_size = (aabb.max - aabb.min) * 0.5f;
+		float outside_radius = radius + glm::length(half_size) + margin;
+
+		if (dist_sqr_of(aabb.min + half_size) > outside_radius * outside_radius) {
+			return Overlap::OUTSIDE;
+		}
+
+		// the capsule is convex so the box is inside if all its corners are
+		for (uint32_t corner = 0; corner < 8; corner++) {
+
+			glm::vec3 pos = {
+				corner & 1 ? aabb.max.x : aabb.min.x,
+				corner & 2 ? aabb.max.y : aabb.min.y,
+				corner & 4 ? aabb.max.z : aabb.min.z
+			};
+
+			if (dist_sqr_of(pos) > inside_radius * inside_radius) {
+				return Overlap::PARTIAL;
+			}
+		}
+		return Overlap::INSIDE;
+	});
+
+	gatherLeafVerts(*this, context, radius_sqr, dist_sqr_of, r_verts, r_dist_sqrs);
+}
+
+// Selection
+
+static bool isBitSet(const std::vector<uint64_t>& bits, uint32_t idx)
+{
+	return (bits[idx >> 6] & (1ULL << (idx & 63))) != 0;
+}
+
+// the box grown so that it holds the vertices that sit a few ULP outside their leaf
+static AxisBoundingBox3D<> inflatedLeafBox(const AxisBoundingBox3D<>& aabb, float margin)
+{
+	AxisBoundingBox3D<> inflated;
+	inflated.min = aabb.min - margin;
+	inflated.max = aabb.max + margin;
+	return inflated;
+}
+
+// planes are (normal, distance) and points with dot(normal, point) + distance >= 0 are inside
+static Overlap classifyPlanes(const AxisBoundingBox3D<>& aabb, const glm::vec4* planes, uint32_t plane_count)
+{
+	Overlap overlap = Overlap::INSIDE;
+
+	for (uint32_t i = 0; i < plane_count; i++) {
+
+		const glm::vec4& plane = planes[i];
+		glm::vec3 normal = plane;
+
+		// corners farthest along and against the normal
+		glm::vec3 positive = glm::mix(aabb.min, aabb.max, glm::greaterThanEqual(normal, glm::vec3(0)));
+		glm::vec3 negative = glm::mix(aabb.max, aabb.min, glm::greaterThanEqual(normal, glm::vec3(0)));
+
+		if (glm::dot(normal, positive) + plane.w < 0) {
+			return Overlap::OUTSIDE;
+		}
+
+		if (glm::dot(normal, negative) + plane.w < 0) {
+			overlap = Overlap::PARTIAL;
+		}
+	}
+
+	return overlap;
+}
+
+// the planes of the screen rectangle, the near and the far plane in the space local_to_clip transforms from,
+// clip z goes from 0 to w
+static std::array<glm::vec4, 6> rectFrustumPlanes(const glm::mat4& local_to_clip,
+	const glm::vec2& ndc_min, const glm::vec2& ndc_max)
+{
+	glm::vec4 rows[4];
+
+	for (uint32_t i = 0; i < 4; i++) {
+		rows[i] = { local_to_clip[0][i], local_to_clip[1][i], local_to_clip[2][i], local_to_clip[3][i] };
+	}
+
+	return {
+		rows[0] - ndc_min.x * rows[3],
+		ndc_max.x * rows[3] - rows[0],
+		rows[1] - ndc_min.y * rows[3],
+		ndc_max.y * rows[3] - rows[1],
+		rows[2],
+		rows[3] - rows[2]
+	};
+}
+
+static bool isVisible(const SelectionDepth* depth, const glm::vec4& clip)
+{
+	if (depth == nullptr) {
+		return true;
+	}
+
+	glm::vec3 ndc = glm::vec3(clip) / clip.w;
+
+	float x = (ndc.x * 0.5f + 0.5f) * depth->width;
+	float y = (0.5f - ndc.y * 0.5f) * depth->height;
+
+	uint32_t pixel_x = (uint32_t)glm::clamp(x, 0.f, (float)(depth->width - 1));
+	uint32_t pixel_y = (uint32_t)glm::clamp(y, 0.f, (float)(depth->height - 1));
+
+	return ndc.z <= depth->depths[pixel_y * depth->width + pixel_x] + depth->bias;
+}
+
+// even-odd rule
+static bool isInsideLasso(const std::vector<glm::vec2>& lasso, const glm::vec2& point)
+{
+	bool inside = false;
+
+	for (uint32_t i = 0, j = lasso.size() - 1; i < lasso.size(); j = i++) {
+
+		const glm::vec2& a = lasso[i];
+		const glm::vec2& b = lasso[j];
+
+		if ((a.y > point.y) != (b.y > point.y) &&
+			point.x < (b.x - a.x) * (point.y - a.y) / (b.y - a.y) + a.x)
+		{
+			inside = !inside;
+		}
+	}
+
+	return inside;
+}
+
+// does any part of the segment lie in the rectangle
+static bool isSegmentInRect(const glm::vec2& a, const glm::vec2& b, const glm::vec2& rect_min, const glm::vec2& rect_max)
+{
+	glm::vec2 delta = b - a;
+	float t_begin = 0;
+	float t_end = 1;
+
+	for (uint32_t axis = 0; axis < 2; axis++) {
+
+		if (delta[axis] == 0) {
+
+			if (a[axis] < rect_min[axis] || a[axis] > rect_max[axis]) {
+				return false;
+			}
+			continue;
+		}
+
+		float t_min = (rect_min[axis] - a[axis]) / delta[axis];
+		float t_max = (rect_max[axis] - a[axis]) / delta[axis];
+
+		if (t_min > t_max) {
+			std::swap(t_min, t_max);
+		}
+
+		t_begin = std::max(t_begin, t_min);
+		t_end = std::min(t_end, t_max);
+
+		if (t_begin > t_end) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+// one cleared bit per vertex index
+static void clearVertexBits(const SculptMesh& mesh, std::vector<uint64_t>& r_bits)
+{
+	uint32_t vertex_end = mesh.verts.size() ? mesh.verts.lastIndex() + 1 : 0;
+	r_bits.assign((vertex_end + 63) / 64, 0);
+}
+
+// fills the vertex bitset from the leafs gathered for a selection shape,
+// select(vertex, inside) decides for the vertices of inside and partial leafs,
+// only the vertices of the gathered leafs are read
+template<typename Select>
+static void selectLeafVerts(const SculptMesh& mesh, QueryContext& context, Select select,
+	std::vector<uint64_t>& r_selected)
+{
+	clearVertexBits(mesh, r_selected);
+
+	std::vector<uint32_t>& inside_leafs = context.inside_leafs;
+	std::vector<uint32_t>& partial_leafs = context.partial_leafs;
+
+	uint32_t inside_count = inside_leafs.size();
+	uint32_t leaf_count = inside_count + partial_leafs.size();
+
+	// the vertices of different leafs may share a word so the words are written with an atomic OR
+	auto write_bits = [&](uint32_t word_idx, uint64_t bits) {
+		if (bits) {
+			_InterlockedOr64((volatile int64_t*)&r_selected[word_idx], (int64_t)bits);
+		}
+	};
+
+	conc::parallel_for(0u, leaf_count, [&](uint32_t i) {
+
+		bool inside = i < inside_count;
+		const VertexBoundingBox& leaf = mesh.aabbs[inside ? inside_leafs[i] : partial_leafs[i - inside_count]];
+
+		// consecutive vertices of the same word are gathered before writing
+		uint32_t word_idx = 0;
+		uint64_t bits = 0;
+
+		for (uint32_t j = leaf.verts_begin; j < leaf.verts_end; j++) {
+
+			uint32_t vertex_idx = mesh.aabb_vert_indexes[j];
+
+			if (select(vertex_idx, inside) == false) {
+				continue;
+			}
+
+			if (vertex_idx >> 6 != word_idx) {
+				write_bits(word_idx, bits);
+				word_idx = vertex_idx >> 6;
+				bits = 0;
+			}
+
+			bits |= 1ULL << (vertex_idx & 63);
+		}
+
+		write_bits(word_idx, bits);
+	});
+}
+
+void SculptMesh::selectVertsInRect(QueryContext& context, const glm::mat4& local_to_clip,
+	const glm::vec2& ndc_min, const glm::vec2& ndc_max, const SelectionDepth* depth,
+	std::vector<uint64_t>& r_selected) const
+{
+	float margin = octreeMargin(*this);
+	std::array<glm::vec4, 6> planes = rectFrustumPlanes(local_to_clip, ndc_min, ndc_max);
+
+	gatherOctreeLeafs(*this, context, [&](const AxisBoundingBox3D<>& aabb) {
+		return classifyPlanes(inflatedLeafBox(aabb, margin), planes.data(), 6);
+	});
+
+	selectLeafVerts(*this, context, [&](uint32_t vertex_idx, bool inside) {
+
+		glm::vec4 pos = glm::vec4(vert_positions[vertex_idx], 1);
+
+		if (inside == false) {
+			for (glm::vec4& plane : planes) {
+				if (glm::dot(plane, pos) < 0) {
+					return false;
+				}
+			}
+		}
+
+		return depth == nullptr || isVisible(depth, local_to_clip * pos);
+	},
+	r_selected);
+}
+
+void SculptMesh::selectVertsInBox(QueryContext& context, const AxisBoundingBox3D<>& box,
+	std::vector<uint64_t>& r_selected) const
+{
+	float margin = octreeMargin(*this);
+
+	gatherOctreeLeafs(*this, context, [&](const AxisBoundingBox3D<>& aabb) {
+
+		AxisBoundingBox3D<> inflated = inflatedLeafBox(aabb, margin);
+
+		if (glm::any(glm::greaterThan(inflated.min, box.max)) || glm::any(glm::lessThan(inflated.max, box.min))) {
+			return Overlap::OUTSIDE;
+		}
+
+		if (glm::all(glm::greaterThanEqual(inflated.min, box.min)) && glm::all(glm::lessThanEqual(inflated.max, box.max))) {
+			return Overlap::INSIDE;
+		}
+		return Overlap::PARTIAL;
+	});
+
+	selectLeafVerts(*this, context, [&](uint32_t vertex_idx, bool inside) {
+
+		const glm::vec3& pos = vert_positions[vertex_idx];
+
+		return inside ||
+			(glm::all(glm::greaterThanEqual(pos, box.min)) && glm::all(glm::lessThanEqual(pos, box.max)));
+	},
+	r_selected);
+}
+
+void SculptMesh::selectVertsInLasso(QueryContext& context, const glm::mat4& local_to_clip,
+	const std::vector<glm::vec2>& lasso, const SelectionDepth* depth,
+	std::vector<uint64_t>& r_selected) const
+{
+	if (lasso.size() < 3) {
+		clearVertexBits(*this, r_selected);
+		return;
+	}
+
+	float margin = octreeMargin(*this);
+
+	glm::vec2 lasso_min = lasso[0];
+	glm::vec2 lasso_max = lasso[0];
+
+	for (const glm::vec2& point : lasso) {
+		lasso_min = glm::min(lasso_min, point);
+		lasso_max = glm::max(lasso_max, point);
+	}
+
+	// the frustum around the lasso so that nodes off screen or past the near and far planes are culled
+	std::array<glm::vec4, 6> planes = rectFrustumPlanes(local_to_clip, lasso_min, lasso_max);
+
+	gatherOctreeLeafs(*this, context, [&](const AxisBoundingBox3D<>& aabb) {
+
+		AxisBoundingBox3D<> inflated = inflatedLeafBox(aabb, margin);
+
+		Overlap overlap = classifyPlanes(inflated, planes.data(), 6);
+
+		if (overlap != Overlap::INSIDE) {
+			return overlap;
+		}
+
+		// inside the frustum every corner is in front of the camera and can be projected
+		glm::vec2 rect_min = { FLT_MAX, FLT_MAX };
+		glm::vec2 rect_max = { -FLT_MAX, -FLT_MAX };
+
+		for (uint32_t corner = 0; corner < 8; corner++) {
+
+			glm::vec4 pos = {
+				corner & 1 ? inflated.max.x : inflated.min.x,
+				corner & 2 ? inflated.max.y : inflated.min.y,
+				corner & 4 ? inflated.max.z : inflated.min.z,
+				1
+			};
+
+			glm::vec4 clip = local_to_clip * pos;
+			glm::vec2 ndc = glm::vec2(clip) / clip.w;
+
+			rect_min = glm::min(rect_min, ndc);
+			rect_max = glm::max(rect_max, ndc);
+		}
+
+		// without the lasso crossing the rectangle all of it is on the same side
+		for (uint32_t i = 0, j = lasso.size() - 1; i < lasso.size(); j = i++) {
+			if (isSegmentInRect(lasso[j], lasso[i], rect_min, rect_max)) {
+				return Overlap::PARTIAL;
+			}
+		}
+
+		return isInsideLasso(lasso, rect_min) ? Overlap::INSIDE : Overlap::OUTSIDE;
+	});
+
+	selectLeafVerts(*this, context, [&](uint32_t vertex_idx, bool inside) {
+
+		glm::vec4 clip = local_to_clip * glm::vec4(vert_positions[vertex_idx], 1);
+
+		if (inside == false) {
+
+			if (clip.z < 0 || clip.z > clip.w) {
+				return false;
+			}
+
+			if (isInsideLasso(lasso, glm::vec2(clip) / clip.w) == false) {
+				return false;
+			}
+		}
+
+		return isVisible(depth, clip);
+	},
+	r_selected);
+}
+
+void SculptMesh::selectPolysFromVerts(const std::vector<uint64_t>& selected_verts,
+	std::vector<uint64_t>& r_selected_polys) const
+{
+	uint32_t poly_end = polys.size() ? polys.lastIndex() + 1 : 0;
+	uint32_t word_count = (poly_end + 63) / 64;
+
+	r_selected_polys.resize(word_count);
+
+	conc::parallel_for(0u, word_count, [&](uint32_t word_idx) {
+
+		uint64_t bits = 0;
+		uint32_t bits_end = std::min(64u, poly_end - word_idx * 64);
+
+		for (uint32_t bit = 0; bit < bits_end; bit++) {
+
+			uint32_t poly_idx = word_idx * 64 + bit;
+
+			if (polys.isDeleted(poly_idx)) {
+				continue;
+			}
+
+			// every vertex of the poly is on one of its edges
+			const Poly& poly = polys[poly_idx];
+			uint32_t edge_count = poly.is_tris ? 3 : 4;
+			bool all_selected = true;
+
+			for (uint32_t i = 0; i < edge_count && all_selected; i++) {
+
+				const Edge& edge = edges[poly.edges[i]];
+				all_selected = isBitSet(selected_verts, edge.v0) && isBitSet(selected_verts, edge.v1);
+			}
+
+			if (all_selected) {
+				bits |= 1ULL << bit;
+			}
+		}
+
+		r_selected_polys[word_idx] = bits;
+	});
+}
+
+void SculptMesh::selectEdgesFromVerts(const std::vector<uint64_t>& selected_verts,
+	std::vector<uint64_t>& r_selected_edges) const
+{
+	uint32_t edge_end = edges.size() ? edges.lastIndex() + 1 : 0;
+	uint32_t word_count = (edge_end + 63) / 64;
+
+	r_selected_edges.resize(word_count);
+
+	conc::parallel_for(0u, word_count, [&](uint32_t word_idx) {
+
+		uint64_t bits = 0;
+		uint32_t bits_end = std::min(64u, edge_end - word_idx * 64);
+
+		for (uint32_t bit = 0; bit < bits_end; bit++) {
+
+			uint32_t edge_idx = word_idx * 64 + bit;
+
+			if (edges.isDeleted(edge_idx)) {
+				continue;
+			}
+
+			const Edge& edge = edges[edge_idx];
+
+			if (isBitSet(selected_verts, edge.v0) && isBitSet(selected_verts, edge.v1)) {
+				bits |= 1ULL << bit;
+			}
+		}
+
+		r_selected_edges[word_idx] = bits;
+	});
 }
\ No newline at end of file
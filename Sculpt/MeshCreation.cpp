@@ -4,8 +4,12 @@
 
 #include "Renderer.hpp"
 
+#include <atomic>
+#include <ppl.h>
+
 
 using namespace scme;
+namespace conc = concurrency;
 
 
 void SculptMesh::init()
@@ -54,12 +58,12 @@ void SculptMesh::init()
 
 void SculptMesh::createAsTriangle(float size, uint32_t max_vertices_AABB)
 {
-	verts.resize(3);
+	_resizeVertexMemory(3);
 
 	float half = size / 2;
-	verts[0].pos = { 0, half, 0 };
-	verts[1].pos = { half, -half, 0 };
-	verts[2].pos = { -half, -half, 0 };
+	vert_positions[0] = { 0, half, 0 };
+	vert_positions[1] = { half, -half, 0 };
+	vert_positions[2] = { -half, -half, 0 };
 
 	for (uint8_t i = 0; i < 3; i++) {
 		verts[i].init();
@@ -75,13 +79,13 @@ void SculptMesh::createAsTriangle(float size, uint32_t max_vertices_AABB)
 
 void SculptMesh::createAsQuad(float size, uint32_t max_vertices_AABB)
 {
-	verts.resize(4);
+	_resizeVertexMemory(4);
 
 	float half = size / 2;
-	verts[0].pos = { -half, half, 0 };
-	verts[1].pos = { half, half, 0 };
-	verts[2].pos = { half, -half, 0 };
-	verts[3].pos = { -half, -half, 0 };
+	vert_positions[0] = { -half, half, 0 };
+	vert_positions[1] = { half, half, 0 };
+	vert_positions[2] = { half, -half, 0 };
+	vert_positions[3] = { -half, -half, 0 };
 
 	for (uint8_t i = 0; i < 4; i++) {
 		verts[i].init();
@@ -107,47 +111,46 @@ void SculptMesh::createAsQuad(float size, uint32_t max_vertices_AABB)
 */
 void SculptMesh::createAsWavyGrid(float size, uint32_t max_vertices_AABB)
 {
-	verts.resize(25);
+	_resizeVertexMemory(25);
 
 	uint32_t rows = 5;
 	uint32_t cols = 5;
 
-	for (auto iter = verts.begin(); iter != verts.end(); iter.next()) {
-		Vertex& vertex = iter.get();
-		vertex.init();
-
-		markVertexFullUpdate(iter.index());
+	for (uint32_t i = 0; i < 25; i++) {
+		verts[i].init();
 	}
 
-	verts[0].pos.z = 0;
-	verts[1].pos.z = 0.1f;
-	verts[2].pos.z = 0;
-	verts[3].pos.z = -0.1f;
-	verts[4].pos.z = 0;
-
-	verts[5].pos.z = 0;
-	verts[6].pos.z = 0.15f;
-	verts[7].pos.z = -0.22f;
-	verts[8].pos.z = 0;
-	verts[9].pos.z = 0.08f;
-
-	verts[10].pos.z = 0;
-	verts[11].pos.z = 0;
-	verts[12].pos.z = 0.07f;
-	verts[13].pos.z = 0;
-	verts[14].pos.z = 0;
-
-	verts[15].pos.z = -0.1f;
-	verts[16].pos.z = 0;
-	verts[17].pos.z = 0;
-	verts[18].pos.z = 0;
-	verts[19].pos.z = -0.03f;
-
-	verts[20].pos.z = 0;
-	verts[21].pos.z = 0;
-	verts[22].pos.z = 0.18f;
-	verts[23].pos.z = 0;
-	verts[24].pos.z = -0.1f;
+	markAllVerticesFullUpdate();
+
+	vert_positions[0].z = 0;
+	vert_positions[1].z = 0.1f;
+	vert_positions[2].z = 0;
+	vert_positions[3].z = -0.1f;
+	vert_positions[4].z = 0;
+
+	vert_positions[5].z = 0;
+	vert_positions[6].z = 0.15f;
+	vert_positions[7].z = -0.22f;
+	vert_positions[8].z = 0;
+	vert_positions[9].z = 0.08f;
+
+	vert_positions[10].z = 0;
+	vert_positions[11].z = 0;
+	vert_positions[12].z = 0.07f;
+	vert_positions[13].z = 0;
+	vert_positions[14].z = 0;
+
+	vert_positions[15].z = -0.1f;
+	vert_positions[16].z = 0;
+	vert_positions[17].z = 0;
+	vert_positions[18].z = 0;
+	vert_positions[19].z = -0.03f;
+
+	vert_positions[20].z = 0;
+	vert_positions[21].z = 0;
+	vert_positions[22].z = 0.18f;
+	vert_positions[23].z = 0;
+	vert_positions[24].z = -0.1f;
 
 	float step = size / (cols - 1);
 
@@ -155,11 +158,14 @@ void SculptMesh::createAsWavyGrid(float size, uint32_t max_vertices_AABB)
 		for (uint32_t col = 0; col < cols; col++) {
 
 			uint32_t v_idx = (row * cols) + col;
-			verts[v_idx].pos.x = step * col;
-			verts[v_idx].pos.y = -(step * row);
+			vert_positions[v_idx].x = step * col;
+			vert_positions[v_idx].y = -(step * row);
 		}
 	}
 
+	std::vector<uint32_t> poly_corners;
+	poly_corners.reserve((rows - 1) * (cols - 1) * 4);
+
 	for (uint32_t row = 0; row < rows - 1; row++) {
 		for (uint32_t col = 0; col < cols - 1; col++) {
 
@@ -168,10 +174,12 @@ void SculptMesh::createAsWavyGrid(float size, uint32_t max_vertices_AABB)
 			uint32_t v2_idx = (row + 1) * cols + col + 1;
 			uint32_t v3_idx = (row + 1) * cols + col;
 
-			addQuad(v0_idx, v1_idx, v2_idx, v3_idx);
+			poly_corners.insert(poly_corners.end(), { v0_idx, v1_idx, v2_idx, v3_idx });
 		}
 	}
 
+	_buildTopology(poly_corners);
+
 	recreateAABBs(max_vertices_AABB);
 }
 
@@ -187,202 +195,312 @@ void SculptMesh::createAsWavyGrid(float size, uint32_t max_vertices_AABB)
 */
 void SculptMesh::createAsCube(float size, uint32_t max_vertices_AABB)
 {
-	verts.resize(8);
+	_resizeVertexMemory(8);
 
 	float half = size / 2;
 
 	// Front
-	verts[0].pos = { -half,  half, half };
-	verts[1].pos = { half,  half, half };
-	verts[2].pos = { half, -half, half };
-	verts[3].pos = { -half, -half, half };
+	vert_positions[0] = { -half,  half, half };
+	vert_positions[1] = { half,  half, half };
+	vert_positions[2] = { half, -half, half };
+	vert_positions[3] = { -half, -half, half };
 	
 	// Back
-	verts[4].pos = { -half,  half, -half };
-	verts[5].pos = { half,  half, -half };
-	verts[6].pos = { half, -half, -half };
-	verts[7].pos = { -half, -half, -half };
+	vert_positions[4] = { -half,  half, -half };
+	vert_positions[5] = { half,  half, -half };
+	vert_positions[6] = { half, -half, -half };
+	vert_positions[7] = { -half, -half, -half };
 
 	for (uint8_t i = 0; i < verts.size(); i++) {
 		verts[i].init();
-
-		markVertexFullUpdate(i);
 	}
 
-	addQuad(0, 1, 2, 3);  // front
-	addQuad(1, 5, 6, 2);  // right
-	addQuad(5, 4, 7, 6);  // back
-	addQuad(4, 0, 3, 7);  // left
-	addQuad(0, 4, 5, 1);  // top
-	addQuad(3, 2, 6, 7);  // bot
+	markAllVerticesFullUpdate();
+
+	std::vector<uint32_t> poly_corners = {
+		0, 1, 2, 3,  // front
+		1, 5, 6, 2,  // right
+		5, 4, 7, 6,  // back
+		4, 0, 3, 7,  // left
+		0, 4, 5, 1,  // top
+		3, 2, 6, 7  // bot
+	};
+	_buildTopology(poly_corners);
 
 	recreateAABBs(max_vertices_AABB);
 }
 
-void SculptMesh::createAsCylinder(float height, float diameter, uint32_t rows, uint32_t cols, bool capped,
-	uint32_t max_vertices_AABB)
+/*
+  the side of the tube is a grid of rows x cols vertices wrapping around the columns,
+  for capped tubes the top and bottom vertices are the last 2 vertices
+
+  Edges:
+  - horizontal (row, col) -> (row, col + 1) at row * cols + col
+  - vertical (row, col) -> (row + 1, col) after all the horizontal edges
+  - cap (0, col) -> top and (rows - 1, col) -> bot after all the vertical edges
+
+  Polys:
+  - quad (row, col), (row, col + 1), (row + 1, col + 1), (row + 1, col) at row * cols + col
+  - bot cap triangle (rows - 1, col), bot, (rows - 1, col - 1) after all the quads
+  - top cap triangle (0, col), top, (0, col + 1) after the bot cap triangles
+*/
+void SculptMesh::_createTubeTopology(uint32_t rows, uint32_t cols, bool capped)
 {
-	float radius = diameter / 2.f;
-
-	uint32_t vertex_count = rows * cols;
+	uint32_t grid_vertex_count = rows * cols;
+	uint32_t vertex_count = capped ? grid_vertex_count + 2 : grid_vertex_count;
 	uint32_t quad_count = (rows - 1) * cols;
-	uint32_t tris_count = 0;
+	uint32_t tris_count = capped ? cols * 2 : 0;
 
-	if (capped) {
-		vertex_count += 2;
-		tris_count = cols * 2;
-	}
+	uint32_t vertical_edges_start = rows * cols;
+	uint32_t top_edges_start = vertical_edges_start + (rows - 1) * cols;
+	uint32_t bot_edges_start = top_edges_start + cols;
+	uint32_t edge_count = capped ? bot_edges_start + cols : top_edges_start;
 
-	verts.resize(vertex_count);
-	polys.reserve(quad_count + tris_count);
-	polys.resize(quad_count);
+	uint32_t bot_tris_start = quad_count;
+	uint32_t top_tris_start = bot_tris_start + cols;
 
-	float height_step = height / (rows - 1);
-	float y = 0;
+	uint32_t top_idx = grid_vertex_count;
+	uint32_t bot_idx = grid_vertex_count + 1;
 
-	for (uint32_t row = 0; row < rows; row++) {
+	_resizeVertexMemory(vertex_count);
+	_resizeEdgeMemory(edge_count);
+	_resizePolyMemory(quad_count + tris_count);
+
+	auto vertex_at = [&](uint32_t row, uint32_t col) {
+		return row * cols + (col % cols);
+	};
+
+	auto horizontal_edge = [&](uint32_t row, uint32_t col) {
+		return row * cols + (col % cols);
+	};
+
+	auto vertical_edge = [&](uint32_t row, uint32_t col) {
+		return vertical_edges_start + row * cols + (col % cols);
+	};
+
+	auto quad_at = [&](uint32_t row, uint32_t col) {
+		return row * cols + (col % cols);
+	};
 
-		uint32_t row_offset = row * cols;
+	auto setEdgeData = [&](uint32_t edge_idx, uint32_t v0, uint32_t v1, uint32_t p0, uint32_t p1) {
+
+		Edge& edge = edges[edge_idx];
+		edge.v0 = v0;
+		edge.v1 = v1;
+		edge.p0 = p0;
+		edge.p1 = p1;
+	};
+
+	// Edges
+	conc::parallel_for(0u, rows, [&](uint32_t row) {
 
 		for (uint32_t col = 0; col < cols; col++) {
 
-			uint32_t idx = row_offset + col;
-			Vertex& v = verts[idx];
+			// horizontal edges border the quads above and below or a cap triangle
+			uint32_t above = 0xFFFF'FFFF;
+			uint32_t below = 0xFFFF'FFFF;
 
-			float col_ratio = ((float)col / cols) * (2.f * glm::pi<float>());
-			float cosine = std::cosf(col_ratio);
-			float sine = std::sinf(col_ratio);
+			if (row > 0) {
+				above = quad_at(row - 1, col);
+			}
+			else if (capped) {
+				above = top_tris_start + col;
+			}
 
-			v.init();
-			v.pos.x = cosine * radius;
-			v.pos.z = -(sine * radius);
-			v.pos.y = y;
+			if (row < rows - 1) {
+				below = quad_at(row, col);
+			}
+			else if (capped) {
+				below = bot_tris_start + (col + 1) % cols;
+			}
 
-			markVertexFullUpdate(idx);
+			if (below == 0xFFFF'FFFF) {
+				std::swap(above, below);
+			}
+
+			setEdgeData(horizontal_edge(row, col), vertex_at(row, col), vertex_at(row, col + 1), below, above);
+
+			// vertical edges border the quads to the left and right
+			if (row < rows - 1) {
+				setEdgeData(vertical_edge(row, col), vertex_at(row, col), vertex_at(row + 1, col),
+					quad_at(row, col), quad_at(row, col + cols - 1));
+			}
 		}
+	});
 
-		y -= height_step;
+	if (capped) {
+		conc::parallel_for(0u, cols, [&](uint32_t col) {
+
+			setEdgeData(top_edges_start + col, vertex_at(0, col), top_idx,
+				top_tris_start + col, top_tris_start + (col + cols - 1) % cols);
+
+			setEdgeData(bot_edges_start + col, vertex_at(rows - 1, col), bot_idx,
+				bot_tris_start + col, bot_tris_start + (col + 1) % cols);
+		});
 	}
 
+	// Polys
+	conc::parallel_for(0u, rows - 1, [&](uint32_t row) {
+
+		for (uint32_t col = 0; col < cols; col++) {
+
+			Poly& quad = polys[quad_at(row, col)];
+			quad.is_tris = false;
+			quad.tesselation_type = 0;
+			quad.edges[0] = horizontal_edge(row, col);
+			quad.edges[1] = vertical_edge(row, col + 1);
+			quad.edges[2] = horizontal_edge(row + 1, col);
+			quad.edges[3] = vertical_edge(row, col);
+			quad.flip_edge_0 = false;
+			quad.flip_edge_1 = false;
+			quad.flip_edge_2 = true;
+			quad.flip_edge_3 = true;
+		}
+	});
+
 	if (capped) {
+		conc::parallel_for(0u, cols, [&](uint32_t col) {
+
+			Poly& bot_tris = polys[bot_tris_start + col];
+			bot_tris.is_tris = true;
+			bot_tris.tesselation_type = 0;
+			bot_tris.edges[0] = bot_edges_start + col;
+			bot_tris.edges[1] = bot_edges_start + (col + cols - 1) % cols;
+			bot_tris.edges[2] = horizontal_edge(rows - 1, col + cols - 1);
+			bot_tris.flip_edge_0 = false;
+			bot_tris.flip_edge_1 = true;
+			bot_tris.flip_edge_2 = false;
+			bot_tris.flip_edge_3 = false;
+
+			Poly& top_tris = polys[top_tris_start + col];
+			top_tris.is_tris = true;
+			top_tris.tesselation_type = 0;
+			top_tris.edges[0] = top_edges_start + col;
+			top_tris.edges[1] = top_edges_start + (col + 1) % cols;
+			top_tris.edges[2] = horizontal_edge(0, col);
+			top_tris.flip_edge_0 = false;
+			top_tris.flip_edge_1 = true;
+			top_tris.flip_edge_2 = true;
+			top_tris.flip_edge_3 = false;
+		});
+	}
 
-		std::vector<uint32_t> rim(cols);
+	// Vertex Edge Lists
+	auto linkLoop = [&](uint32_t vertex_idx, uint32_t* loop, uint32_t count) {
 
-		auto iter = verts.end();
-		iter.prev();
+		Vertex& vertex = verts[vertex_idx];
+		vertex.init();
+		vertex.edge = loop[0];
 
-		// bot cap
-		{
-			uint32_t bot_idx = iter.index();
+		for (uint32_t i = 0; i < count; i++) {
+			edges[loop[i]].setPrevNextEdges(vertex_idx,
+				loop[(i + count - 1) % count], loop[(i + 1) % count]);
+		}
+	};
 
-			Vertex& bot_vertex = verts[bot_idx];
-			bot_vertex.init();
-			bot_vertex.pos = { 0, -height, 0 };
+	conc::parallel_for(0u, rows, [&](uint32_t row) {
 
-			markVertexFullUpdate(bot_idx);
-			{
-				uint32_t row_offset = (rows - 1) * cols;
+		for (uint32_t col = 0; col < cols; col++) {
 
-				uint32_t col = cols - 1;
-				for (auto& v : rim) {
-					v = row_offset + col;
-					col--;
-				}
+			std::array<uint32_t, 4> loop;
+			uint32_t count = 0;
 
-				stichVerticesToVertexLooped(rim, bot_idx);
+			loop[count++] = horizontal_edge(row, col);
+
+			if (row < rows - 1) {
+				loop[count++] = vertical_edge(row, col);
+			}
+			else if (capped) {
+				loop[count++] = bot_edges_start + col;
 			}
-		}	
 
-		iter.prev();
+			loop[count++] = horizontal_edge(row, col + cols - 1);
 
-		// top cap
-		{
-			uint32_t top_idx = iter.index();
+			if (row > 0) {
+				loop[count++] = vertical_edge(row - 1, col);
+			}
+			else if (capped) {
+				loop[count++] = top_edges_start + col;
+			}
 
-			Vertex& top_vertex = verts[top_idx];
-			top_vertex.init();
-			top_vertex.pos = { 0, 0, 0 };
+			linkLoop(vertex_at(row, col), loop.data(), count);
+		}
+	});
 
-			markVertexFullUpdate(top_idx);
+	if (capped) {
+		std::vector<uint32_t> loop(cols);
 
-			for (uint32_t col = 0; col < cols; col++) {
-				rim[col] = col;
-			}
+		for (uint32_t col = 0; col < cols; col++) {
+			loop[col] = top_edges_start + col;
+		}
+		linkLoop(top_idx, loop.data(), cols);
 
-			stichVerticesToVertexLooped(rim, top_idx);
+		for (uint32_t col = 0; col < cols; col++) {
+			loop[col] = bot_edges_start + col;
 		}
+		linkLoop(bot_idx, loop.data(), cols);
 	}
 
-	// make origin top -> center
-	float half_heigth = height / 2.f;
+	markAllVerticesFullUpdate();
+	markAllPolysFullUpdate();
+}
 
-	for (auto iter = verts.begin(); iter != verts.end(); iter.next()) {
-		Vertex& v = iter.get();
-		v.pos.y += half_heigth;
-	}
+void SculptMesh::createAsCylinder(float height, float diameter, uint32_t rows, uint32_t cols, bool capped,
+	uint32_t max_vertices_AABB)
+{
+	assert_cond(rows > 1, "");
+	assert_cond(cols > 2, "");
 
-	// Create Quads
-	uint32_t quad_idx = 0;
+	_createTubeTopology(rows, cols, capped);
 
-	for (uint32_t row = 0; row < rows - 1; row++) {
-		for (uint32_t col = 0; col < cols - 1; col++) {
+	float radius = diameter / 2.f;
+	float height_step = height / (rows - 1);
 
-			uint32_t v0_idx = (row * cols) + col;
-			uint32_t v1_idx = (row * cols) + col + 1;
-			uint32_t v2_idx = (row + 1) * cols + col + 1;
-			uint32_t v3_idx = (row + 1) * cols + col;
+	// origin is at the center
+	float half_heigth = height / 2.f;
 
-			setQuad(quad_idx, v0_idx, v1_idx, v2_idx, v3_idx);
-			
-			quad_idx++;
-		}
+	conc::parallel_for(0u, rows, [&](uint32_t row) {
+
+		float y = half_heigth - row * height_step;
+
+		for (uint32_t col = 0; col < cols; col++) {
 
-		uint32_t v0_idx = (row * cols) + cols - 1;
-		uint32_t v1_idx = (row * cols);
-		uint32_t v2_idx = (row + 1) * cols;
-		uint32_t v3_idx = (row + 1) * cols + cols - 1;
+			glm::vec3& pos = vert_positions[row * cols + col];
 
-		setQuad(quad_idx, v0_idx, v1_idx, v2_idx, v3_idx);
+			float col_ratio = ((float)col / cols) * (2.f * glm::pi<float>());
+			float cosine = std::cosf(col_ratio);
+			float sine = std::sinf(col_ratio);
+
+			pos.x = cosine * radius;
+			pos.z = -(sine * radius);
+			pos.y = y;
+		}
+	});
 
-		quad_idx++;
+	if (capped) {
+		vert_positions[rows * cols] = { 0, half_heigth, 0 };
+		vert_positions[rows * cols + 1] = { 0, -half_heigth, 0 };
 	}
 
 	recreateAABBs(max_vertices_AABB);
-
-	// make sure I got the counts right
-	assert_cond(polys.capacity() == quad_count + tris_count, "");
 }
 
 void SculptMesh::createAsUV_Sphere(float diameter, uint32_t rows, uint32_t cols, uint32_t max_vertices_AABB)
 {
 	assert_cond(rows > 1, "");
-	assert_cond(cols > 1, "");
-
-	// pre-allocate memory
-	uint32_t vertex_count = rows * cols + 2;
-	uint32_t quad_count = (rows - 1) * cols;
-	uint32_t tris_count = cols * 2;
-	{
-		verts.resize(vertex_count);	
-
-		// can't be bothered to manually pass indexes when doing cap stiching
-		polys.reserve(quad_count + tris_count);
-		polys.resize(quad_count);
+	assert_cond(cols > 2, "");
 
-		edges.reserve((size_t)(quad_count * (float)2.5)); // rough guess over-allocate
-	}
+	_createTubeTopology(rows, cols, true);
 
 	float radius = diameter / 2.f;
 
-	for (uint32_t row = 0; row < rows; row++) {
-
-		uint32_t row_offset = row * cols;
+	conc::parallel_for(0u, rows, [&](uint32_t row) {
 
 		float row_radius;
 		float y;
 		{
 			float v_ratio = (float)(row + 1) / (rows + 1);
-			row_radius = std::sinf(v_ratio * glm::pi<float>()) * radius; //  * radius;
+			row_radius = std::sinf(v_ratio * glm::pi<float>()) * radius;
 			y = std::cosf(v_ratio * glm::pi<float>()) * radius;
 		}
 
@@ -392,156 +510,643 @@ void SculptMesh::createAsUV_Sphere(float diameter, uint32_t rows, uint32_t cols,
 			x = sin(Pi * m / M) * cos(2Pi * n / N);
 			y = sin(Pi * m / M) * sin(2Pi * n / N);
 			z = cos(Pi * m / M);*/
-			uint32_t v_idx = row_offset + col;
-			Vertex& v = verts[v_idx];
+			glm::vec3& pos = vert_positions[row * cols + col];
 
 			float col_ratio = ((float)col / cols) * (2.f * glm::pi<float>());
 			float cosine = std::cosf(col_ratio);
 			float sine = std::sinf(col_ratio);
-		
-			v.init();
-			v.pos.x = cosine * row_radius;
-			v.pos.z = -(sine * row_radius);
-			v.pos.y = y;
 
-			markVertexFullUpdate(v_idx);
+			pos.x = cosine * row_radius;
+			pos.z = -(sine * row_radius);
+			pos.y = y;
+		}
+	});
+
+	vert_positions[rows * cols] = { 0, radius, 0 };
+	vert_positions[rows * cols + 1] = { 0, -radius, 0 };
+
+	recreateAABBs(max_vertices_AABB);
+}
+
+// groups the items by key in parallel, the items with key K end up in ascending order in
+// r_items[r_offsets[K], r_offsets[K + 1]), items with the key 0xFFFF'FFFF are skipped
+template<typename KeyOf>
+static void bucketByKey(uint32_t key_count, uint32_t item_count, KeyOf key_of,
+	std::vector<uint32_t>& r_offsets, std::vector<uint32_t>& r_items)
+{
+	// counts then write positions
+	std::vector<std::atomic<uint32_t>> cursors(key_count);
+
+	conc::parallel_for(0u, item_count, [&](uint32_t item) {
+
+		uint32_t key = key_of(item);
+
+		if (key != 0xFFFF'FFFF) {
+			cursors[key].fetch_add(1, std::memory_order_relaxed);
 		}
+	});
+
+	r_offsets.resize(key_count + 1);
+
+	uint32_t total = 0;
+	for (uint32_t key = 0; key < key_count; key++) {
+
+		r_offsets[key] = total;
+		total += cursors[key].load(std::memory_order_relaxed);
+		cursors[key].store(r_offsets[key], std::memory_order_relaxed);
 	}
+	r_offsets[key_count] = total;
 
-	// Capped
-	{
-		std::vector<uint32_t> rim(cols);
+	r_items.resize(total);
 
-		auto iter = verts.end();
-		iter.prev();
+	conc::parallel_for(0u, item_count, [&](uint32_t item) {
 
-		// bot cap
-		{
-			uint32_t bot_idx = iter.index();
+		uint32_t key = key_of(item);
 
-			Vertex& bot_vertex = verts[bot_idx];
-			bot_vertex.init();
-			bot_vertex.pos = { 0, -radius, 0 };
+		if (key != 0xFFFF'FFFF) {
+			r_items[cursors[key].fetch_add(1, std::memory_order_relaxed)] = item;
+		}
+	});
 
-			markVertexFullUpdate(bot_idx);
-			{
-				uint32_t row_offset = (rows - 1) * cols;
+	// scattering doesn't preserve order
+	conc::parallel_for(0u, key_count, [&](uint32_t key) {
+		std::sort(r_items.begin() + r_offsets[key], r_items.begin() + r_offsets[key + 1]);
+	});
+}
 
-				uint32_t col = cols - 1;
-				for (auto& v : rim) {
-					v = row_offset + col;
-					col--;
-				}
+void SculptMesh::_buildTopology(std::vector<uint32_t>& poly_corners)
+{
+	uint32_t vertex_count = verts.size();
+	uint32_t poly_count = poly_corners.size() / 4;
+
+	_resizePolyMemory(poly_count);
+
+	// a side is the edge of a poly going from corner (side % 4) to the next corner of poly (side / 4)
+	auto side_count_of = [&](uint32_t poly_idx) -> uint32_t {
+		return poly_corners[poly_idx * 4 + 3] == 0xFFFF'FFFF ? 3 : 4;
+	};
+
+	auto side_vertices = [&](uint32_t side, uint32_t& r_v0, uint32_t& r_v1) {
+
+		uint32_t poly_idx = side / 4;
+		uint32_t corner = side % 4;
+
+		r_v0 = poly_corners[side];
+		r_v1 = poly_corners[poly_idx * 4 + (corner + 1) % side_count_of(poly_idx)];
+	};
+
+	auto other_vertex = [&](uint32_t side, uint32_t vertex_idx) {
+
+		uint32_t v0, v1;
+		side_vertices(side, v0, v1);
+
+		return v0 == vertex_idx ? v1 : v0;
+	};
+
+	// Unique Edges
+	// sides are bucketed by their smallest vertex, the sides of a bucket that share the other vertex
+	// are the same edge, this avoids walking the vertex edge lists like addEdge does
+	std::vector<uint32_t> side_offsets;
+	std::vector<uint32_t> sides;
+
+	bucketByKey(vertex_count, poly_count * 4, [&](uint32_t side) -> uint32_t {
+
+		// triangles have no 4th side
+		if (poly_corners[side] == 0xFFFF'FFFF) {
+			return 0xFFFF'FFFF;
+		}
 
-				stichVerticesToVertexLooped(rim, bot_idx);
+		uint32_t v0, v1;
+		side_vertices(side, v0, v1);
+
+		return std::min(v0, v1);
+	}, side_offsets, sides);
+
+	std::vector<uint32_t> edge_offsets(vertex_count + 1);
+
+	conc::parallel_for(0u, vertex_count, [&](uint32_t vertex_idx) {
+
+		auto begin = sides.begin() + side_offsets[vertex_idx];
+		auto end = sides.begin() + side_offsets[vertex_idx + 1];
+
+		// stable so that the first poly to use an edge stays first
+		std::stable_sort(begin, end, [&](uint32_t a, uint32_t b) {
+			return other_vertex(a, vertex_idx) < other_vertex(b, vertex_idx);
+		});
+
+		uint32_t edge_count = 0;
+		uint32_t prev_other = 0xFFFF'FFFF;
+
+		for (auto iter = begin; iter != end; iter++) {
+
+			uint32_t other = other_vertex(*iter, vertex_idx);
+
+			if (other != prev_other) {
+				edge_count++;
+				prev_other = other;
 			}
 		}
 
-		iter.prev();
+		edge_offsets[vertex_idx] = edge_count;
+	});
 
-		// top cap
-		{
-			uint32_t top_idx = iter.index();
+	uint32_t edge_count = 0;
+	for (uint32_t vertex_idx = 0; vertex_idx <= vertex_count; vertex_idx++) {
+
+		uint32_t count = edge_offsets[vertex_idx];
+		edge_offsets[vertex_idx] = edge_count;
+		edge_count += count;
+	}
+
+	_resizeEdgeMemory(edge_count);
 
-			Vertex& top_vertex = verts[top_idx];
-			top_vertex.init();
-			top_vertex.pos = { 0, radius, 0 };
+	std::vector<uint32_t> side_edges(poly_count * 4);
 
-			markVertexFullUpdate(top_idx);
+	conc::parallel_for(0u, vertex_count, [&](uint32_t vertex_idx) {
 
-			for (uint32_t col = 0; col < cols; col++) {
-				rim[col] = col;
+		uint32_t edge_idx = edge_offsets[vertex_idx];
+		uint32_t run_begin = side_offsets[vertex_idx];
+		uint32_t bucket_end = side_offsets[vertex_idx + 1];
+
+		while (run_begin < bucket_end) {
+
+			uint32_t other = other_vertex(sides[run_begin], vertex_idx);
+
+			uint32_t run_end = run_begin + 1;
+			while (run_end < bucket_end && other_vertex(sides[run_end], vertex_idx) == other) {
+				run_end++;
 			}
 
-			stichVerticesToVertexLooped(rim, top_idx);
+			// like addEdge the first poly decides the direction,
+			// like registerPolyToEdge the last poly of a non manifold edge is kept
+			Edge& edge = edges[edge_idx];
+			side_vertices(sides[run_begin], edge.v0, edge.v1);
+			edge.p0 = sides[run_begin] / 4;
+			edge.p1 = run_end - run_begin > 1 ? sides[run_end - 1] / 4 : 0xFFFF'FFFF;
+
+			for (uint32_t i = run_begin; i < run_end; i++) {
+				side_edges[sides[i]] = edge_idx;
+			}
+
+			edge_idx++;
+			run_begin = run_end;
+		}
+	});
+
+	// Polys
+	conc::parallel_for(0u, poly_count, [&](uint32_t poly_idx) {
+
+		Poly& poly = polys[poly_idx];
+		uint32_t* corners = &poly_corners[poly_idx * 4];
+		uint32_t* poly_side_edges = &side_edges[poly_idx * 4];
+
+		poly.tesselation_type = 0;
+		poly.edges[0] = poly_side_edges[0];
+		poly.edges[1] = poly_side_edges[1];
+		poly.edges[2] = poly_side_edges[2];
+		poly.flip_edge_0 = edges[poly.edges[0]].v0 != corners[0];
+		poly.flip_edge_1 = edges[poly.edges[1]].v0 != corners[1];
+		poly.flip_edge_2 = edges[poly.edges[2]].v0 != corners[2];
+
+		if (corners[3] == 0xFFFF'FFFF) {
+			poly.is_tris = true;
+			poly.flip_edge_3 = 0;
+		}
+		else {
+			poly.is_tris = false;
+			poly.edges[3] = poly_side_edges[3];
+			poly.flip_edge_3 = edges[poly.edges[3]].v0 != corners[3];
+		}
+	});
+
+	// Vertex Edge Lists
+	// every edge is bucketed twice, once for each vertex, then the edges of a bucket are linked in a loop
+	std::vector<uint32_t> loop_offsets;
+	std::vector<uint32_t> loop_edges;
+
+	bucketByKey(vertex_count, edge_count * 2, [&](uint32_t edge_end) -> uint32_t {
+
+		Edge& edge = edges[edge_end / 2];
+		return edge_end & 1 ? edge.v1 : edge.v0;
+	}, loop_offsets, loop_edges);
+
+	conc::parallel_for(0u, vertex_count, [&](uint32_t vertex_idx) {
+
+		uint32_t begin = loop_offsets[vertex_idx];
+		uint32_t end = loop_offsets[vertex_idx + 1];
+
+		if (begin == end) {
+			return;
 		}
+
+		verts[vertex_idx].edge = loop_edges[begin] / 2;
+
+		for (uint32_t i = begin; i < end; i++) {
+
+			uint32_t prev_edge_idx = loop_edges[i == begin ? end - 1 : i - 1] / 2;
+			uint32_t next_edge_idx = loop_edges[i + 1 == end ? begin : i + 1] / 2;
+
+			// each thread writes only the half of the edge that belongs to its vertex
+			edges[loop_edges[i] / 2].setPrevNextEdges(vertex_idx, prev_edge_idx, next_edge_idx);
+		}
+	});
+
+	markAllPolysFullUpdate();
+}
+
+// merges the vertices closer than distance, each vertex is given to the lowest index kept vertex in range
+// found through a spatial hash with cells of distance size so only the 27 cells around a vertex need checking,
+// the merged vertex keeps the position of the lowest index vertex and the average normal,
+// polys that collapse to less than 3 unique corners are removed
+static void weldPolyCorners(float distance, std::vector<glm::vec3>& r_positions, std::vector<glm::vec3>& r_normals,
+	std::vector<uint32_t>& r_poly_corners)
+{
+	uint32_t vertex_count = r_positions.size();
+	uint32_t poly_count = r_poly_corners.size() / 4;
+
+	float inv_cell_size = 1.f / distance;
+	float max_distance_sq = distance * distance;
+
+	// power of 2 so that the hash can be masked
+	uint32_t table_size = 1;
+	while (table_size < vertex_count) {
+		table_size <<= 1;
 	}
 
-	// Create Quads
-	uint32_t quad_idx = 0;
+	auto cell_of = [&](glm::vec3& pos) -> glm::ivec3 {
+		// clamped so that far away vertices don't overflow the cell coordinates
+		return glm::ivec3(glm::clamp(glm::floor(pos * inv_cell_size), -1e9f, 1e9f));
+	};
 
-	for (uint32_t row = 0; row < rows - 1; row++) {
-		for (uint32_t col = 0; col < cols - 1; col++) {
+	// different cells may share a bucket, the distance check sorts them out
+	auto bucket_of = [&](glm::ivec3 cell) -> uint32_t {
+		uint32_t hash = ((uint32_t)cell.x * 73856093) ^ ((uint32_t)cell.y * 19349663) ^ ((uint32_t)cell.z * 83492791);
+		return hash & (table_size - 1);
+	};
 
-			uint32_t v0_idx = (row * cols) + col;
-			uint32_t v1_idx = (row * cols) + col + 1;
-			uint32_t v2_idx = (row + 1) * cols + col + 1;
-			uint32_t v3_idx = (row + 1) * cols + col;
+	std::vector<uint32_t> bucket_offsets;
+	std::vector<uint32_t> bucket_verts;
+
+	bucketByKey(table_size, vertex_count, [&](uint32_t vertex_idx) {
+		return bucket_of(cell_of(r_positions[vertex_idx]));
+	}, bucket_offsets, bucket_verts);
+
+	// lowest index vertex in range below vertex_idx for which is_candidate(index) is true, vertex_idx if none
+	auto find_lowest_in_range = [&](uint32_t vertex_idx, auto is_candidate) -> uint32_t {
+
+		glm::vec3& pos = r_positions[vertex_idx];
+		glm::ivec3 cell = cell_of(pos);
+
+		uint32_t lowest = vertex_idx;
+
+		for (int32_t z = -1; z <= 1; z++) {
+			for (int32_t y = -1; y <= 1; y++) {
+				for (int32_t x = -1; x <= 1; x++) {
+
+					uint32_t bucket = bucket_of(cell + glm::ivec3(x, y, z));
+
+					// buckets are sorted so the first vertex found is the lowest of the bucket
+					for (uint32_t i = bucket_offsets[bucket]; i < bucket_offsets[bucket + 1]; i++) {
 
-			setQuad(quad_idx, v0_idx, v1_idx, v2_idx, v3_idx);
+						uint32_t other_idx = bucket_verts[i];
 
-			quad_idx++;
+						if (other_idx >= lowest) {
+							break;
+						}
+
+						glm::vec3 delta = r_positions[other_idx] - pos;
+
+						if (glm::dot(delta, delta) <= max_distance_sq && is_candidate(other_idx)) {
+							lowest = other_idx;
+							break;
+						}
+					}
+				}
+			}
 		}
 
-		uint32_t v0_idx = (row * cols) + cols - 1;
-		uint32_t v1_idx = (row * cols);
-		uint32_t v2_idx = (row + 1) * cols;
-		uint32_t v3_idx = (row + 1) * cols + cols - 1;
+		return lowest;
+	};
+
+	// the lowest vertex in range of each vertex, found in parallel
+	std::vector<uint32_t> roots(vertex_count);
+
+	conc::parallel_for(0u, vertex_count, [&](uint32_t vertex_idx) {
+		roots[vertex_idx] = find_lowest_in_range(vertex_idx, [](uint32_t) { return true; });
+	});
+
+	// a vertex only merges into a vertex that is itself in range and kept,
+	// resolved in index order so that chains of vertices closer than distance are not collapsed into one,
+	// the lowest vertex in range is usually kept so the search is only repeated for the others
+	uint32_t new_vertex_count = 0;
+	std::vector<uint32_t> remap(vertex_count);
+
+	for (uint32_t vertex_idx = 0; vertex_idx < vertex_count; vertex_idx++) {
+
+		uint32_t& root = roots[vertex_idx];
 
-		setQuad(quad_idx, v0_idx, v1_idx, v2_idx, v3_idx);
+		if (roots[root] != root) {
+			root = find_lowest_in_range(vertex_idx, [&](uint32_t other_idx) {
+				return roots[other_idx] == other_idx;
+			});
+		}
 
-		quad_idx++;
+		if (root == vertex_idx) {
+			remap[vertex_idx] = new_vertex_count;
+			new_vertex_count++;
+		}
 	}
 
-	recreateAABBs(max_vertices_AABB);
+	if (new_vertex_count == vertex_count) {
+		return;
+	}
+
+	conc::parallel_for(0u, vertex_count, [&](uint32_t vertex_idx) {
+
+		// only the merged vertices are written so the roots can be read
+		if (roots[vertex_idx] != vertex_idx) {
+			remap[vertex_idx] = remap[roots[vertex_idx]];
+		}
+	});
+
+	// Vertices
+	std::vector<uint32_t> merged_offsets;
+	std::vector<uint32_t> merged_verts;
+
+	bucketByKey(new_vertex_count, vertex_count, [&](uint32_t vertex_idx) {
+		return remap[vertex_idx];
+	}, merged_offsets, merged_verts);
+
+	std::vector<glm::vec3> new_positions(new_vertex_count);
+	std::vector<glm::vec3> new_normals(new_vertex_count);
+
+	conc::parallel_for(0u, new_vertex_count, [&](uint32_t new_idx) {
+
+		uint32_t begin = merged_offsets[new_idx];
+		uint32_t end = merged_offsets[new_idx + 1];
+
+		glm::vec3 normal = { 0, 0, 0 };
+
+		for (uint32_t i = begin; i < end; i++) {
+			normal += r_normals[merged_verts[i]];
+		}
+
+		// the first one is the root
+		new_positions[new_idx] = r_positions[merged_verts[begin]];
+		new_normals[new_idx] = glm::dot(normal, normal) > 0 ? glm::normalize(normal) : r_normals[merged_verts[begin]];
+	});
+
+	r_positions.swap(new_positions);
+	r_normals.swap(new_normals);
+
+	// Polys
+	std::vector<uint8_t> keep_poly(poly_count);
+
+	conc::parallel_for(0u, poly_count, [&](uint32_t poly_idx) {
+
+		uint32_t* corners = &r_poly_corners[poly_idx * 4];
+		uint32_t corner_count = corners[3] == 0xFFFF'FFFF ? 3 : 4;
+
+		// drop the corners merged into their neighbour
+		std::array<uint32_t, 4> unique_corners;
+		uint32_t unique_count = 0;
+
+		for (uint32_t i = 0; i < corner_count; i++) {
+
+			uint32_t corner = remap[corners[i]];
+			uint32_t prev_corner = remap[corners[(i + corner_count - 1) % corner_count]];
+
+			if (corner != prev_corner) {
+				unique_corners[unique_count] = corner;
+				unique_count++;
+			}
+		}
 
-	// make sure I got the counts right
-	assert_cond(polys.capacity() == quad_count + tris_count, "");
+		// a quad folded onto itself like A B A B has no consecutive duplicates but is still degenerate
+		bool is_valid = unique_count >= 3 &&
+			(unique_count == 3 || (unique_corners[0] != unique_corners[2] && unique_corners[1] != unique_corners[3]));
+
+		for (uint32_t i = 0; i < 4; i++) {
+			corners[i] = i < unique_count ? unique_corners[i] : 0xFFFF'FFFF;
+		}
+
+		keep_poly[poly_idx] = is_valid;
+	});
+
+	uint32_t new_poly_count = 0;
+
+	for (uint32_t poly_idx = 0; poly_idx < poly_count; poly_idx++) {
+
+		if (keep_poly[poly_idx]) {
+
+			std::copy_n(&r_poly_corners[poly_idx * 4], 4, &r_poly_corners[new_poly_count * 4]);
+			new_poly_count++;
+		}
+	}
+
+	r_poly_corners.resize(new_poly_count * 4);
 }
 
-void SculptMesh::createFromLists(std::vector<uint32_t>& indexes, std::vector<glm::vec3>& positions,
-	std::vector<glm::vec3>& normals, uint32_t max_vertices_AABB)
+void SculptMesh::weldByDistance(float distance, std::vector<uint32_t>& r_indexes,
+	std::vector<glm::vec3>& r_positions, std::vector<glm::vec3>& r_normals)
 {
-	verts.resize(positions.size());
-	polys.resize(indexes.size() / 3);
+	if (distance <= 0) {
+		return;
+	}
 
-	float new_root_aabb_size = 0;
+	uint32_t tris_count = r_indexes.size() / 3;
 
-	for (uint32_t i = 0; i < positions.size(); i++) {
+	std::vector<uint32_t> poly_corners(tris_count * 4);
 
-		Vertex& v = verts[i];
-		v.init();
-		v.pos = positions[i];
-		v.normal = normals[i];
+	conc::parallel_for(0u, tris_count, [&](uint32_t tris_idx) {
 
-		markVertexFullUpdate(i);
+		uint32_t* corners = &poly_corners[tris_idx * 4];
+		corners[0] = r_indexes[tris_idx * 3 + 0];
+		corners[1] = r_indexes[tris_idx * 3 + 1];
+		corners[2] = r_indexes[tris_idx * 3 + 2];
+		corners[3] = 0xFFFF'FFFF;
+	});
 
-		if (std::abs(v.pos.x) > new_root_aabb_size) {
-			new_root_aabb_size = v.pos.x;
-		}
+	weldPolyCorners(distance, r_positions, r_normals, poly_corners);
+
+	// triangles can only collapse so they stay triangles
+	tris_count = poly_corners.size() / 4;
+	r_indexes.resize(tris_count * 3);
+
+	conc::parallel_for(0u, tris_count, [&](uint32_t tris_idx) {
+
+		uint32_t* corners = &poly_corners[tris_idx * 4];
+		r_indexes[tris_idx * 3 + 0] = corners[0];
+		r_indexes[tris_idx * 3 + 1] = corners[1];
+		r_indexes[tris_idx * 3 + 2] = corners[2];
+	});
+}
+
+void SculptMesh::mergeByDistance(float distance)
+{
+	if (distance <= 0) {
+		return;
+	}
+
+	uint32_t old_vertex_count = verts._count;
+	uint32_t old_poly_count = polys._count;
+
+	// Gather
+	// the mesh is turned back into lists without the deleted slots
+	std::vector<uint32_t> vert_remap;
+	verts.buildCompactionRemap(vert_remap);
+
+	std::vector<glm::vec3> positions(verts.size());
+	std::vector<glm::vec3> normals(verts.size());
+
+	verts.parallelForEach([&](Vertex&, uint32_t vertex_idx) {
+
+		uint32_t new_idx = vert_remap[vertex_idx];
+		positions[new_idx] = vert_positions[vertex_idx];
+		normals[new_idx] = vert_normals[vertex_idx];
+	});
 
-		if (std::abs(v.pos.y) > new_root_aabb_size) {
-			new_root_aabb_size = v.pos.y;
+	std::vector<uint32_t> poly_corners(polys.size() * 4);
+
+	polys.parallelForEachRanked([&](Poly& poly, uint32_t, uint32_t rank) {
+
+		uint32_t* corners = &poly_corners[rank * 4];
+
+		if (poly.is_tris) {
+			std::array<uint32_t, 3> vs_idxs;
+			getTrisPrimitives(&poly, vs_idxs);
+
+			corners[0] = vert_remap[vs_idxs[0]];
+			corners[1] = vert_remap[vs_idxs[1]];
+			corners[2] = vert_remap[vs_idxs[2]];
+			corners[3] = 0xFFFF'FFFF;
 		}
+		else {
+			std::array<uint32_t, 4> vs_idxs;
+			getQuadPrimitives(&poly, vs_idxs);
 
-		if (std::abs(v.pos.z) > new_root_aabb_size) {
-			new_root_aabb_size = v.pos.z;
+			corners[0] = vert_remap[vs_idxs[0]];
+			corners[1] = vert_remap[vs_idxs[1]];
+			corners[2] = vert_remap[vs_idxs[2]];
+			corners[3] = vert_remap[vs_idxs[3]];
 		}
+	});
+
+	weldPolyCorners(distance, positions, normals, poly_corners);
+
+	// Rebuild
+	uint32_t vertex_count = positions.size();
+
+	_resizeVertexMemory(vertex_count);
+
+	conc::parallel_for(0u, vertex_count, [&](uint32_t i) {
+
+		verts[i].init();
+		vert_positions[i] = positions[i];
+		vert_normals[i] = normals[i];
+	});
+
+	// the pending changes reference old indexes, the tails of the GPU buffers past the new counts are cleared
+	modified_verts.clear();
+	modified_polys.clear();
+
+	markAllVerticesFullUpdate();
+
+	_buildTopology(poly_corners);
+
+	for (uint32_t i = verts.size(); i < old_vertex_count; i++) {
+
+		ModifiedVertex& modified_vertex = modified_verts.emplace_back();
+		modified_vertex.idx = i;
+		modified_vertex.state = ModifiedVertexState::DELETED;
+	}
+
+	for (uint32_t i = polys.size(); i < old_poly_count; i++) {
+
+		ModifiedPoly& modified_poly = modified_polys.emplace_back();
+		modified_poly.idx = i;
+		modified_poly.state = ModifiedPolyState::DELETED;
 	}
 
-	uint32_t tris_idx = 0;
-	for (uint32_t i = 0; i < indexes.size(); i += 3) {
-		
-		uint32_t v0_idx = indexes[i];
-		uint32_t v1_idx = indexes[i + 1];
-		uint32_t v2_idx = indexes[i + 2];
+	recreateAABBs();
+}
+
+void SculptMesh::createFromLists(std::vector<uint32_t>& indexes, std::vector<glm::vec3>& positions,
+	std::vector<glm::vec3>& normals, uint32_t max_vertices_AABB)
+{
+	std::vector<uint32_t> quad_indexes;
+	createFromLists(indexes, quad_indexes, positions, normals, max_vertices_AABB);
+}
+
+void SculptMesh::createFromLists(std::vector<uint32_t>& tris_indexes, std::vector<uint32_t>& quad_indexes,
+	std::vector<glm::vec3>& positions, std::vector<glm::vec3>& normals, uint32_t max_vertices_AABB)
+{
+	uint32_t vertex_count = positions.size();
 
-		Vertex* v0 = &verts[v0_idx];
-		Vertex* v1 = &verts[v1_idx];
-		Vertex* v2 = &verts[v2_idx];
+	_resizeVertexMemory(vertex_count);
 
-		glm::vec3 normal = (v0->normal + v1->normal + v2->normal) / 3.f;
-		glm::vec3 winding_normal = calcWindingNormal(v0, v1, v2);
+	conc::parallel_for(0u, vertex_count, [&](uint32_t i) {
+
+		verts[i].init();
+		vert_positions[i] = positions[i];
+		vert_normals[i] = normals[i];
+	});
+
+	markAllVerticesFullUpdate();
+
+	uint32_t tris_count = tris_indexes.size() / 3;
+	uint32_t quad_count = quad_indexes.size() / 4;
+
+	// flip the winding order of polys that face away from their vertex normals
+	std::vector<uint32_t> poly_corners((tris_count + quad_count) * 4);
+
+	conc::parallel_for(0u, tris_count, [&](uint32_t tris_idx) {
+
+		uint32_t* vs = &tris_indexes[tris_idx * 3];
+		uint32_t* corners = &poly_corners[tris_idx * 4];
+
+		glm::vec3 normal = (vert_normals[vs[0]] + vert_normals[vs[1]] + vert_normals[vs[2]]) / 3.f;
+		glm::vec3 winding_normal = calcWindingNormal(vert_positions[vs[0]],
+			vert_positions[vs[1]], vert_positions[vs[2]]);
 
 		if (glm::dot(normal, winding_normal) > 0) {
-			setTris(tris_idx, v0_idx, v1_idx, v2_idx);
+			corners[0] = vs[0];
+			corners[1] = vs[1];
+			corners[2] = vs[2];
 		}
 		else {
-			setTris(tris_idx, v2_idx, v1_idx, v0_idx);
+			corners[0] = vs[2];
+			corners[1] = vs[1];
+			corners[2] = vs[0];
 		}
+		corners[3] = 0xFFFF'FFFF;
+	});
 
-		tris_idx++;
-	}
+	conc::parallel_for(0u, quad_count, [&](uint32_t quad_idx) {
+
+		uint32_t* vs = &quad_indexes[quad_idx * 4];
+		uint32_t* corners = &poly_corners[(tris_count + quad_idx) * 4];
+
+		glm::vec3 normal = (vert_normals[vs[0]] + vert_normals[vs[1]] +
+			vert_normals[vs[2]] + vert_normals[vs[3]]) / 4.f;
+		glm::vec3 winding_normal = calcWindingNormal(vert_positions[vs[0]],
+			vert_positions[vs[1]], vert_positions[vs[2]]);
+
+		if (glm::dot(normal, winding_normal) > 0) {
+			corners[0] = vs[0];
+			corners[1] = vs[1];
+			corners[2] = vs[2];
+			corners[3] = vs[3];
+		}
+		else {
+			corners[0] = vs[3];
+			corners[1] = vs[2];
+			corners[2] = vs[1];
+			corners[3] = vs[0];
+		}
+	});
+
+	_buildTopology(poly_corners);
 
 	recreateAABBs(max_vertices_AABB);
 }
@@ -550,10 +1155,10 @@ void SculptMesh::createAsLine(glm::vec3& origin, glm::vec3& direction, float len
 {
 	glm::vec3 target = origin + direction * length;
 
-	verts.resize(3);
-	verts[0].pos = origin;
-	verts[1].pos = origin;
-	verts[2].pos = target;
+	_resizeVertexMemory(3);
+	vert_positions[0] = origin;
+	vert_positions[1] = origin;
+	vert_positions[2] = target;
 
 	VertexBoundingBox& aabb = aabbs.emplace_back();
 	aabb.parent = 0xFFFF'FFFF;
@@ -565,14 +1170,18 @@ void SculptMesh::createAsLine(glm::vec3& origin, glm::vec3& direction, float len
 	aabb.aabb.max.y = std::max(origin.y, target.y);
 	aabb.aabb.max.z = std::max(origin.z, target.z);
 	aabb.children[0] = 0xFFFF'FFFF;
-	aabb.verts_deleted_count = 0;
-	aabb.verts = { 0, 1, 2 };
+	aabb.verts_begin = 0;
+	aabb.verts_end = 3;
+	aabb.verts_capacity_end = 3;
+	aabb_vert_indexes = { 0, 1, 2 };
 
 	for (uint32_t i = 0; i < 3; i++) {
 
 		Vertex& vertex = verts[i];
 		vertex.init();
-		vertex.normal = { 0.f, 0.f, 0.f };
+		vertex.aabb = 0;
+		vertex.idx_in_aabb = i;
+		vert_normals[i] = { 0.f, 0.f, 0.f };
 	}
 
 	addTris(0, 1, 2);
@@ -580,16 +1189,16 @@ void SculptMesh::createAsLine(glm::vec3& origin, glm::vec3& direction, float len
 
 void SculptMesh::changeLineOrigin(glm::vec3& new_origin)
 {
-	verts[0].pos = new_origin;
-	verts[1].pos = new_origin;
+	vert_positions[0] = new_origin;
+	vert_positions[1] = new_origin;
 }
 
 void SculptMesh::changeLineDirection(glm::vec3& new_direction)
 {
-	glm::vec3& origin = verts[0].pos;
-	float length = glm::distance(verts[0].pos, verts[2].pos);
+	glm::vec3& origin = vert_positions[0];
+	float length = glm::distance(vert_positions[0], vert_positions[2]);
 
 	glm::vec3 target = origin + new_direction * length;
 
-	verts[2].pos = target;
+	vert_positions[2] = target;
 }
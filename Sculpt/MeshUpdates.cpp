@@ -17,17 +17,116 @@ void SculptMesh::markAllVerticesForNormalUpdate()
 {
 	modified_verts.resize(verts.size());
 
-	uint32_t i = 0;
-	for (auto iter = verts.begin(); iter != verts.end(); iter.next()) {
+	verts.parallelForEachRanked([&](Vertex&, uint32_t vertex_idx, uint32_t rank) {
 
-		ModifiedVertex& modified_vertex = modified_verts[i];
-		modified_vertex.idx = iter.index();
+		ModifiedVertex& modified_vertex = modified_verts[rank];
+		modified_vertex.idx = vertex_idx;
 		modified_vertex.state = ModifiedVertexState::UPDATE;
+	});
 
-		i++;
+	this->dirty_vertex_normals = true;
+}
+
+void SculptMesh::_dedupeModifiedVerts()
+{
+	_modified_vert_epoch++;
+
+	// the marks overflowed so old marks could look current
+	if (_modified_vert_epoch == 0) {
+		std::fill(_modified_vert_marks.begin(), _modified_vert_marks.end(), 0);
+		_modified_vert_epoch = 1;
 	}
 
-	this->dirty_vertex_normals = true;
+	if (_modified_vert_marks.size() < verts.capacity()) {
+		_modified_vert_marks.resize(verts.capacity(), 0);
+	}
+
+	uint32_t kept_count = 0;
+
+	for (ModifiedVertex& modified_v : modified_verts) {
+
+		if (modified_v.state == ModifiedVertexState::UPDATE) {
+
+			uint32_t& mark = _modified_vert_marks[modified_v.idx];
+
+			if (mark == _modified_vert_epoch) {
+				continue;
+			}
+			mark = _modified_vert_epoch;
+		}
+
+		modified_verts[kept_count++] = modified_v;
+	}
+
+	modified_verts.resize(kept_count);
+}
+
+// packs the alive vertices marked for update into groups of 64 compute shader threads in parallel,
+// load(group, thread_idx, vertex_idx) is called from multiple threads
+template<typename Group, typename Load>
+static void packVertexUpdates(SparseVector<Vertex>& verts, std::vector<ModifiedVertex>& modified_verts,
+	std::vector<Group>& r_groups, Load load)
+{
+	// modified vertices handed to a worker at a time
+	constexpr uint32_t block_size = 1024;
+
+	uint32_t modified_count = modified_verts.size();
+	uint32_t block_count = (modified_count + block_size - 1) / block_size;
+
+	auto is_packed = [&](ModifiedVertex& modified_v) {
+		return modified_v.state == ModifiedVertexState::UPDATE &&
+			verts.isDeleted(modified_v.idx) == false;
+	};
+
+	// Counting
+	std::vector<uint32_t> block_offsets(block_count);
+
+	conc::parallel_for(0u, block_count, [&](uint32_t block_idx) {
+
+		uint32_t begin = block_idx * block_size;
+		uint32_t end = std::min(begin + block_size, modified_count);
+
+		uint32_t count = 0;
+		for (uint32_t i = begin; i < end; i++) {
+			if (is_packed(modified_verts[i])) {
+				count++;
+			}
+		}
+		block_offsets[block_idx] = count;
+	});
+
+	uint32_t packed_count = 0;
+	for (uint32_t& block_offset : block_offsets) {
+		uint32_t count = block_offset;
+		block_offset = packed_count;
+		packed_count += count;
+	}
+
+	r_groups.resize(packed_count / 64 + 1);
+
+	// Load
+	conc::parallel_for(0u, block_count, [&](uint32_t block_idx) {
+
+		uint32_t begin = block_idx * block_size;
+		uint32_t end = std::min(begin + block_size, modified_count);
+
+		uint32_t rank = block_offsets[block_idx];
+		for (uint32_t i = begin; i < end; i++) {
+
+			ModifiedVertex& modified_v = modified_verts[i];
+
+			if (is_packed(modified_v)) {
+				load(r_groups[rank / 64], rank % 64, modified_v.idx);
+				rank++;
+			}
+		}
+	});
+
+	// Round Down Threads
+	Group& last_group = r_groups.back();
+	for (uint32_t thread_idx = packed_count % 64; thread_idx < 64; thread_idx++) {
+		last_group.vertex_id[thread_idx] = 0;
+	}
 }
 
 void SculptMesh::uploadVertexAddsRemoves()
@@ -62,54 +161,12 @@ void SculptMesh::uploadVertexPositions()
 
 		auto& r = renderer;
 
-		// Counting
-		{
-			uint32_t group_count = 1;
-			uint32_t thread_count = 0;
-
-			for (scme::ModifiedVertex& modified_v : modified_verts) {
-
-				if (modified_v.state == ModifiedVertexState::UPDATE &&
-					verts.isDeleted(modified_v.idx) == false)
-				{
-					thread_count++;
-
-					if (thread_count == 64) {
-						group_count++;
-						thread_count = 0;
-					}
-				}
-			}
-
-			r.vert_pos_updates.resize(group_count);
-		}
-
-		uint32_t group_idx = 0;
-		uint32_t thread_idx = 0;
-
-		for (scme::ModifiedVertex& modified_v : modified_verts) {
-
-			if (modified_v.state == ModifiedVertexState::UPDATE &&
-				verts.isDeleted(modified_v.idx) == false)
-			{
-				auto& update = r.vert_pos_updates[group_idx];
-				update.vertex_id[thread_idx] = modified_v.idx + 1;
-				update.new_pos[thread_idx] = dxConvert(verts[modified_v.idx].pos);
+		packVertexUpdates(verts, modified_verts, r.vert_pos_updates,
+			[&](GPU_VertexPositionUpdateGroup& update, uint32_t thread_idx, uint32_t vertex_idx) {
 
-				thread_idx++;
-
-				if (thread_idx == 64) {
-					group_idx++;
-					thread_idx = 0;
-				}
-			}
-		}
-
-		// Round Down Threads
-		uint32_t last_thread = thread_idx;
-		for (thread_idx = last_thread; thread_idx < 64; thread_idx++) {
-			r.vert_pos_updates[group_idx].vertex_id[thread_idx] = 0;
-		}
+				update.vertex_id[thread_idx] = vertex_idx + 1;
+				update.new_pos[thread_idx] = dxConvert(vert_positions[vertex_idx]);
+			});
 
 		// Load
 		r.gpu_vert_pos_updates.upload(r.vert_pos_updates);
@@ -150,58 +207,19 @@ void SculptMesh::uploadVertexNormals()
 
 		auto& r = renderer;
 
-		// Counting
-		{
-			uint32_t group_count = 1;
-			uint32_t thread_count = 0;
-
-			for (scme::ModifiedVertex& modified_v : modified_verts) {
-
-				if (modified_v.state == ModifiedVertexState::UPDATE &&
-					verts.isDeleted(modified_v.idx) == false)
-				{
-					thread_count++;
-
-					if (thread_count == 64) {
-						group_count++;
-						thread_count = 0;
-					}
-				}
-			}
-
-			r.vert_normal_updates.resize(group_count);
-		}
-
-		uint32_t group_idx = 0;
-		uint32_t thread_idx = 0;
+		// each vertex is packed once so that no two threads write the same normal
+		_dedupeModifiedVerts();
 
-		for (scme::ModifiedVertex& modified_v : modified_verts) {
-
-			if (modified_v.state == ModifiedVertexState::UPDATE &&
-				verts.isDeleted(modified_v.idx) == false)
-			{
-				calcVertexNormal(modified_v.idx);
+		// normals are averaged from the polys around each vertex,
+		// the adjacency tables are used only if already built since few vertices change per upload
+		packVertexUpdates(verts, modified_verts, r.vert_normal_updates,
+			[&](GPU_VertexNormalUpdateGroup& update, uint32_t thread_idx, uint32_t vertex_idx) {
 
-				// Load
-				auto& update = r.vert_normal_updates[group_idx];
-				update.vertex_id[thread_idx] = modified_v.idx + 1;
-				update.new_normal[thread_idx] = dxConvert(verts[modified_v.idx].normal);
+				calcVertexNormal(vertex_idx);
 
-				// Increment
-				thread_idx++;
-
-				if (thread_idx == 64) {
-					group_idx++;
-					thread_idx = 0;
-				}
-			}
-		}
-
-		// Round Down Threads
-		uint32_t last_thread = thread_idx;
-		for (thread_idx = last_thread; thread_idx < 64; thread_idx++) {
-			r.vert_normal_updates[group_idx].vertex_id[thread_idx] = 0;
-		}
+				update.vertex_id[thread_idx] = vertex_idx + 1;
+				update.new_normal[thread_idx] = dxConvert(vert_normals[vertex_idx]);
+			});
 
 		// Load
 		r.gpu_vert_normal_updates.upload(r.vert_normal_updates);
@@ -420,29 +438,15 @@ void SculptMesh::uploadTesselationTriangles(TesselationModificationBasis based_o
 
 		case scme::TesselationModificationBasis::MODIFIED_VERTICES: {
 
+			buildAdjacency();
+
 			for (scme::ModifiedVertex& modified_v : modified_verts) {
 
 				if (modified_v.state == ModifiedVertexState::UPDATE &&
 					verts.isDeleted(modified_v.idx) == false)
 				{
-					Vertex& vertex = verts[modified_v.idx];
-
-					if (vertex.edge == 0xFFFF'FFFF) {
-						return;
-					}
-
-					// loop around the changed vertex to update all polygons connected to that vertex
-					uint32_t edge_idx = vertex.edge;
-					Edge* edge = &edges[edge_idx];
-
-					do {
-						group_updates(edge->p0);
-						group_updates(edge->p1);
-
-						// Iter
-						edge_idx = edge->nextEdgeOf(modified_v.idx);
-						edge = &edges[edge_idx];
-					} while (edge_idx != vertex.edge);
+					// update all polygons connected to the changed vertex
+					forEachVertexPoly(modified_v.idx, group_updates);
 				}
 			}
 			break;
@@ -504,10 +508,10 @@ void SculptMesh::uploadTesselationTriangles(TesselationModificationBasis based_o
 					break;
 				}
 
-				Poly& poly = polys[updates.tess_idxs[thread_idx][0] / 2];
-				poly.normal = results.poly_normal[thread_idx];
-				poly.tess_normals[0] = results.tess_normals[thread_idx][0];
-				poly.tess_normals[1] = results.tess_normals[thread_idx][1];
+				PolyNormals& normals = poly_normals[updates.tess_idxs[thread_idx][0] / 2];
+				normals.normal = results.poly_normal[thread_idx];
+				normals.tess_normals[0] = results.tess_normals[thread_idx][0];
+				normals.tess_normals[1] = results.tess_normals[thread_idx][1];
 			}
 		}
 	}
@@ -0,0 +1,634 @@
+
+// Header
+#include "SculptMesh.hpp"
+
+#include <ppl.h>
+
+
+using namespace scme;
+namespace conc = concurrency;
+
+
+// a poly as seen by the builder
+struct BVH_PolyRef {
+	AxisBoundingBox3D<> aabb;
+	glm::vec3 centroid;
+	uint32_t poly_idx;
+};
+
+constexpr uint32_t bvh_max_leaf_polys = 4;
+constexpr uint32_t bvh_bin_count = 16;
+constexpr uint32_t bvh_parallel_polys = 16384;  // ranges bigger than this are built in parallel
+constexpr uint32_t bvh_max_sah_depth = 40;  // deeper nodes split in half so that bad splits cannot chain
+
+static void setEmpty(AxisBoundingBox3D<>& aabb)
+{
+	aabb.min = { FLT_MAX, FLT_MAX, FLT_MAX };
+	aabb.max = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+}
+
+static void grow(AxisBoundingBox3D<>& aabb, const AxisBoundingBox3D<>& other)
+{
+	aabb.min = glm::min(aabb.min, other.min);
+	aabb.max = glm::max(aabb.max, other.max);
+}
+
+static void grow(AxisBoundingBox3D<>& aabb, const glm::vec3& pos)
+{
+	aabb.min = glm::min(aabb.min, pos);
+	aabb.max = glm::max(aabb.max, pos);
+}
+
+static float halfArea(AxisBoundingBox3D<>& aabb)
+{
+	glm::vec3 size = aabb.max - aabb.min;
+	return size.x * size.y + size.y * size.z + size.z * size.x;
+}
+
+static void polyBounds(SculptMesh& mesh, uint32_t poly_idx, AxisBoundingBox3D<>& r_aabb)
+{
+	Poly* poly = &mesh.polys[poly_idx];
+
+	setEmpty(r_aabb);
+
+	if (poly->is_tris) {
+
+		std::array<glm::vec3, 3> vs;
+		mesh.getTrisPrimitives(poly, vs);
+
+		for (glm::vec3& v : vs) {
+			grow(r_aabb, v);
+		}
+	}
+	else {
+		std::array<glm::vec3, 4> vs;
+		mesh.getQuadPrimitives(poly, vs);
+
+		for (glm::vec3& v : vs) {
+			grow(r_aabb, v);
+		}
+	}
+}
+
+static void setChildBounds(PolyBVH_Node& node, uint32_t child, AxisBoundingBox3D<>& aabb)
+{
+	node.min_x[child] = aabb.min.x;
+	node.min_y[child] = aabb.min.y;
+	node.min_z[child] = aabb.min.z;
+	node.max_x[child] = aabb.max.x;
+	node.max_y[child] = aabb.max.y;
+	node.max_z[child] = aabb.max.z;
+}
+
+// writes the triangles of the polys into the lanes of the block, returns how many lanes are used
+static uint32_t gatherTrisBlock(SculptMesh& mesh, const uint32_t* poly_idxs, uint32_t poly_count,
+	PolyBVH_TrisBlock& r_block)
+{
+	uint32_t lane = 0;
+
+	auto set_lane = [&](glm::vec3& v0, glm::vec3& v1, glm::vec3& v2, uint32_t poly_idx) {
+
+		glm::vec3 v0v1 = v1 - v0;
+		glm::vec3 v0v2 = v2 - v0;
+
+		r_block.v0_x[lane] = v0.x;
+		r_block.v0_y[lane] = v0.y;
+		r_block.v0_z[lane] = v0.z;
+		r_block.v0v1_x[lane] = v0v1.x;
+		r_block.v0v1_y[lane] = v0v1.y;
+		r_block.v0v1_z[lane] = v0v1.z;
+		r_block.v0v2_x[lane] = v0v2.x;
+		r_block.v0v2_y[lane] = v0v2.y;
+		r_block.v0v2_z[lane] = v0v2.z;
+		r_block.polys[lane] = poly_idx;
+		lane++;
+	};
+
+	for (uint32_t i = 0; i < poly_count; i++) {
+
+		Poly* poly = &mesh.polys[poly_idxs[i]];
+
+		if (poly->is_tris) {
+
+			std::array<glm::vec3, 3> vs;
+			mesh.getTrisPrimitives(poly, vs);
+
+			set_lane(vs[0], vs[1], vs[2], poly_idxs[i]);
+		}
+		else {
+			std::array<glm::vec3, 4> vs;
+			mesh.getQuadPrimitives(poly, vs);
+
+			// same split as raycastPoly
+			if (poly->tesselation_type == 0) {
+				set_lane(vs[0], vs[1], vs[2], poly_idxs[i]);
+				set_lane(vs[0], vs[2], vs[3], poly_idxs[i]);
+			}
+			else {
+				set_lane(vs[0], vs[1], vs[3], poly_idxs[i]);
+				set_lane(vs[1], vs[2], vs[3], poly_idxs[i]);
+			}
+		}
+	}
+
+	uint32_t tris_count = lane;
+
+	glm::vec3 zero = { 0, 0, 0 };
+
+	while (lane < 8) {
+		set_lane(zero, zero, zero, 0xFFFF'FFFF);
+	}
+
+	return tris_count;
+}
+
+static void nodeBounds(PolyBVH_Node& node, AxisBoundingBox3D<>& r_aabb)
+{
+	setEmpty(r_aabb);
+
+	for (uint32_t i = 0; i < 4; i++) {
+
+		if (node.children[i] != 0xFFFF'FFFF) {
+			grow(r_aabb, { { node.min_x[i], node.min_y[i], node.min_z[i] },
+				{ node.max_x[i], node.max_y[i], node.max_z[i] } });
+		}
+	}
+}
+
+struct SAH_Bins {
+	AxisBoundingBox3D<> aabbs[3][bvh_bin_count];
+	uint32_t counts[3][bvh_bin_count];
+
+	SAH_Bins()
+	{
+		for (uint32_t axis = 0; axis < 3; axis++) {
+			for (uint32_t bin = 0; bin < bvh_bin_count; bin++) {
+				setEmpty(aabbs[axis][bin]);
+				counts[axis][bin] = 0;
+			}
+		}
+	}
+
+	void merge(const SAH_Bins& other)
+	{
+		for (uint32_t axis = 0; axis < 3; axis++) {
+			for (uint32_t bin = 0; bin < bvh_bin_count; bin++) {
+				grow(aabbs[axis][bin], other.aabbs[axis][bin]);
+				counts[axis][bin] += other.counts[axis][bin];
+			}
+		}
+	}
+};
+
+// calls func(i, local) for i in [begin, end), big ranges are split between threads each with its own local
+template<typename T, typename Func, typename Combine>
+static T reduceRange(uint32_t begin, uint32_t end, Func func, Combine combine)
+{
+	if (end - begin <= bvh_parallel_polys) {
+
+		T local;
+		for (uint32_t i = begin; i < end; i++) {
+			func(i, local);
+		}
+		return local;
+	}
+
+	conc::combinable<T> locals;
+	uint32_t chunk_count = (end - begin + bvh_parallel_polys - 1) / bvh_parallel_polys;
+
+	conc::parallel_for(0u, chunk_count, [&](uint32_t chunk) {
+
+		T& local = locals.local();
+
+		uint32_t chunk_begin = begin + chunk * bvh_parallel_polys;
+		uint32_t chunk_end = std::min(chunk_begin + bvh_parallel_polys, end);
+
+		for (uint32_t i = chunk_begin; i < chunk_end; i++) {
+			func(i, local);
+		}
+	});
+
+	T result;
+	locals.combine_each([&](const T& local) {
+		combine(result, local);
+	});
+
+	return result;
+}
+
+struct CentroidBounds {
+	AxisBoundingBox3D<> aabb;
+
+	CentroidBounds()
+	{
+		setEmpty(aabb);
+	}
+};
+
+// splits the refs in [begin, end) in two by the surface area heuristic with binned centroids,
+// returns where the second half starts
+static uint32_t splitSAH(std::vector<BVH_PolyRef>& refs, uint32_t begin, uint32_t end)
+{
+	AxisBoundingBox3D<> centroid_bounds = reduceRange<CentroidBounds>(begin, end,
+		[&](uint32_t i, CentroidBounds& local) {
+			grow(local.aabb, refs[i].centroid);
+		},
+		[](CentroidBounds& result, const CentroidBounds& local) {
+			grow(result.aabb, local.aabb);
+		}).aabb;
+
+	glm::vec3 extent = centroid_bounds.max - centroid_bounds.min;
+	glm::vec3 bin_scale;
+
+	for (uint32_t axis = 0; axis < 3; axis++) {
+		bin_scale[axis] = extent[axis] > 0 ? (bvh_bin_count * 0.9999f) / extent[axis] : 0;
+	}
+
+	auto bin_of = [&](BVH_PolyRef& ref, uint32_t axis) {
+		uint32_t bin = (uint32_t)((ref.centroid[axis] - centroid_bounds.min[axis]) * bin_scale[axis]);
+		return std::min(bin, bvh_bin_count - 1);
+	};
+
+	SAH_Bins bins = reduceRange<SAH_Bins>(begin, end,
+		[&](uint32_t i, SAH_Bins& local) {
+
+			BVH_PolyRef& ref = refs[i];
+
+			for (uint32_t axis = 0; axis < 3; axis++) {
+
+				uint32_t bin = bin_of(ref, axis);
+				grow(local.aabbs[axis][bin], ref.aabb);
+				local.counts[axis][bin]++;
+			}
+		},
+		[](SAH_Bins& result, const SAH_Bins& local) {
+			result.merge(local);
+		});
+
+	// the cost of splitting after each bin is the area times the poly count of both sides
+	float best_cost = FLT_MAX;
+	uint32_t best_axis = 0xFFFF'FFFF;
+	uint32_t best_bin;
+
+	for (uint32_t axis = 0; axis < 3; axis++) {
+
+		if (extent[axis] <= 0) {
+			continue;
+		}
+
+		float right_costs[bvh_bin_count];
+		{
+			AxisBoundingBox3D<> right;
+			setEmpty(right);
+			uint32_t right_count = 0;
+
+			for (uint32_t bin = bvh_bin_count - 1; bin > 0; bin--) {
+
+				grow(right, bins.aabbs[axis][bin]);
+				right_count += bins.counts[axis][bin];
+				right_costs[bin - 1] = right_count ? right_count * halfArea(right) : 0;
+			}
+		}
+
+		AxisBoundingBox3D<> left;
+		setEmpty(left);
+		uint32_t left_count = 0;
+
+		for (uint32_t bin = 0; bin < bvh_bin_count - 1; bin++) {
+
+			grow(left, bins.aabbs[axis][bin]);
+			left_count += bins.counts[axis][bin];
+
+			if (left_count == 0 || left_count == end - begin) {
+				continue;
+			}
+
+			float cost = left_count * halfArea(left) + right_costs[bin];
+
+			if (cost < best_cost) {
+				best_cost = cost;
+				best_axis = axis;
+				best_bin = bin;
+			}
+		}
+	}
+
+	// all the centroids are in the same spot so split in the middle
+	if (best_axis == 0xFFFF'FFFF) {
+		return begin + (end - begin) / 2;
+	}
+
+	auto mid = std::partition(refs.begin() + begin, refs.begin() + end, [&](BVH_PolyRef& ref) {
+		return bin_of(ref, best_axis) <= best_bin;
+	});
+
+	return (uint32_t)(mid - refs.begin());
+}
+
+// builds the node of the refs [begin, end) at the end of r_nodes and returns its index
+static uint32_t buildNode(std::vector<BVH_PolyRef>& refs, uint32_t begin, uint32_t end, uint32_t depth,
+	std::vector<PolyBVH_Node>& r_nodes)
+{
+	uint32_t node_idx = r_nodes.size();
+	r_nodes.emplace_back();
+
+	// split the biggest range until there are 4 children or all of them fit in a leaf
+	uint32_t child_count = 1;
+	uint32_t child_begins[4] = { begin };
+	uint32_t child_ends[4] = { end };
+
+	while (child_count < 4) {
+
+		uint32_t split_child = 0xFFFF'FFFF;
+		uint32_t split_size = bvh_max_leaf_polys;
+
+		for (uint32_t i = 0; i < child_count; i++) {
+
+			uint32_t size = child_ends[i] - child_begins[i];
+
+			if (size > split_size) {
+				split_child = i;
+				split_size = size;
+			}
+		}
+
+		if (split_child == 0xFFFF'FFFF) {
+			break;
+		}
+
+		uint32_t mid = depth < bvh_max_sah_depth ?
+			splitSAH(refs, child_begins[split_child], child_ends[split_child]) :
+			child_begins[split_child] + split_size / 2;
+
+		child_begins[child_count] = mid;
+		child_ends[child_count] = child_ends[split_child];
+		child_ends[split_child] = mid;
+		child_count++;
+	}
+
+	// Children
+	uint32_t children[4];
+
+	auto is_leaf = [&](uint32_t i) {
+		return child_ends[i] - child_begins[i] <= bvh_max_leaf_polys;
+	};
+
+	if (end - begin > bvh_parallel_polys) {
+
+		// each subtree is built on its own then appended after the others
+		std::array<std::vector<PolyBVH_Node>, 4> subtrees;
+
+		conc::parallel_for(0u, child_count, [&](uint32_t i) {
+			if (is_leaf(i) == false) {
+				buildNode(refs, child_begins[i], child_ends[i], depth + 1, subtrees[i]);
+			}
+		});
+
+		for (uint32_t i = 0; i < child_count; i++) {
+
+			if (is_leaf(i)) {
+				continue;
+			}
+
+			uint32_t offset = r_nodes.size();
+			r_nodes.insert(r_nodes.end(), subtrees[i].begin(), subtrees[i].end());
+
+			for (uint32_t node = offset; node < r_nodes.size(); node++) {
+
+				PolyBVH_Node& subtree_node = r_nodes[node];
+
+				for (uint32_t j = 0; j < 4; j++) {
+					if (subtree_node.counts[j] == 0 && subtree_node.children[j] != 0xFFFF'FFFF) {
+						subtree_node.children[j] += offset;
+					}
+				}
+			}
+
+			children[i] = offset;
+		}
+	}
+	else {
+		for (uint32_t i = 0; i < child_count; i++) {
+			if (is_leaf(i) == false) {
+				children[i] = buildNode(refs, child_begins[i], child_ends[i], depth + 1, r_nodes);
+			}
+		}
+	}
+
+	PolyBVH_Node& node = r_nodes[node_idx];
+
+	for (uint32_t i = 0; i < 4; i++) {
+
+		AxisBoundingBox3D<> aabb;
+		setEmpty(aabb);
+
+		if (i >= child_count) {
+			node.children[i] = 0xFFFF'FFFF;
+			node.counts[i] = 0;
+		}
+		else if (is_leaf(i)) {
+			node.children[i] = child_begins[i];
+			node.counts[i] = child_ends[i] - child_begins[i];
+
+			for (uint32_t j = child_begins[i]; j < child_ends[i]; j++) {
+				grow(aabb, refs[j].aabb);
+			}
+		}
+		else {
+			node.children[i] = children[i];
+			node.counts[i] = 0;
+
+			nodeBounds(r_nodes[children[i]], aabb);
+		}
+
+		setChildBounds(node, i, aabb);
+	}
+
+	return node_idx;
+}
+
+void SculptMesh::buildPolyBVH()
+{
+	if (poly_bvh.is_valid) {
+
+		// several strokes can move vertices before the renderer refits
+		if (poly_bvh.needs_refit) {
+			refitPolyBVH();
+		}
+		return;
+	}
+
+	uint32_t poly_count = polys.size();
+
+	std::vector<BVH_PolyRef> refs(poly_count);
+
+	polys.parallelForEachRanked([&](Poly&, uint32_t poly_idx, uint32_t rank) {
+
+		BVH_PolyRef& ref = refs[rank];
+		polyBounds(*this, poly_idx, ref.aabb);
+		ref.centroid = (ref.aabb.min + ref.aabb.max) * 0.5f;
+		ref.poly_idx = poly_idx;
+	});
+
+	std::vector<PolyBVH_Node>& nodes = poly_bvh.nodes;
+	nodes.clear();
+
+	if (poly_count) {
+		buildNode(refs, 0, poly_count, 0, nodes);
+	}
+
+	// links used by refit to go up from a poly
+	uint32_t node_count = nodes.size();
+
+	poly_bvh.parents.assign(node_count, 0xFFFF'FFFF);
+	poly_bvh.poly_nodes.resize(polys.size() ? polys.lastIndex() + 1 : 0);
+
+	// one block of triangles per leaf, numbered in node order
+	std::vector<uint32_t> block_offsets(node_count + 1);
+	{
+		uint32_t offset = 0;
+
+		for (uint32_t node_idx = 0; node_idx < node_count; node_idx++) {
+
+			block_offsets[node_idx] = offset;
+
+			for (uint32_t count : nodes[node_idx].counts) {
+				offset += count != 0;
+			}
+		}
+		block_offsets[node_count] = offset;
+	}
+
+	poly_bvh.tris_blocks.resize(block_offsets[node_count]);
+
+	conc::parallel_for(0u, node_count, [&](uint32_t node_idx) {
+
+		PolyBVH_Node& node = nodes[node_idx];
+		uint32_t block_idx = block_offsets[node_idx];
+
+		for (uint32_t i = 0; i < 4; i++) {
+
+			if (node.counts[i]) {
+
+				uint32_t leaf_polys[bvh_max_leaf_polys];
+
+				for (uint32_t j = 0; j < node.counts[i]; j++) {
+
+					leaf_polys[j] = refs[node.children[i] + j].poly_idx;
+					poly_bvh.poly_nodes[leaf_polys[j]] = node_idx;
+				}
+
+				node.counts[i] = gatherTrisBlock(*this, leaf_polys, node.counts[i],
+					poly_bvh.tris_blocks[block_idx]);
+				node.children[i] = block_idx;
+				block_idx++;
+			}
+			else if (node.children[i] != 0xFFFF'FFFF) {
+				poly_bvh.parents[node.children[i]] = node_idx;
+			}
+		}
+	});
+
+	poly_bvh.refit_marks.assign(node_count, 0);
+	poly_bvh.refit_epoch = 0;
+	poly_bvh.is_valid = true;
+	poly_bvh.needs_refit = false;
+}
+
+void SculptMesh::invalidatePolyBVH()
+{
+	poly_bvh.is_valid = false;
+}
+
+void SculptMesh::refitPolyBVH()
+{
+	if (poly_bvh.is_valid == false) {
+		return;
+	}
+
+	poly_bvh.needs_refit = false;
+
+	std::vector<uint32_t>& marks = poly_bvh.refit_marks;
+
+	poly_bvh.refit_epoch++;
+
+	// the marks overflowed so old marks could look current
+	if (poly_bvh.refit_epoch == 0) {
+		std::fill(marks.begin(), marks.end(), 0);
+		poly_bvh.refit_epoch = 1;
+	}
+
+	uint32_t epoch = poly_bvh.refit_epoch;
+
+	// the nodes with the modified polys and all their ancestors
+	std::vector<uint32_t> dirty_nodes;
+
+	for (ModifiedVertex& modified_vertex : modified_verts) {
+
+		if (modified_vertex.state != ModifiedVertexState::UPDATE ||
+			verts.isDeleted(modified_vertex.idx))
+		{
+			continue;
+		}
+
+		forEachVertexPoly(modified_vertex.idx, [&](uint32_t poly_idx) {
+
+			uint32_t node_idx = poly_bvh.poly_nodes[poly_idx];
+
+			while (node_idx != 0xFFFF'FFFF && marks[node_idx] != epoch) {
+
+				marks[node_idx] = epoch;
+				dirty_nodes.push_back(node_idx);
+
+				node_idx = poly_bvh.parents[node_idx];
+			}
+		});
+	}
+
+	// children come after their parents so going backwards updates them first
+	std::sort(dirty_nodes.begin(), dirty_nodes.end(), std::greater<uint32_t>());
+
+	for (uint32_t node_idx : dirty_nodes) {
+
+		PolyBVH_Node& node = poly_bvh.nodes[node_idx];
+
+		for (uint32_t i = 0; i < 4; i++) {
+
+			AxisBoundingBox3D<> aabb;
+			setEmpty(aabb);
+
+			if (node.counts[i]) {
+
+				PolyBVH_TrisBlock& block = poly_bvh.tris_blocks[node.children[i]];
+
+				// the lanes of a quad are next to each other
+				uint32_t leaf_polys[bvh_max_leaf_polys];
+				uint32_t leaf_poly_count = 0;
+
+				for (uint32_t lane = 0; lane < node.counts[i]; lane++) {
+
+					if (lane == 0 || block.polys[lane] != block.polys[lane - 1]) {
+						leaf_polys[leaf_poly_count++] = block.polys[lane];
+					}
+				}
+
+				for (uint32_t j = 0; j < leaf_poly_count; j++) {
+
+					AxisBoundingBox3D<> poly_aabb;
+					polyBounds(*this, leaf_polys[j], poly_aabb);
+					grow(aabb, poly_aabb);
+				}
+
+				gatherTrisBlock(*this, leaf_polys, leaf_poly_count, block);
+			}
+			else if (node.children[i] != 0xFFFF'FFFF) {
+				nodeBounds(poly_bvh.nodes[node.children[i]], aabb);
+			}
+			else {
+				continue;
+			}
+
+			setChildBounds(node, i, aabb);
+		}
+	}
+}
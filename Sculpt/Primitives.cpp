@@ -2,8 +2,11 @@
 // Header
 #include "SculptMesh.hpp"
 
+#include <ppl.h>
+
 
 using namespace scme;
+namespace conc = concurrency;
 
 
 void Vertex::init()
@@ -17,72 +20,53 @@ bool Vertex::isPoint()
 	return edge == 0xFFFF'FFFF;
 }
 
-bool VertexBoundingBox::isLeaf()
+bool VertexBoundingBox::isLeaf() const
 {
 	return children[0] == 0xFFFF'FFFF;
 }
 
-bool VertexBoundingBox::hasVertices()
+bool VertexBoundingBox::isFree() const
 {
-	return verts.size() > 0;
+	return children[0] == 0xFFFF'FFFE;
 }
 
-uint32_t VertexBoundingBox::inWhichChildDoesPositionReside(glm::vec3& pos)
+bool VertexBoundingBox::hasVertices() const
 {
-	assert_cond(isLeaf() == false, "should not be called for leafs because leafs don't have children");
+	return verts_end > verts_begin;
+}
 
-	// above
-	if (pos.y >= mid.y) {
+uint32_t VertexBoundingBox::vertexCount() const
+{
+	return verts_end - verts_begin;
+}
 
-		// forward
-		if (pos.z >= mid.z) {
+uint32_t VertexBoundingBox::octantOf(glm::vec3& pos)
+{
+	uint32_t octant = 0;
 
-			// left
-			if (pos.x <= mid.x) {
-				return children[0];
-			}
-			// right
-			else {
-				return children[1];
-			}
-		}
-		// back
-		else {
-			// left
-			if (pos.x <= mid.x) {
-				return children[2];
-			}
-			// right
-			else {
-				return children[3];
-			}
-		}
-	}
 	// below
-	else {
-		// forward
-		if (pos.z >= mid.z) {
-
-			// left
-			if (pos.x <= mid.x) {
-				return children[4];
-			}
-			// right
-			else {
-				return children[5];
-			}
-		}
-		// back
-		else {
-			// left
-			if (pos.x <= mid.x) {
-				return children[6];
-			}
-		}
+	if (pos.y < mid.y) {
+		octant |= 4;
+	}
+
+	// back
+	if (pos.z < mid.z) {
+		octant |= 2;
 	}
 
 	// right
-	return children[7];
+	if (pos.x > mid.x) {
+		octant |= 1;
+	}
+
+	return octant;
+}
+
+uint32_t VertexBoundingBox::inWhichChildDoesPositionReside(glm::vec3& pos)
+{
+	assert_cond(isLeaf() == false, "should not be called for leafs because leafs don't have children");
+
+	return children[octantOf(pos)];
 }
 
 uint32_t& Edge::nextEdgeOf(uint32_t vertex_idx)
@@ -119,9 +103,59 @@ void Edge::setPrevNextEdges(uint32_t vertex_idx, uint32_t prev_edge_idx, uint32_
 	}
 }
 
+void SculptMesh::_resizeVertexMemory(uint32_t vertex_count)
+{
+	verts.resize(vertex_count);
+	vert_positions.resize(vertex_count);
+	vert_normals.resize(vertex_count);
+
+	invalidateAdjacency();
+}
+
+void SculptMesh::_resizeEdgeMemory(uint32_t edge_count)
+{
+	edges.resize(edge_count);
+
+	invalidateAdjacency();
+}
+
+void SculptMesh::_resizePolyMemory(uint32_t poly_count)
+{
+	polys.resize(poly_count);
+	poly_normals.resize(poly_count);
+
+	invalidateAdjacency();
+	invalidatePolyBVH();
+}
+
+uint32_t SculptMesh::_createEdgeMemory()
+{
+	uint32_t new_edge_idx;
+	edges.emplace(new_edge_idx);
+
+	return new_edge_idx;
+}
+
+uint32_t SculptMesh::_createPolyMemory()
+{
+	uint32_t new_poly_idx;
+	polys.emplace(new_poly_idx);
+
+	if (new_poly_idx >= poly_normals.size()) {
+		poly_normals.resize(polys.capacity());
+	}
+
+	return new_poly_idx;
+}
+
 void SculptMesh::_deleteVertexMemory(uint32_t vertex_idx)
 {
+	if (verts[vertex_idx].aabb != 0xFFFF'FFFF) {
+		_removeVertexFromAABB(vertex_idx);
+	}
+
 	verts.erase(vertex_idx);
+	invalidateAdjacency();
 
 	ModifiedVertex& modified_vertex = modified_verts.emplace_back();
 	modified_vertex.idx = vertex_idx;
@@ -131,11 +165,14 @@ void SculptMesh::_deleteVertexMemory(uint32_t vertex_idx)
 void SculptMesh::_deleteEdgeMemory(uint32_t edge_idx)
 {
 	edges.erase(edge_idx);
+	invalidateAdjacency();
 }
 
 void SculptMesh::_deletePolyMemory(uint32_t poly_idx)
 {
 	polys.erase(poly_idx);
+	invalidateAdjacency();
+	invalidatePolyBVH();
 
 	ModifiedPoly& modified_poly = modified_polys.emplace_back();
 	modified_poly.idx = poly_idx;
@@ -144,6 +181,126 @@ void SculptMesh::_deletePolyMemory(uint32_t poly_idx)
 	dirty_index_buff = true;
 }
 
+// packs a column indexed the same as a SparseVector using the remap of that SparseVector
+template<typename T>
+static void compactColumn(std::vector<T>& column, std::vector<uint32_t>& remap, uint32_t new_count)
+{
+	std::vector<T> packed(new_count);
+
+	conc::parallel_for(0u, (uint32_t)remap.size(), [&](uint32_t i) {
+		uint32_t new_idx = remap[i];
+
+		if (new_idx != 0xFFFF'FFFF) {
+			packed[new_idx] = column[i];
+		}
+	});
+
+	column.swap(packed);
+}
+
+void SculptMesh::compact(CompactionRemaps* r_remaps)
+{
+	CompactionRemaps local_remaps;
+	CompactionRemaps& remaps = r_remaps != nullptr ? *r_remaps : local_remaps;
+
+	uint32_t old_vertex_count = verts._count;
+	uint32_t old_poly_count = polys._count;
+	uint32_t new_vertex_count = verts.size();
+	uint32_t new_edge_count = edges.size();
+	uint32_t new_poly_count = polys.size();
+
+	conc::parallel_invoke(
+		[&]() { verts.buildCompactionRemap(remaps.verts); },
+		[&]() { edges.buildCompactionRemap(remaps.edges); },
+		[&]() { polys.buildCompactionRemap(remaps.polys); }
+	);
+
+	std::vector<uint32_t>& vert_remap = remaps.verts;
+	std::vector<uint32_t>& edge_remap = remaps.edges;
+	std::vector<uint32_t>& poly_remap = remaps.polys;
+
+	// move primitives and rewrite the references in the same pass
+	conc::parallel_invoke(
+		[&]() {
+			verts.compact(vert_remap, [&](Vertex& vertex) {
+				if (vertex.edge != 0xFFFF'FFFF) {
+					vertex.edge = edge_remap[vertex.edge];
+				}
+			});
+		},
+		[&]() {
+			edges.compact(edge_remap, [&](Edge& edge) {
+				edge.v0 = vert_remap[edge.v0];
+				edge.v0_next_edge = edge_remap[edge.v0_next_edge];
+				edge.v0_prev_edge = edge_remap[edge.v0_prev_edge];
+
+				edge.v1 = vert_remap[edge.v1];
+				edge.v1_next_edge = edge_remap[edge.v1_next_edge];
+				edge.v1_prev_edge = edge_remap[edge.v1_prev_edge];
+
+				if (edge.p0 != 0xFFFF'FFFF) {
+					edge.p0 = poly_remap[edge.p0];
+				}
+
+				if (edge.p1 != 0xFFFF'FFFF) {
+					edge.p1 = poly_remap[edge.p1];
+				}
+			});
+		},
+		[&]() {
+			polys.compact(poly_remap, [&](Poly& poly) {
+				poly.edges[0] = edge_remap[poly.edges[0]];
+				poly.edges[1] = edge_remap[poly.edges[1]];
+				poly.edges[2] = edge_remap[poly.edges[2]];
+
+				if (poly.is_tris == false) {
+					poly.edges[3] = edge_remap[poly.edges[3]];
+				}
+			});
+		},
+		[&]() { compactColumn(vert_positions, vert_remap, new_vertex_count); },
+		[&]() { compactColumn(vert_normals, vert_remap, new_vertex_count); },
+		[&]() { compactColumn(poly_normals, poly_remap, new_poly_count); },
+		[&]() {
+			// only the used part of the leaf ranges holds live vertices
+			conc::parallel_for_each(aabbs.begin(), aabbs.end(), [&](VertexBoundingBox& aabb) {
+				for (uint32_t i = aabb.verts_begin; i < aabb.verts_end; i++) {
+					aabb_vert_indexes[i] = vert_remap[aabb_vert_indexes[i]];
+				}
+			});
+		}
+	);
+
+	// the pending changes reference old indexes so replace them with a full reupload
+	// and clear the now unused tail of the GPU buffers
+	modified_verts.resize(old_vertex_count);
+
+	for (uint32_t i = 0; i < old_vertex_count; i++) {
+
+		ModifiedVertex& modified_vertex = modified_verts[i];
+		modified_vertex.idx = i;
+		modified_vertex.state = i < verts.size() ? ModifiedVertexState::UPDATE : ModifiedVertexState::DELETED;
+	}
+
+	modified_polys.resize(old_poly_count);
+
+	for (uint32_t i = 0; i < old_poly_count; i++) {
+
+		ModifiedPoly& modified_poly = modified_polys[i];
+		modified_poly.idx = i;
+		modified_poly.state = i < polys.size() ? ModifiedPolyState::UPDATE : ModifiedPolyState::DELETED;
+	}
+
+	invalidateAdjacency();
+	invalidatePolyBVH();
+
+	dirty_vertex_list = true;
+	dirty_vertex_pos = true;
+	dirty_vertex_normals = true;
+	dirty_index_buff = true;
+	dirty_tess_tris = true;
+}
+
 void SculptMesh::printEdgeListOfVertex(uint32_t vertex_idx)
 {
 	Vertex& vertex = verts[vertex_idx];
@@ -165,40 +322,26 @@ void SculptMesh::printEdgeListOfVertex(uint32_t vertex_idx)
 
 void SculptMesh::calcVertexNormal(uint32_t vertex_idx)
 {
-	Vertex* vertex = &verts[vertex_idx];
-
-	if (vertex->edge == 0xFFFF'FFFF) {
+	if (verts[vertex_idx].edge == 0xFFFF'FFFF) {
 		return;
 	}
 
+	// accumulate locally so that the stored normal is written only once
 	uint32_t count = 0;
-	vertex->normal = { 0, 0, 0 };
-
-	uint32_t edge_idx = vertex->edge;
-	Edge* edge = &edges[edge_idx];
+	glm::vec3 normal = { 0, 0, 0 };
 
-	do {
-		Poly* poly;
-		if (edge->p0 != 0xFFFF'FFFF) {
-			poly = &polys[edge->p0];
-			vertex->normal += poly->normal;
-			count++;
-		}
+	forEachVertexPoly(vertex_idx, [&](uint32_t poly_idx) {
+		normal += poly_normals[poly_idx].normal;
+		count++;
+	});
 
-		if (edge->p1 != 0xFFFF'FFFF) {
-			poly = &polys[edge->p1];
-			vertex->normal += poly->normal;
-			count++;
-		}
-
-		// Iter
-		edge_idx = edge->nextEdgeOf(vertex_idx);
-		edge = &edges[edge_idx];
+	// a vertex on loose edges keeps its normal
+	if (count == 0) {
+		return;
 	}
-	while (edge_idx != vertex->edge);
 
-	vertex->normal /= count;
-	vertex->normal = glm::normalize(vertex->normal);
+	normal /= count;
+	vert_normals[vertex_idx] = glm::normalize(normal);
 }
 
 void SculptMesh::markVertexFullUpdate(uint32_t vertex)
@@ -210,6 +353,43 @@ void SculptMesh::markVertexFullUpdate(uint32_t vertex)
 	this->dirty_vertex_list = true;
 	this->dirty_vertex_pos = true;
 	this->dirty_vertex_normals = true;
+	poly_bvh.needs_refit = true;
+}
+
+void SculptMesh::markVerticesFullUpdate(const std::vector<uint32_t>& vertices)
+{
+	uint32_t old_size = modified_verts.size();
+	modified_verts.resize(old_size + vertices.size());
+
+	conc::parallel_for(0u, (uint32_t)vertices.size(), [&](uint32_t i) {
+
+		ModifiedVertex& modified_vertex = modified_verts[old_size + i];
+		modified_vertex.idx = vertices[i];
+		modified_vertex.state = ModifiedVertexState::UPDATE;
+	});
+
+	this->dirty_vertex_list = true;
+	this->dirty_vertex_pos = true;
+	this->dirty_vertex_normals = true;
+	poly_bvh.needs_refit = true;
+}
+
+void SculptMesh::markAllVerticesFullUpdate()
+{
+	uint32_t old_size = modified_verts.size();
+	modified_verts.resize(old_size + verts.size());
+
+	verts.parallelForEachRanked([&](Vertex&, uint32_t vertex_idx, uint32_t rank) {
+
+		ModifiedVertex& modified_vertex = modified_verts[old_size + rank];
+		modified_vertex.idx = vertex_idx;
+		modified_vertex.state = ModifiedVertexState::UPDATE;
+	});
+
+	this->dirty_vertex_list = true;
+	this->dirty_vertex_pos = true;
+	this->dirty_vertex_normals = true;
+	poly_bvh.needs_refit = true;
 }
 
 void SculptMesh::deleteVertex(uint32_t)
@@ -271,10 +451,10 @@ uint32_t SculptMesh::findEdgeBetween(uint32_t v0_idx, uint32_t v1_idx)
 	return 0xFFFF'FFFF;
 }
 
-glm::vec3 calcNormalForTrisPositions(Vertex* v0, Vertex* v1, Vertex* v2)
+glm::vec3 calcNormalForTrisPositions(glm::vec3& v0, glm::vec3& v1, glm::vec3& v2)
 {
-	glm::vec3 dir_0 = glm::normalize(v1->pos - v0->pos);
-	glm::vec3 dir_1 = glm::normalize(v2->pos - v0->pos);
+	glm::vec3 dir_0 = glm::normalize(v1 - v0);
+	glm::vec3 dir_1 = glm::normalize(v2 - v0);
 
 	return glm::normalize(-glm::cross(dir_0, dir_1));
 }
@@ -284,6 +464,8 @@ void SculptMesh::registerEdgeToVertexList(uint32_t new_edge_idx, uint32_t vertex
 	Edge& new_edge = edges[new_edge_idx];
 	Vertex& vertex = verts[vertex_idx];
 
+	invalidateAdjacency();
+
 	// if vertex is point then vertex loop list is unused
 	if (vertex.edge == 0xFFFF'FFFF) {
 
@@ -308,6 +490,8 @@ void SculptMesh::registerEdgeToVertexList(uint32_t new_edge_idx, uint32_t vertex
 
 void SculptMesh::unregisterEdgeFromVertex(Edge* delete_edge, uint32_t vertex_idx, Vertex* vertex)
 {
+	invalidateAdjacency();
+
 	if (vertex->edge != 0xFFFF'FFFF) {
 
 		uint32_t prev_edge_idx = delete_edge->prevEdgeOf(vertex_idx);
@@ -328,6 +512,9 @@ void SculptMesh::unregisterEdgeFromVertex(Edge* delete_edge, uint32_t vertex_idx
 
 void SculptMesh::registerPolyToEdge(uint32_t new_poly_idx, uint32_t edge_idx)
 {
+	invalidateAdjacency();
+	invalidatePolyBVH();
+
 	Edge& edge = edges[edge_idx];
 	if (edge.p0 == 0xFFFF'FFFF) {
 		edge.p0 = new_poly_idx;
@@ -339,6 +526,8 @@ void SculptMesh::registerPolyToEdge(uint32_t new_poly_idx, uint32_t edge_idx)
 
 void SculptMesh::unregisterPolyFromEdge(uint32_t delete_poly_idx, uint32_t edge_idx)
 {
+	invalidateAdjacency();
+
 	Edge& edge = edges[edge_idx];
 	if (edge.p0 == delete_poly_idx) {
 		edge.p0 = 0xFFFF'FFFF;
@@ -350,8 +539,7 @@ void SculptMesh::unregisterPolyFromEdge(uint32_t delete_poly_idx, uint32_t edge_
 
 uint32_t SculptMesh::createEdge(uint32_t v0, uint32_t v1)
 {
-	uint32_t new_loop_idx;;
-	edges.emplace(new_loop_idx);
+	uint32_t new_loop_idx = _createEdgeMemory();
 
 	setEdge(new_loop_idx, v0, v1);
 	return new_loop_idx;
@@ -364,7 +552,6 @@ void SculptMesh::setEdge(uint32_t existing_edge_idx, uint32_t v0_idx, uint32_t v
 	existing_edge->v1 = v1_idx;
 	existing_edge->p0 = 0xFFFF'FFFF;
 	existing_edge->p1 = 0xFFFF'FFFF;
-	existing_edge->was_raycast_tested = false;
 
 	registerEdgeToVertexList(existing_edge_idx, v0_idx);
 	registerEdgeToVertexList(existing_edge_idx, v1_idx);
@@ -380,43 +567,62 @@ uint32_t SculptMesh::addEdge(uint32_t v0, uint32_t v1)
 	return existing_loop;
 }
 
-glm::vec3 SculptMesh::calcWindingNormal(Vertex* v0, Vertex* v1, Vertex* v2)
+glm::vec3 SculptMesh::calcWindingNormal(glm::vec3& v0, glm::vec3& v1, glm::vec3& v2)
 {
-	return -glm::normalize(glm::cross(v1->pos - v0->pos, v2->pos - v0->pos));
+	return -glm::normalize(glm::cross(v1 - v0, v2 - v0));
 }
 
-void SculptMesh::calcPolyNormal(Poly* poly)
+void SculptMesh::calcPolyNormal(uint32_t poly_idx)
 {
+	Poly* poly = &polys[poly_idx];
+	PolyNormals& normals = poly_normals[poly_idx];
+
 	if (poly->is_tris) {
 
-		std::array<scme::Vertex*, 3> vs;
+		std::array<glm::vec3, 3> vs;
 		getTrisPrimitives(poly, vs);
 
 		// Triangle Normal
-		poly->normal = calcWindingNormal(vs[0], vs[1], vs[2]);
-		poly->tess_normals[0] = poly->normal;
-		poly->tess_normals[1] = poly->normal;
+		normals.normal = calcWindingNormal(vs[0], vs[1], vs[2]);
+		normals.tess_normals[0] = normals.normal;
+		normals.tess_normals[1] = normals.normal;
 	}
 	else {
-		std::array<scme::Vertex*, 4> vs;
+		std::array<glm::vec3, 4> vs;
 		getQuadPrimitives(poly, vs);
 
 		// Tesselation and Normals
-		if (glm::distance(vs[0]->pos, vs[2]->pos) < glm::distance(vs[1]->pos, vs[3]->pos)) {
+		if (glm::distance(vs[0], vs[2]) < glm::distance(vs[1], vs[3])) {
 
 			poly->tesselation_type = 0;
-			poly->tess_normals[0] = calcWindingNormal(vs[0], vs[1], vs[2]);
-			poly->tess_normals[1] = calcWindingNormal(vs[0], vs[2], vs[3]);
+			normals.tess_normals[0] = calcWindingNormal(vs[0], vs[1], vs[2]);
+			normals.tess_normals[1] = calcWindingNormal(vs[0], vs[2], vs[3]);
 		}
 		else {
 			poly->tesselation_type = 1;
-			poly->tess_normals[0] = calcWindingNormal(vs[0], vs[1], vs[3]);
-			poly->tess_normals[1] = calcWindingNormal(vs[1], vs[2], vs[3]);
+			normals.tess_normals[0] = calcWindingNormal(vs[0], vs[1], vs[3]);
+			normals.tess_normals[1] = calcWindingNormal(vs[1], vs[2], vs[3]);
 		}
-		poly->normal = glm::normalize((poly->tess_normals[0] + poly->tess_normals[1]) / 2.f);
+		normals.normal = glm::normalize((normals.tess_normals[0] + normals.tess_normals[1]) / 2.f);
 	}
 }
 
+void SculptMesh::markAllPolysFullUpdate()
+{
+	uint32_t old_size = modified_polys.size();
+	modified_polys.resize(old_size + polys.size());
+
+	polys.parallelForEachRanked([&](Poly&, uint32_t poly_idx, uint32_t rank) {
+
+		ModifiedPoly& modified_poly = modified_polys[old_size + rank];
+		modified_poly.idx = poly_idx;
+		modified_poly.state = ModifiedPolyState::UPDATE;
+	});
+
+	dirty_index_buff = true;
+	dirty_tess_tris = true;
+}
+
 void SculptMesh::markPolyFullUpdate(uint32_t poly)
 {
 	ModifiedPoly& modified_poly = modified_polys.emplace_back();
@@ -427,6 +633,22 @@ void SculptMesh::markPolyFullUpdate(uint32_t poly)
 	dirty_tess_tris = true;
 }
 
+void SculptMesh::markPolysFullUpdate(const std::vector<uint32_t>& polys_to_update)
+{
+	uint32_t old_size = modified_polys.size();
+	modified_polys.resize(old_size + polys_to_update.size());
+
+	conc::parallel_for(0u, (uint32_t)polys_to_update.size(), [&](uint32_t i) {
+
+		ModifiedPoly& modified_poly = modified_polys[old_size + i];
+		modified_poly.idx = polys_to_update[i];
+		modified_poly.state = ModifiedPolyState::UPDATE;
+	});
+
+	dirty_index_buff = true;
+	dirty_tess_tris = true;
+}
+
 void SculptMesh::setTris(uint32_t new_poly_idx, uint32_t v0, uint32_t v1, uint32_t v2)
 {
 	Poly& new_poly = polys[new_poly_idx];
@@ -453,8 +675,7 @@ void SculptMesh::setTris(uint32_t new_poly_idx, uint32_t v0, uint32_t v1, uint32
 
 uint32_t SculptMesh::addTris(uint32_t v0, uint32_t v1, uint32_t v2)
 {
-	uint32_t new_tris_idx;
-	polys.emplace(new_tris_idx);
+	uint32_t new_tris_idx = _createPolyMemory();
 	
 	setTris(new_tris_idx, v0, v1, v2);
 
@@ -492,8 +713,7 @@ void SculptMesh::setQuad(uint32_t new_quad_idx, uint32_t v0, uint32_t v1, uint32
 
 uint32_t SculptMesh::addQuad(uint32_t v0, uint32_t v1, uint32_t v2, uint32_t v3)
 {
-	uint32_t new_quad_idx;
-	polys.emplace(new_quad_idx);
+	uint32_t new_quad_idx = _createPolyMemory();
 	
 	setQuad(new_quad_idx, v0, v1, v2, v3);
 
@@ -564,23 +784,6 @@ void SculptMesh::deletePoly(uint32_t delete_poly_idx)
 	_deletePolyMemory(delete_poly_idx);
 }
 
-void SculptMesh::getTrisPrimitives(Poly* poly,
-	std::array<uint32_t, 3>& r_vs_idxs, std::array<Vertex*, 3>& r_vs)
-{
-	std::array<Edge*, 3> r_es;
-	r_es[0] = &edges[poly->edges[0]];
-	r_es[1] = &edges[poly->edges[1]];
-	r_es[2] = &edges[poly->edges[2]];
-
-	r_vs_idxs[0] = poly->flip_edge_0 ? r_es[0]->v1 : r_es[0]->v0;
-	r_vs_idxs[1] = poly->flip_edge_1 ? r_es[1]->v1 : r_es[1]->v0;
-	r_vs_idxs[2] = poly->flip_edge_2 ? r_es[2]->v1 : r_es[2]->v0;
-
-	r_vs[0] = &verts[r_vs_idxs[0]];
-	r_vs[1] = &verts[r_vs_idxs[1]];
-	r_vs[2] = &verts[r_vs_idxs[2]];
-}
-
 void SculptMesh::getTrisPrimitives(Poly* poly, std::array<uint32_t, 3>& r_vs_idxs)
 {
 	std::array<Edge*, 3> r_es;
@@ -593,41 +796,14 @@ void SculptMesh::getTrisPrimitives(Poly* poly, std::array<uint32_t, 3>& r_vs_idx
 	r_vs_idxs[2] = poly->flip_edge_2 ? r_es[2]->v1 : r_es[2]->v0;
 }
 
-void SculptMesh::getTrisPrimitives(Poly* poly, std::array<Vertex*, 3>& r_vs)
-{
-	std::array<Edge*, 3> r_es;
-	r_es[0] = &edges[poly->edges[0]];
-	r_es[1] = &edges[poly->edges[1]];
-	r_es[2] = &edges[poly->edges[2]];
-
-	std::array<uint32_t, 3> r_vs_idxs;
-	r_vs_idxs[0] = poly->flip_edge_0 ? r_es[0]->v1 : r_es[0]->v0;
-	r_vs_idxs[1] = poly->flip_edge_1 ? r_es[1]->v1 : r_es[1]->v0;
-	r_vs_idxs[2] = poly->flip_edge_2 ? r_es[2]->v1 : r_es[2]->v0;
-
-	r_vs[0] = &verts[r_vs_idxs[0]];
-	r_vs[1] = &verts[r_vs_idxs[1]];
-	r_vs[2] = &verts[r_vs_idxs[2]];
-}
-
-void SculptMesh::getQuadPrimitives(Poly* poly,
-	std::array<uint32_t, 4>& r_vs_idxs, std::array<Vertex*, 4>& r_vs)
+void SculptMesh::getTrisPrimitives(Poly* poly, std::array<glm::vec3, 3>& r_vs)
 {
-	std::array<Edge*, 4> r_es;
-	r_es[0] = &edges[poly->edges[0]];
-	r_es[1] = &edges[poly->edges[1]];
-	r_es[2] = &edges[poly->edges[2]];
-	r_es[3] = &edges[poly->edges[3]];
-
-	r_vs_idxs[0] = poly->flip_edge_0 ? r_es[0]->v1 : r_es[0]->v0;
-	r_vs_idxs[1] = poly->flip_edge_1 ? r_es[1]->v1 : r_es[1]->v0;
-	r_vs_idxs[2] = poly->flip_edge_2 ? r_es[2]->v1 : r_es[2]->v0;
-	r_vs_idxs[3] = poly->flip_edge_3 ? r_es[3]->v1 : r_es[3]->v0;
+	std::array<uint32_t, 3> vs_idxs;
+	getTrisPrimitives(poly, vs_idxs);
 
-	r_vs[0] = &verts[r_vs_idxs[0]];
-	r_vs[1] = &verts[r_vs_idxs[1]];
-	r_vs[2] = &verts[r_vs_idxs[2]];
-	r_vs[3] = &verts[r_vs_idxs[3]];
+	r_vs[0] = vert_positions[vs_idxs[0]];
+	r_vs[1] = vert_positions[vs_idxs[1]];
+	r_vs[2] = vert_positions[vs_idxs[2]];
 }
 
 void SculptMesh::getQuadPrimitives(Poly* poly, std::array<uint32_t, 4>& r_vs_idxs)
@@ -644,37 +820,28 @@ void SculptMesh::getQuadPrimitives(Poly* poly, std::array<uint32_t, 4>& r_vs_idx
 	r_vs_idxs[3] = poly->flip_edge_3 ? r_es[3]->v1 : r_es[3]->v0;
 }
 
-void SculptMesh::getQuadPrimitives(Poly* poly, std::array<Vertex*, 4>& r_vs)
+void SculptMesh::getQuadPrimitives(Poly* poly, std::array<glm::vec3, 4>& r_vs)
 {
-	std::array<Edge*, 4> r_es;
-	r_es[0] = &edges[poly->edges[0]];
-	r_es[1] = &edges[poly->edges[1]];
-	r_es[2] = &edges[poly->edges[2]];
-	r_es[3] = &edges[poly->edges[3]];
-
-	std::array<uint32_t, 4> r_vs_idxs;
-	r_vs_idxs[0] = poly->flip_edge_0 ? r_es[0]->v1 : r_es[0]->v0;
-	r_vs_idxs[1] = poly->flip_edge_1 ? r_es[1]->v1 : r_es[1]->v0;
-	r_vs_idxs[2] = poly->flip_edge_2 ? r_es[2]->v1 : r_es[2]->v0;
-	r_vs_idxs[3] = poly->flip_edge_3 ? r_es[3]->v1 : r_es[3]->v0;
+	std::array<uint32_t, 4> vs_idxs;
+	getQuadPrimitives(poly, vs_idxs);
 
-	r_vs[0] = &verts[r_vs_idxs[0]];
-	r_vs[1] = &verts[r_vs_idxs[1]];
-	r_vs[2] = &verts[r_vs_idxs[2]];
-	r_vs[3] = &verts[r_vs_idxs[3]];
+	r_vs[0] = vert_positions[vs_idxs[0]];
+	r_vs[1] = vert_positions[vs_idxs[1]];
+	r_vs[2] = vert_positions[vs_idxs[2]];
+	r_vs[3] = vert_positions[vs_idxs[3]];
 }
 
 void SculptMesh::printVerices()
 {
 	for (auto iter = verts.begin(); iter != verts.end(); iter.next()) {
 
-		Vertex& vertex = iter.get();
+		glm::vec3& pos = vert_positions[iter.index()];
 
 		printf("vertex[%d].pos = { %.2f, %.2f %.2f } \n",
 			iter.index(),
-			vertex.pos.x,
-			vertex.pos.y,
-			vertex.pos.z
+			pos.x,
+			pos.y,
+			pos.z
 		);
 	}
 }
@@ -0,0 +1,313 @@
+#pragma once
+
+// Standard
+#include <cfloat>
+
+#include <immintrin.h>
+
+
+// SIMD Moller-Trumbore (raycastTrisWide) written once over a float lane type, used as 1 ray against many triangles
+// by broadcasting the ray or as many rays against 1 triangle by broadcasting the triangle,
+// and the closest point of many triangles to 1 position (closestPointTrisWide)
+
+namespace scme {
+
+	struct Float4 {
+		__m128 v;
+
+		static constexpr uint32_t lanes = 4;
+
+		static Float4 set1(float value) { return { _mm_set1_ps(value) }; }
+		static Float4 load(const float* values) { return { _mm_load_ps(values) }; }
+		static Float4 loadUnaligned(const float* values) { return { _mm_loadu_ps(values) }; }
+
+		void store(float* r_values) { _mm_store_ps(r_values, v); }
+		void storeUnaligned(float* r_values) { _mm_storeu_ps(r_values, v); }
+	};
+
+	inline Float4 operator+(Float4 a, Float4 b) { return { _mm_add_ps(a.v, b.v) }; }
+	inline Float4 operator-(Float4 a, Float4 b) { return { _mm_sub_ps(a.v, b.v) }; }
+	inline Float4 operator*(Float4 a, Float4 b) { return { _mm_mul_ps(a.v, b.v) }; }
+	inline Float4 operator/(Float4 a, Float4 b) { return { _mm_div_ps(a.v, b.v) }; }
+
+	// comparisons return all bits set in the lanes where true, NaN lanes are false
+	inline Float4 operator<(Float4 a, Float4 b) { return { _mm_cmplt_ps(a.v, b.v) }; }
+	inline Float4 operator<=(Float4 a, Float4 b) { return { _mm_cmple_ps(a.v, b.v) }; }
+	inline Float4 operator>=(Float4 a, Float4 b) { return { _mm_cmpge_ps(a.v, b.v) }; }
+	inline Float4 operator&(Float4 a, Float4 b) { return { _mm_and_ps(a.v, b.v) }; }
+
+	inline Float4 absLanes(Float4 a) { return { _mm_andnot_ps(_mm_set1_ps(-0.f), a.v) }; }
+	inline Float4 sqrtLanes(Float4 a) { return { _mm_sqrt_ps(a.v) }; }
+
+	// return b in the lanes where either is NaN
+	inline Float4 minLanes(Float4 a, Float4 b) { return { _mm_min_ps(a.v, b.v) }; }
+	inline Float4 maxLanes(Float4 a, Float4 b) { return { _mm_max_ps(a.v, b.v) }; }
+
+	// mask ? a : b
+	inline Float4 select(Float4 mask, Float4 a, Float4 b)
+	{
+		return { _mm_or_ps(_mm_and_ps(mask.v, a.v), _mm_andnot_ps(mask.v, b.v)) };
+	}
+
+	inline uint32_t moveMask(Float4 mask) { return _mm_movemask_ps(mask.v); }
+
+
+#ifdef __AVX2__
+	struct Float8 {
+		__m256 v;
+
+		static constexpr uint32_t lanes = 8;
+
+		static Float8 set1(float value) { return { _mm256_set1_ps(value) }; }
+		static Float8 load(const float* values) { return { _mm256_load_ps(values) }; }
+		static Float8 loadUnaligned(const float* values) { return { _mm256_loadu_ps(values) }; }
+
+		void store(float* r_values) { _mm256_store_ps(r_values, v); }
+		void storeUnaligned(float* r_values) { _mm256_storeu_ps(r_values, v); }
+	};
+
+	inline Float8 operator+(Float8 a, Float8 b) { return { _mm256_add_ps(a.v, b.v) }; }
+	inline Float8 operator-(Float8 a, Float8 b) { return { _mm256_sub_ps(a.v, b.v) }; }
+	inline Float8 operator*(Float8 a, Float8 b) { return { _mm256_mul_ps(a.v, b.v) }; }
+	inline Float8 operator/(Float8 a, Float8 b) { return { _mm256_div_ps(a.v, b.v) }; }
+
+	inline Float8 operator<(Float8 a, Float8 b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ) }; }
+	inline Float8 operator<=(Float8 a, Float8 b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ) }; }
+	inline Float8 operator>=(Float8 a, Float8 b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ) }; }
+	inline Float8 operator&(Float8 a, Float8 b) { return { _mm256_and_ps(a.v, b.v) }; }
+
+	inline Float8 absLanes(Float8 a) { return { _mm256_andnot_ps(_mm256_set1_ps(-0.f), a.v) }; }
+	inline Float8 sqrtLanes(Float8 a) { return { _mm256_sqrt_ps(a.v) }; }
+
+	inline Float8 minLanes(Float8 a, Float8 b) { return { _mm256_min_ps(a.v, b.v) }; }
+	inline Float8 maxLanes(Float8 a, Float8 b) { return { _mm256_max_ps(a.v, b.v) }; }
+
+	inline Float8 select(Float8 mask, Float8 a, Float8 b) { return { _mm256_blendv_ps(b.v, a.v, mask.v) }; }
+
+	inline uint32_t moveMask(Float8 mask) { return _mm256_movemask_ps(mask.v); }
+
+	using FloatWide = Float8;
+#else
+	using FloatWide = Float4;
+#endif
+
+
+	template<typename F>
+	struct WideVec3 {
+		F x;
+		F y;
+		F z;
+
+		static WideVec3 set1(const glm::vec3& value)
+		{
+			return { F::set1(value.x), F::set1(value.y), F::set1(value.z) };
+		}
+
+		static WideVec3 load(const float* xs, const float* ys, const float* zs)
+		{
+			return { F::load(xs), F::load(ys), F::load(zs) };
+		}
+
+		static WideVec3 loadUnaligned(const float* xs, const float* ys, const float* zs)
+		{
+			return { F::loadUnaligned(xs), F::loadUnaligned(ys), F::loadUnaligned(zs) };
+		}
+
+		void store(float* r_xs, float* r_ys, float* r_zs)
+		{
+			x.store(r_xs);
+			y.store(r_ys);
+			z.store(r_zs);
+		}
+	};
+
+	template<typename F>
+	WideVec3<F> operator+(const WideVec3<F>& a, const WideVec3<F>& b)
+	{
+		return { a.x + b.x, a.y + b.y, a.z + b.z };
+	}
+
+	template<typename F>
+	WideVec3<F> operator-(const WideVec3<F>& a, const WideVec3<F>& b)
+	{
+		return { a.x - b.x, a.y - b.y, a.z - b.z };
+	}
+
+	template<typename F>
+	WideVec3<F> operator*(const WideVec3<F>& a, F scale)
+	{
+		return { a.x * scale, a.y * scale, a.z * scale };
+	}
+
+	template<typename F>
+	F dot(const WideVec3<F>& a, const WideVec3<F>& b)
+	{
+		return a.x * b.x + a.y * b.y + a.z * b.z;
+	}
+
+	template<typename F>
+	WideVec3<F> cross(const WideVec3<F>& a, const WideVec3<F>& b)
+	{
+		return {
+			a.y * b.z - a.z * b.y,
+			a.z * b.x - a.x * b.z,
+			a.x * b.y - a.y * b.x
+		};
+	}
+
+	// returns the distance along the direction of the hit in each lane,
+	// FLT_MAX for lanes that miss, are parallel, behind the origin or not closer than max_t,
+	// r_u and r_v are the barycentric weights of v1 and v2 at the hit
+	template<typename F>
+	F raycastTrisWide(const WideVec3<F>& orig, const WideVec3<F>& dir,
+		const WideVec3<F>& v0, const WideVec3<F>& v0v1, const WideVec3<F>& v0v2, F max_t,
+		F& r_u, F& r_v)
+	{
+		WideVec3<F> pvec = cross(dir, v0v2);
+		F det = dot(v0v1, pvec);
+		F inv_det = F::set1(1.f) / det;
+
+		WideVec3<F> tvec = orig - v0;
+		F u = dot(tvec, pvec) * inv_det;
+
+		WideVec3<F> qvec = cross(tvec, v0v1);
+		F v = dot(dir, qvec) * inv_det;
+
+		F t = dot(v0v2, qvec) * inv_det;
+
+		F zero = F::set1(0.f);
+		F one = F::set1(1.f);
+
+		F hit = (absLanes(det) >= F::set1(1e-8f)) &
+			(u >= zero) & (u <= one) &
+			(v >= zero) & (u + v <= one) &
+			(t >= zero) & (t < max_t);
+
+		r_u = u;
+		r_v = v;
+
+		return select(hit, t, F::set1(FLT_MAX));
+	}
+
+	// returns the squared distance from the position to the closest point of the triangle in each lane,
+	// r_u and r_v are the barycentric weights of v1 and v2 at the closest point
+	template<typename F>
+	F closestPointTrisWide(const WideVec3<F>& pos,
+		const WideVec3<F>& v0, const WideVec3<F>& v0v1, const WideVec3<F>& v0v2,
+		F& r_u, F& r_v)
+	{
+		F zero = F::set1(0.f);
+		F one = F::set1(1.f);
+
+		WideVec3<F> v0p = pos - v0;
+
+		F d00 = dot(v0v1, v0v1);
+		F d01 = dot(v0v1, v0v2);
+		F d11 = dot(v0v2, v0v2);
+		F d20 = dot(v0p, v0v1);
+		F d21 = dot(v0p, v0v2);
+
+		auto dist_sqr_at = [&](F u, F v) {
+			WideVec3<F> delta = {
+				v0p.x - v0v1.x * u - v0v2.x * v,
+				v0p.y - v0v1.y * u - v0v2.y * v,
+				v0p.z - v0v1.z * u - v0v2.z * v
+			};
+			return dot(delta, delta);
+		};
+
+		// maxLanes returns zero for NaN so degenerate edges clamp to their start
+		auto clamp01 = [&](F t) {
+			return minLanes(maxLanes(t, zero), one);
+		};
+
+		// projection on the plane, used only when it lands inside the triangle
+		F inv_denom = one / (d00 * d11 - d01 * d01);
+		F plane_u = (d11 * d20 - d01 * d21) * inv_denom;
+		F plane_v = (d00 * d21 - d01 * d20) * inv_denom;
+		F inside = (plane_u >= zero) & (plane_v >= zero) & (plane_u + plane_v <= one);
+
+		F closest = select(inside, dist_sqr_at(plane_u, plane_v), F::set1(FLT_MAX));
+		F closest_u = select(inside, plane_u, zero);
+		F closest_v = select(inside, plane_v, zero);
+
+		auto keep_closer = [&](F u, F v) {
+			F dist_sqr = dist_sqr_at(u, v);
+			F closer = dist_sqr < closest;
+			closest = select(closer, dist_sqr, closest);
+			closest_u = select(closer, u, closest_u);
+			closest_v = select(closer, v, closest_v);
+		};
+
+		// edges v0 v1, v0 v2 and v1 v2
+		keep_closer(clamp01(d20 / d00), zero);
+		keep_closer(zero, clamp01(d21 / d11));
+
+		F t = clamp01((d21 - d20 - d01 + d00) / (d00 - d01 - d01 + d11));
+		keep_closer(one - t, t);
+
+		r_u = closest_u;
+		r_v = closest_v;
+
+		return closest;
+	}
+
+
+	// up to 8 coherent rays traced together, unused lanes have zero directions that hit nothing
+	struct alignas(32) RayPacket {
+		float origin_x[8];
+		float origin_y[8];
+		float origin_z[8];
+		float dir_x[8];
+		float dir_y[8];
+		float dir_z[8];
+
+		// closest hit of each ray so far, start as FLT_MAX and 0xFFFF'FFFF
+		float closest_t[8];
+		uint32_t polys[8];
+		uint32_t poly_tris[8];  // which triangle of the poly was hit
+		float u[8];
+		float v[8];
+	};
+
+	// tests all the rays of the packet against 1 triangle keeping the closest hit of each ray,
+	// the triangle is given as v0 and the edges to v1 and v2
+	inline void raycastTrisPacket(RayPacket& packet,
+		const glm::vec3& v0, const glm::vec3& v0v1, const glm::vec3& v0v2,
+		uint32_t poly, uint32_t poly_tris)
+	{
+		using F = FloatWide;
+
+		WideVec3<F> tris_v0 = WideVec3<F>::set1(v0);
+		WideVec3<F> tris_v0v1 = WideVec3<F>::set1(v0v1);
+		WideVec3<F> tris_v0v2 = WideVec3<F>::set1(v0v2);
+
+		for (uint32_t lane = 0; lane < 8; lane += F::lanes) {
+
+			WideVec3<F> orig = WideVec3<F>::load(packet.origin_x + lane, packet.origin_y + lane, packet.origin_z + lane);
+			WideVec3<F> dir = WideVec3<F>::load(packet.dir_x + lane, packet.dir_y + lane, packet.dir_z + lane);
+			F closest_t = F::load(packet.closest_t + lane);
+
+			F u;
+			F v;
+			F t = raycastTrisWide(orig, dir, tris_v0, tris_v0v1, tris_v0v2, closest_t, u, v);
+
+			F hit = t < closest_t;
+			uint32_t hit_mask = moveMask(hit);
+
+			if (hit_mask) {
+
+				select(hit, t, closest_t).store(packet.closest_t + lane);
+				select(hit, u, F::load(packet.u + lane)).store(packet.u + lane);
+				select(hit, v, F::load(packet.v + lane)).store(packet.v + lane);
+
+				for (uint32_t i = 0; i < F::lanes; i++) {
+					if (hit_mask & (1 << i)) {
+						packet.polys[lane + i] = poly;
+						packet.poly_tris[lane + i] = poly_tris;
+					}
+				}
+			}
+		}
+	}
+}
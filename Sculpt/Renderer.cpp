@@ -266,6 +266,9 @@ void MeshRenderer::loadVertices()
 					}
 					}
 				}
+
+				sculpt_mesh.refitAABBs();
+				sculpt_mesh.refitPolyBVH();
 			}
 
 			sculpt_mesh.modified_verts.clear();
@@ -7,7 +7,9 @@
 #include <chrono>
 
 // GLM
+#include "glm\vec2.hpp"
 #include "glm\vec3.hpp"
+#include "glm\mat4x4.hpp"
 
 // DirectX 11
 #include "DX11Wrapper.hpp"
@@ -56,15 +58,16 @@ namespace scme {
 
 	// edge == 0xFFFF'FFFF, vertex is a point, not connected to anything
 	// aabb == 0xFFFF'FFFF, vertex does not belong to any AABB
+	//
+	// only the topology of the vertex is stored here, position and normal are stored in separate
+	// columns of the mesh (SculptMesh::vert_positions, SculptMesh::vert_normals) under the same index
+	// so that sweeps over positions don't drag the topology through the cache
 	struct Vertex {
 	public:
-		glm::vec3 pos;
-		glm::vec3 normal;
-
 		uint32_t edge;  // any edge attached to vertex
 
 		uint32_t aabb;  // to leaf AABB does this vertex belong
-		uint32_t idx_in_aabb;  // where to find vertex in parent AABB (makes AABB transfers faster)
+		uint32_t idx_in_aabb;  // where to find vertex in SculptMesh::aabb_vert_indexes (makes AABB transfers faster)
 
 	public:
 		Vertex() {};
@@ -81,6 +84,11 @@ namespace scme {
 	// - All AABBs get divided into 8, even if child AABBs are unused,
 	//   this is to not require storing which vertices belong to each child in a buffer before assigning them to
 	//   to the child AABB, as well as to enable resizing the AABB vector only once for all 8 children
+	// - The vertices of all leafs live in one array (SculptMesh::aabb_vert_indexes) in Morton order after a rebuild,
+	//   a leaf owns [verts_begin, verts_capacity_end) of it and uses [verts_begin, verts_end),
+	//   a leaf that runs out of room moves to the end of the array and leaves its old range unused
+	// - AABBs merged away by SculptMesh::refitAABBs are marked with children[0] == 0xFFFF'FFFE
+	//   and are neither leafs nor reachable from the root until they are reused
 	struct VertexBoundingBox {
 		uint32_t parent;
 		uint32_t children[8];
@@ -88,14 +96,20 @@ namespace scme {
 		AxisBoundingBox3D<> aabb;
 		glm::vec3 mid;
 
-		uint32_t verts_deleted_count;  // how many empty slots does this AABB have
-		std::vector<uint32_t> verts;  // indexes of contained vertices
+		uint32_t verts_begin;
+		uint32_t verts_end;
+		uint32_t verts_capacity_end;
 
 		//bool _debug_show_tesselation;  // TODO:
 
 	public:
-		bool isLeaf();
-		bool hasVertices();
+		bool isLeaf() const;
+		bool isFree() const;
+		bool hasVertices() const;
+		uint32_t vertexCount() const;
+
+		// index of the child octant, in the order of AxisBoundingBox3D::subdivide
+		uint32_t octantOf(glm::vec3& pos);
 
 		uint32_t inWhichChildDoesPositionReside(glm::vec3& pos);
 	};
@@ -110,7 +124,8 @@ namespace scme {
 
 
 	/* Winged-edge data structure */
-	struct Edge {
+	// only the connectivity is stored here (exactly 32 bytes, 2 edges per cache line)
+	struct alignas(32) Edge {
 	public:
 		// Double Linked list of edges around vertices
 		uint32_t v0;
@@ -125,9 +140,6 @@ namespace scme {
 		uint32_t p0;
 		uint32_t p1;
 
-		uint8_t was_raycast_tested : 1,  // used in poly raycasting to mark edge as tested
-			: 7;
-
 		Edge() {};
 
 		// edges don't have consistent orientation so a list edges around a vertex
@@ -136,7 +148,7 @@ namespace scme {
 		uint32_t& prevEdgeOf(uint32_t vertex);
 		void setPrevNextEdges(uint32_t vertex, uint32_t prev_edge, uint32_t next_edge);
 	};
-
+	static_assert(sizeof(Edge) == 32);
 
 	enum class ModifiedPolyState {
 		UPDATE,
@@ -149,13 +161,10 @@ namespace scme {
 	};
 
 
-	struct Poly {
+	// only the connectivity is stored here (padded to 32 bytes, 2 polys per cache line),
+	// normals are in PolyNormals
+	struct alignas(32) Poly {
 	public:
-		// the normal of the triangle or 
-		// the average normal of the 2 triangles composing the quad
-		glm::vec3 normal;
-		glm::vec3 tess_normals[2];
-
 		uint32_t edges[4];
 
 		uint8_t tesselation_type : 1,  // split from 0 to 2 or from 1 to 3
@@ -169,6 +178,142 @@ namespace scme {
 		Poly() {};
 	};
 	// NOTE TO SELF: wrong bit field syntax breaks MSVC hard
+	static_assert(sizeof(Poly) == 32);
+
+	// stored in a separate column of the mesh (SculptMesh::poly_normals) under the same index as the poly
+	struct PolyNormals {
+		// the normal of the triangle or 
+		// the average normal of the 2 triangles composing the quad
+		glm::vec3 normal;
+		glm::vec3 tess_normals[2];
+	};
+
+
+	// compressed sparse row adjacency, the neighbours of a vertex are found in the range
+	// [offsets[vertex], offsets[vertex + 1]) of the neighbour list
+	struct VertexAdjacency {
+		std::vector<uint32_t> poly_offsets;
+		std::vector<uint32_t> polys;  // each poly appears only once per vertex
+
+		std::vector<uint32_t> vert_offsets;
+		std::vector<uint32_t> verts;  // vertices connected to the vertex by an edge
+
+		bool is_valid = false;
+	};
+
+
+	// node of a 4 wide bounding volume hierarchy over the polys
+	struct alignas(16) PolyBVH_Node {
+		// bounds of the 4 children stored per axis so that all 4 are slab tested at once,
+		// unused children have inverted bounds that no ray can enter
+		float min_x[4];
+		float min_y[4];
+		float min_z[4];
+		float max_x[4];
+		float max_y[4];
+		float max_z[4];
+
+		// inner child: index of the node with a count of 0
+		// leaf child: index in PolyBVH::tris_blocks with the count of triangles
+		// unused child: 0xFFFF'FFFF with a count of 0
+		uint32_t children[4];
+		uint32_t counts[4];
+	};
+
+	// triangles of a BVH leaf gathered per component so that they are tested against a ray at once,
+	// quads take 2 lanes, unused lanes have zero edges that no ray can hit
+	struct alignas(32) PolyBVH_TrisBlock {
+		float v0_x[8];
+		float v0_y[8];
+		float v0_z[8];
+
+		// v1 - v0 and v2 - v0 as used by Moller-Trumbore
+		float v0v1_x[8];
+		float v0v1_y[8];
+		float v0v1_z[8];
+		float v0v2_x[8];
+		float v0v2_y[8];
+		float v0v2_z[8];
+
+		uint32_t polys[8];
+	};
+
+	struct PolyBVH {
+		std::vector<PolyBVH_Node> nodes;  // the root is the first node, children come after their parents
+		std::vector<PolyBVH_TrisBlock> tris_blocks;  // one per leaf
+		std::vector<uint32_t> parents;  // indexed the same as nodes
+
+		std::vector<uint32_t> poly_nodes;  // node that has the poly in a leaf, indexed the same as SculptMesh::polys
+
+		// nodes visited by refit are marked with the current epoch instead of clearing flags
+		std::vector<uint32_t> refit_marks;
+		uint32_t refit_epoch = 0;
+
+		bool is_valid = false;
+		bool needs_refit = false;  // vertices were marked for update since the last build or refit
+	};
+
+
+	// scratch of the spatial queries, each thread that queries a mesh owns one
+	// so that queries never write into the mesh and can run at the same time
+	struct QueryContext {
+		std::vector<uint32_t> stack;  // BVH or octree nodes left to visit
+		std::vector<std::pair<float, uint32_t>> node_queue;  // BVH nodes by squared distance, closest first
+
+		// octree leafs found by range queries, the ones fully inside the range and the ones crossing it
+		std::vector<uint32_t> inside_leafs;
+		std::vector<uint32_t> partial_leafs;
+		std::vector<uint32_t> leaf_offsets;  // where the vertices of each leaf go in the result
+
+		// vertices and polys visited by the current query have their mark equal to the epoch,
+		// so starting a query only increments the epoch instead of clearing the marks
+		std::vector<uint32_t> vert_marks;
+		std::vector<uint32_t> poly_marks;
+		uint32_t epoch = 0;
+
+		// starts a query that can visit vertex and poly indexes below the counts
+		void beginQuery(uint32_t vertex_count, uint32_t poly_count);
+
+		// returns true the first time the vertex/poly is visited by the current query
+		bool visitVertex(uint32_t vertex);
+		bool visitPoly(uint32_t poly);
+	};
+
+
+	struct Ray {
+		glm::vec3 origin;
+		glm::vec3 direction;
+	};
+
+	struct RayHit {
+		uint32_t poly;  // 0xFFFF'FFFF if the ray hit nothing
+
+		// triangle of the poly that was hit, split like in raycastPoly, 1 for the second triangle of a quad
+		uint32_t poly_tris;
+
+		// weights of the second and third corner of the triangle, the first one has 1 - x - y
+		glm::vec2 barycentric;
+
+		float distance;  // in multiples of the ray direction
+	};
+
+	struct ClosestPoint {
+		uint32_t poly;  // 0xFFFF'FFFF if no poly is within the max distance
+		uint32_t poly_tris;  // same as RayHit::poly_tris
+		glm::vec2 barycentric;  // same as RayHit::barycentric
+		glm::vec3 position;
+		float distance;
+	};
+
+
+	// depth buffer of the view, vertices behind the stored depth are hidden and are not selected
+	struct SelectionDepth {
+		const float* depths;  // row major from the top row, in the same range as clip z / w
+		uint32_t width;
+		uint32_t height;
+
+		float bias;  // how far behind the stored depth a vertex is still visible
+	};
 
 
 	struct StandardBrushInfo {
@@ -176,12 +321,109 @@ namespace scme {
 
 		glm::vec3 last_pos;
 
-		glm::vec3 end_pos;
+		glm::vec3 end_pos;  // center of the dab in mesh space
 		SteadyTime end_time;
 		
 		float diameter;
-		float focus;
-		float strength;
+		float focus;  // fraction of the radius moved at full strength before the falloff starts
+		float strength;  // displacement at the center in multiples of the radius
+	};
+
+	// a Laplacian step moves each vertex by factor * (average of its neighbours - vertex),
+	// Taubin smoothing follows each lambda step with a mu step (mu < -lambda) that undoes the shrinking
+	struct SmoothSettings {
+		uint32_t iterations = 1;
+		float lambda = 0.5f;
+		float mu = -0.53f;
+		bool taubin = true;
+	};
+
+	// turns the cursor samples of a stroke into dabs placed evenly along the surface,
+	// a new stroke starts with a new BrushStroke
+	struct BrushStroke {
+		float spacing = 0.25f;  // distance between dabs in multiples of the brush diameter
+
+		// cursor sample of the path so far, the distance walked from the last dab carries over to the next frame
+		bool has_last_sample = false;
+		Ray last_ray;
+		glm::vec3 last_pos;
+		float travelled;
+
+		// scratch of sampleStroke
+		std::vector<RayHit> cursor_hits;
+		std::vector<Ray> dab_rays;
+		std::vector<RayHit> dab_hits;
+	};
+
+	// the vertices moved by a grab stroke and their weights, captured once when the stroke starts
+	// so that the drag never queries the octree
+	struct GrabBrush {
+		glm::vec3 start_pos;  // grabbed point in mesh space
+
+		std::vector<uint32_t> verts;
+
+		// per vertex in separate arrays padded to whole SIMD lanes, padding has a weight of 0
+		std::vector<float> weights;
+		std::vector<float> start_xs;
+		std::vector<float> start_ys;
+		std::vector<float> start_zs;
+
+		std::vector<uint32_t> polys;  // polys around the vertices, each one once
+	};
+
+	// the brushes that run as SIMD kernels over the vertices of a dab, see BrushKernels.hpp
+	enum class BrushKernelType {
+		INFLATE,
+		PINCH,
+		CREASE,
+		FLATTEN,
+		CLAY
+	};
+
+	// vertices of the dab gathered for the brush kernels,
+	// in separate arrays padded to whole SIMD lanes, padding has a weight of 0
+	struct BrushBatch {
+		std::vector<float> xs;
+		std::vector<float> ys;
+		std::vector<float> zs;
+		std::vector<float> normal_xs;
+		std::vector<float> normal_ys;
+		std::vector<float> normal_zs;
+		std::vector<float> weights;
+	};
+
+	// scratch of the brushes, kept between dabs so that a stroke does not allocate
+	struct BrushScratch {
+		QueryContext query;
+
+		// vertices under the current dab with their squared distance to the center and falloff weight
+		std::vector<uint32_t> verts;
+		std::vector<float> dist_sqrs;
+		std::vector<float> weights;
+		std::vector<uint32_t> slots;  // where each vertex of the dab is in merged_verts
+
+		std::vector<uint32_t> polys;  // polys around the vertices, each one once
+		std::vector<glm::vec3> poly_area_normals;  // indexed the same as polys of the mesh, set for the polys of the dab
+
+		BrushBatch batch;
+
+		// the dabs of a frame add up their displacements here and the mesh is updated once for all of them
+		std::vector<uint32_t> merged_verts;
+		std::vector<glm::vec3> merged_displacements;
+		std::vector<uint32_t> vert_slots;  // indexed the same as verts, 0xFFFF'FFFF for vertices not merged
+
+		// smoothing writes the new positions here so that every vertex reads the positions of the previous step
+		std::vector<glm::vec3> smoothed;  // indexed the same as the vertices of the dab
+		std::vector<glm::vec3> relaxed;  // indexed the same as vert_positions
+	};
+
+
+	// old index -> new index for each primitive type after compaction,
+	// deleted primitives map to 0xFFFF'FFFF
+	struct CompactionRemaps {
+		std::vector<uint32_t> verts;
+		std::vector<uint32_t> edges;
+		std::vector<uint32_t> polys;
 	};
 
 
@@ -207,6 +449,12 @@ namespace scme {
 		// AABBs
 		uint32_t root_aabb_idx;
 		std::vector<VertexBoundingBox> aabbs;
+		std::vector<uint32_t> aabb_vert_indexes;  // vertex ranges of the leaf AABBs
+		uint32_t unused_aabb_vert_count = 0;  // slots of aabb_vert_indexes that no leaf owns anymore
+		std::vector<uint32_t> _refit_aabbs;  // leafs that lost vertices since the last refit, each one once
+		std::vector<uint32_t> _refit_marks;  // equal to _refit_epoch for the AABBs in _refit_aabbs
+		uint32_t _refit_epoch = 1;
+		std::vector<uint32_t> _free_aabb_blocks;  // first index of 8 consecutive free AABBs
 		std::vector<GPU_MeshVertex> aabb_verts;
 		dx11::ArrayBuffer<GPU_MeshVertex> gpu_aabb_verts;
 
@@ -216,7 +464,11 @@ namespace scme {
 
 		// Vertex
 		SparseVector<Vertex> verts;
+		std::vector<glm::vec3> vert_positions;  // indexed the same as verts
+		std::vector<glm::vec3> vert_normals;
 		std::vector<ModifiedVertex> modified_verts;
+		std::vector<uint32_t> _modified_vert_marks;  // equal to _modified_vert_epoch for vertices already kept
+		uint32_t _modified_vert_epoch = 0;
 		dx11::ArrayBuffer<GPU_MeshVertex> gpu_verts;
 
 		// Edge
@@ -224,14 +476,35 @@ namespace scme {
 
 		// Poly
 		SparseVector<Poly> polys;
+		std::vector<PolyNormals> poly_normals;  // indexed the same as polys
 		std::vector<ModifiedPoly> modified_polys;
 		dx11::ArrayBuffer<uint32_t> gpu_indexes;
 		dx11::ArrayBuffer<GPU_MeshTriangle> gpu_triangles;
 
+		// Adjacency
+		VertexAdjacency adjacency;  // built on demand, dropped when topology changes
+
+		// Poly BVH
+		PolyBVH poly_bvh;  // built on demand by raycasts, dropped when polys are added or removed
+
+		// Brushes
+		BrushScratch brush_scratch;
+
 		// Settings
 		uint32_t max_vertices_in_AABB;
 
 	public:
+		// allocates memory for vertices and their position and normal columns
+		void _resizeVertexMemory(uint32_t vertex_count);
+
+		// allocates memory for edges/polys and their attribute columns
+		void _resizeEdgeMemory(uint32_t edge_count);
+		void _resizePolyMemory(uint32_t poly_count);
+
+		// creates a new blank edge/poly, growing the attribute columns if needed
+		uint32_t _createEdgeMemory();
+		uint32_t _createPolyMemory();
+
 		// mark vertex as deleted in both CPU and GPU memory
 		void _deleteVertexMemory(uint32_t vertex);
 
@@ -241,6 +514,11 @@ namespace scme {
 		// mark poly as deleted in both CPU and GPU memory
 		void _deletePolyMemory(uint32_t poly);
 
+		// removes the deleted slots left behind in vertex, edge and poly memory,
+		// all references are rewritten to the new indexes and the whole mesh is scheduled for GPU upload
+		// invalidates all indexes and pointers to primitives
+		void compact(CompactionRemaps* r_remaps = nullptr);
+
 		void printEdgeListOfVertex(uint32_t vertex_idx);
 
 	public:
@@ -248,12 +526,42 @@ namespace scme {
 
 		// Axis Aligned Bounding Box ////////////////////////////////
 
+		// removes the vertex from its leaf by moving the last vertex of the leaf in its place
+		void _removeVertexFromAABB(uint32_t vertex);
+
+		// moves the vertex range of a leaf to the end of aabb_vert_indexes with more room
+		void _growAABB_VertexRange(uint32_t aabb);
+
+		// empties _refit_aabbs and starts a new epoch of _refit_marks
+		void _clearRefitAABBs();
+
+		// returns the first of 8 consecutive AABBs, reusing freed ones when possible
+		uint32_t _allocAABB_Block();
+
+		// marks the AABBs as free, they are reused only if they are 8 consecutive AABBs
+		void _freeAABBs(std::array<uint32_t, 8>& aabb_idxs);
+
+		// turns a leaf into 8 child leafs and distributes its vertices between them
+		void _subdivideAABB(uint32_t aabb);
+
+		// turns a AABB with only leaf children holding few vertices into a leaf,
+		// returns false if the children can't be merged
+		bool _mergeAABB_Children(uint32_t aabb);
+
+		// moves all leaf ranges to the front of aabb_vert_indexes without unused slots in between
+		void _compactAABB_VertexRanges();
+
 		void _transferVertexToAABB(uint32_t vertex, uint32_t destination_aabb);
 
 		void _recreateAABBs();
 
 		void moveVertexInAABBs(uint32_t vertex);
 
+		// incremental maintenance after vertices have been moved, merges the leafs that got emptied,
+		// drops root levels that only hold one child and reclaims unused slots of aabb_vert_indexes,
+		// the work is proportional to the vertices moved since the last refit
+		void refitAABBs();
+
 		void recreateAABBs(uint32_t max_vertices_in_AABB = 0);
 
 
@@ -299,9 +607,9 @@ namespace scme {
 
 		// calculate a normal based on the winding order of the vertices
 		// only called when updating poly gpu data
-		glm::vec3 calcWindingNormal(Vertex* v0, Vertex* v1, Vertex* v2);
+		glm::vec3 calcWindingNormal(glm::vec3& v0, glm::vec3& v1, glm::vec3& v2);
 
-		void calcPolyNormal(Poly* poly);
+		void calcPolyNormal(uint32_t poly_idx);
 
 		
 
@@ -324,29 +632,110 @@ namespace scme {
 
 		void deletePoly(uint32_t poly);
 
-		void getTrisPrimitives(Poly* poly, std::array<uint32_t, 3>& r_vertex_indexes, std::array<Vertex*, 3>& r_vertices);
+		// positions are copied out of vert_positions, pointers into it do not survive the vertex columns growing
 		void getTrisPrimitives(Poly* poly, std::array<uint32_t, 3>& r_vertex_indexes);
-		void getTrisPrimitives(Poly* poly, std::array<Vertex*, 3>& r_vertices);
+		void getTrisPrimitives(Poly* poly, std::array<glm::vec3, 3>& r_positions);
 
-		void getQuadPrimitives(Poly* poly, std::array<uint32_t, 4>& r_vertex_indexes, std::array<Vertex*, 4>& r_vertices);
 		void getQuadPrimitives(Poly* poly, std::array<uint32_t, 4>& r_vertex_indexes);
-		void getQuadPrimitives(Poly* poly, std::array<Vertex*, 4>& r_vertices);
+		void getQuadPrimitives(Poly* poly, std::array<glm::vec3, 4>& r_positions);
+
+
+		// Adjacency ////////////////////////////////////////////////
+
+		// builds the vertex -> polys and vertex -> vertices adjacency in parallel if not already built
+		void buildAdjacency();
+
+		// called by anything that changes how primitives are connected
+		void invalidateAdjacency();
+
+		// calls func(uint32_t poly) for the polys around the vertex using the adjacency if built,
+		// otherwise walks the edge list of the vertex where a poly will be reported twice
+		template<typename Func>
+		void forEachVertexPoly(uint32_t vertex, Func func);
+
+		// calls func(uint32_t vertex) for every vertex connected to the vertex by an edge
+		template<typename Func>
+		void forEachVertexNeighbour(uint32_t vertex, Func func);
 
 
 		// Queries ////////////////////////////////////////////
 
 		bool raycastPoly(glm::vec3& ray_origin, glm::vec3& ray_direction, uint32_t poly, glm::vec3& r_point);
 
-		// TODO: mark vertices that are processed to avoid duplicate runs and increse performance
+		// finds the closest poly hit by the ray using the poly BVH which must already be built,
+		// many threads can raycast the same mesh at once each with its own context
+		bool raycastPolys(QueryContext& context, const glm::vec3& ray_origin, const glm::vec3& ray_direction,
+			uint32_t& r_isect_poly, glm::vec3& r_isect_position) const;
+
+		// raycasts all the rays in parallel in packets of rays with similar origin and direction,
+		// the poly BVH must already be built
+		void raycastBatch(const std::vector<Ray>& rays, std::vector<RayHit>& r_hits) const;
+
+		// finds the point of the surface closest to the position that is not farther than max_distance,
+		// visits the BVH nodes closest first, the poly BVH must already be built
+		bool closestPoint(QueryContext& context, const glm::vec3& position, float max_distance,
+			ClosestPoint& r_closest) const;
+
+		// closest points of all the positions in parallel
+		void closestPointBatch(const std::vector<glm::vec3>& positions, float max_distance,
+			std::vector<ClosestPoint>& r_closest) const;
+
+		// finds the vertices within radius of the center and their squared distance to it,
+		// the vertices of octree nodes fully inside the sphere are taken without testing each one
+		void sphereQuery(QueryContext& context, const glm::vec3& center, float radius,
+			std::vector<uint32_t>& r_verts, std::vector<float>& r_dist_sqrs) const;
+
+		// finds the vertices within radius of the segment from start to end and their squared distance to it
+		void capsuleQuery(QueryContext& context, const glm::vec3& start, const glm::vec3& end, float radius,
+			std::vector<uint32_t>& r_verts, std::vector<float>& r_dist_sqrs) const;
+
+		// Selection
+		// results are bitsets with 1 bit per index of verts, polys or edges,
+		// the screen shapes are in normalized device coordinates of local_to_clip
+
+		// selects the vertices inside the frustum of a screen rectangle, depth is optional
+		void selectVertsInRect(QueryContext& context, const glm::mat4& local_to_clip,
+			const glm::vec2& ndc_min, const glm::vec2& ndc_max, const SelectionDepth* depth,
+			std::vector<uint64_t>& r_selected) const;
+
+		// selects the vertices inside a box in mesh space
+		void selectVertsInBox(QueryContext& context, const AxisBoundingBox3D<>& box,
+			std::vector<uint64_t>& r_selected) const;
+
+		// selects the vertices inside a screen polygon, it may cross itself and then uses the even-odd rule
+		void selectVertsInLasso(QueryContext& context, const glm::mat4& local_to_clip,
+			const std::vector<glm::vec2>& lasso, const SelectionDepth* depth,
+			std::vector<uint64_t>& r_selected) const;
+
+		// a poly or an edge is selected when all of its vertices are
+		void selectPolysFromVerts(const std::vector<uint64_t>& selected_verts, std::vector<uint64_t>& r_selected_polys) const;
+		void selectEdgesFromVerts(const std::vector<uint64_t>& selected_verts, std::vector<uint64_t>& r_selected_edges) const;
+
+		// builds the poly BVH if needed then raycasts with a context of its own
 		bool raycastPolys(glm::vec3& ray_origin, glm::vec3& ray_direction,
 			uint32_t& r_isect_poly, glm::vec3& r_isect_position);
-		std::vector<VertexBoundingBox*> _now_aabbs;
-		std::vector<VertexBoundingBox*> _next_aabbs;
-		std::vector<VertexBoundingBox*> _traced_aabbs;
-		std::vector<uint32_t> _tested_edges;
+
+		// builds the poly BVH with the surface area heuristic if not already built
+		// or refits it if vertices moved since, must be called before querying from multiple threads
+		void buildPolyBVH();
+
+		// called by anything that adds or removes polys
+		void invalidatePolyBVH();
+
+		// updates the bounds of the BVH nodes above the polys of the modified vertices
+		void refitPolyBVH();
 
 
 		// Creation //////////////////////////////////////////////////////////
+
+		// creates all the edges and polys at once from 4 vertex indexes per poly in parallel,
+		// the vertices must already exist, triangles have the 4th index set to 0xFFFF'FFFF
+		void _buildTopology(std::vector<uint32_t>& poly_corners);
+
+		// creates the vertices, edges and polys of a rows x cols tube directly by index arithmetic,
+		// the caller fills the positions
+		void _createTubeTopology(uint32_t rows, uint32_t cols, bool capped);
+
 		void createAsTriangle(float size, uint32_t max_vertices_in_AABB);
 		void createAsQuad(float size, uint32_t max_vertices_in_AABB);
 		void createAsWavyGrid(float size, uint32_t max_vertices_in_AABB);
@@ -361,23 +750,75 @@ namespace scme {
 
 		void createFromLists(std::vector<uint32_t>& indexes, std::vector<glm::vec3>& positions,
 			std::vector<glm::vec3>& normals, uint32_t max_vertices_AABB);
+
+		// 3 indexes per triangle and 4 indexes per quad
+		void createFromLists(std::vector<uint32_t>& tris_indexes, std::vector<uint32_t>& quad_indexes,
+			std::vector<glm::vec3>& positions, std::vector<glm::vec3>& normals, uint32_t max_vertices_AABB);
+
+		// merges the vertices of triangle lists closer than distance before calling createFromLists,
+		// merged vertices have averaged normals and collapsed triangles are removed
+		static void weldByDistance(float distance, std::vector<uint32_t>& r_indexes,
+			std::vector<glm::vec3>& r_positions, std::vector<glm::vec3>& r_normals);
+
+		// merges the vertices closer than distance and rebuilds the topology,
+		// invalidates all indexes and pointers to primitives
+		void mergeByDistance(float distance);
 	
 		
 		// Sculpt /////////////////////////////////////////////////////////////
 
+		// pushes the vertices in the sphere of the dab along the area normal under the brush
 		void standardBrush(StandardBrushInfo& info);
 
+		// applies the dabs for the cursor samples of a frame as one update of the mesh,
+		// the cursor rays are in mesh space
+		void standardBrushStroke(BrushStroke& stroke, StandardBrushInfo& info, const std::vector<Ray>& cursor_rays);
+
+		// moves the vertices in the sphere of the dab with the kernel of the brush type
+		void kernelBrush(BrushKernelType type, StandardBrushInfo& info);
+
+		void kernelBrushStroke(BrushKernelType type, BrushStroke& stroke, StandardBrushInfo& info,
+			const std::vector<Ray>& cursor_rays);
+
+		// smooths the vertices in the sphere of the dab, strength scales the smoothing factors
+		void smoothBrush(StandardBrushInfo& info, const SmoothSettings& settings);
+
+		void smoothBrushStroke(BrushStroke& stroke, StandardBrushInfo& info, const SmoothSettings& settings,
+			const std::vector<Ray>& cursor_rays);
+
+		// smooths all the vertices of the mesh
+		void relax(const SmoothSettings& settings);
+
+		// captures the vertices in the sphere of the dab with their falloff weights
+		void beginGrab(GrabBrush& grab, const StandardBrushInfo& info);
+
+		// moves the grabbed vertices so that the grabbed point follows grab_pos, scaled by their weights
+		void grabBrush(GrabBrush& grab, const glm::vec3& grab_pos);
+
+		// resamples the cursor path by the stroke spacing and finds where each dab lands on the surface,
+		// each dab is raycast on its own so fast strokes follow the surface instead of cutting through it,
+		// the poly BVH must already be built
+		void sampleStroke(BrushStroke& stroke, float diameter, const std::vector<Ray>& cursor_rays,
+			std::vector<glm::vec3>& r_dab_centers) const;
+
 
 		// GPU Updates
 
 		// schedule a vertex to have it's data updated on the GPU side
 		void markVertexFullUpdate(uint32_t vertex);
+		void markVerticesFullUpdate(const std::vector<uint32_t>& vertices);
+		void markAllVerticesFullUpdate();
 
 		// schedule a poly to have it's data updated on the GPU side
 		void markPolyFullUpdate(uint32_t poly);
+		void markPolysFullUpdate(const std::vector<uint32_t>& polys_to_update);
+		void markAllPolysFullUpdate();
 
 		void markAllVerticesForNormalUpdate();
 
+		// keeps only the first update of a vertex marked more than once, deletions are kept in order
+		void _dedupeModifiedVerts();
+
 		// upload vertex additions and removals to GPU
 		void uploadVertexAddsRemoves();
 		bool dirty_vertex_list;
@@ -410,4 +851,95 @@ namespace scme {
 
 		void validateCPU_GPU_Mirroring();
 	};
+
+
+	inline bool QueryContext::visitVertex(uint32_t vertex_idx)
+	{
+		if (vert_marks[vertex_idx] == epoch) {
+			return false;
+		}
+
+		vert_marks[vertex_idx] = epoch;
+		return true;
+	}
+
+	inline bool QueryContext::visitPoly(uint32_t poly_idx)
+	{
+		if (poly_marks[poly_idx] == epoch) {
+			return false;
+		}
+
+		poly_marks[poly_idx] = epoch;
+		return true;
+	}
+
+	template<typename Func>
+	void SculptMesh::forEachVertexPoly(uint32_t vertex_idx, Func func)
+	{
+		if (adjacency.is_valid) {
+
+			uint32_t end = adjacency.poly_offsets[vertex_idx + 1];
+
+			for (uint32_t i = adjacency.poly_offsets[vertex_idx]; i < end; i++) {
+				func(adjacency.polys[i]);
+			}
+			return;
+		}
+
+		Vertex& vertex = verts[vertex_idx];
+
+		if (vertex.edge == 0xFFFF'FFFF) {
+			return;
+		}
+
+		uint32_t edge_idx = vertex.edge;
+		Edge* edge = &edges[edge_idx];
+
+		do {
+			if (edge->p0 != 0xFFFF'FFFF) {
+				func(edge->p0);
+			}
+
+			if (edge->p1 != 0xFFFF'FFFF) {
+				func(edge->p1);
+			}
+
+			// Iter
+			edge_idx = edge->nextEdgeOf(vertex_idx);
+			edge = &edges[edge_idx];
+		}
+		while (edge_idx != vertex.edge);
+	}
+
+	template<typename Func>
+	void SculptMesh::forEachVertexNeighbour(uint32_t vertex_idx, Func func)
+	{
+		if (adjacency.is_valid) {
+
+			uint32_t end = adjacency.vert_offsets[vertex_idx + 1];
+
+			for (uint32_t i = adjacency.vert_offsets[vertex_idx]; i < end; i++) {
+				func(adjacency.verts[i]);
+			}
+			return;
+		}
+
+		Vertex& vertex = verts[vertex_idx];
+
+		if (vertex.edge == 0xFFFF'FFFF) {
+			return;
+		}
+
+		uint32_t edge_idx = vertex.edge;
+		Edge* edge = &edges[edge_idx];
+
+		do {
+			func(edge->v0 == vertex_idx ? edge->v1 : edge->v0);
+
+			// Iter
+			edge_idx = edge->nextEdgeOf(vertex_idx);
+			edge = &edges[edge_idx];
+		}
+		while (edge_idx != vertex.edge);
+	}
 }
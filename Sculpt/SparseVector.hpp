@@ -1,5 +1,12 @@
 #pragma once
 
+// Standard
+#include <vector>
+#include <type_traits>
+#include <cstring>
+#include <intrin.h>
+#include <ppl.h>
+
 
 // Forward declarations
 template<typename T>
@@ -138,12 +145,22 @@ class SparseVector;
 //};
 
 
+// elements that can be copied as bytes store the free list link inside the deleted element itself
+// so that the node is the same size as the element
 template<typename T>
+constexpr bool is_intrusive_node = std::is_trivially_copyable_v<T> && sizeof(T) >= sizeof(uint32_t);
+
+template<typename T, bool intrusive = is_intrusive_node<T>>
 struct DeferredVectorNode {
-	bool is_deleted;
+	uint32_t next_deleted;  // next free slot, only meaningful while the node is deleted
 	T elem;
 };
 
+template<typename T>
+struct DeferredVectorNode<T, true> {
+	T elem;  // holds the next free slot while the node is deleted
+};
+
 
 template<typename T>
 class DeferredVectorIterator {
@@ -161,7 +178,7 @@ public:
 
 	T& get()
 	{
-		return _parent_vector->nodes[_current_idx].elem;
+		return _parent_vector->_node(_current_idx).elem;
 	}
 
 	inline uint32_t index()
@@ -171,41 +188,12 @@ public:
 
 	void next()
 	{
-		auto& nodes = _parent_vector->nodes;
-
-		_current_idx++;
-
-		while (true) {
-			if (_current_idx > _parent_vector->_last_index) {
-				return;  // reached the end
-			}
-
-			if (nodes[_current_idx].is_deleted == false) {
-				return;  // element found
-			}
-
-			_current_idx++;
-		}
+		_current_idx = _parent_vector->_nextAlive(_current_idx + 1);
 	}
 
-	// WARNING: not fully reversible
 	void prev()
 	{
-		auto& nodes = _parent_vector->nodes;
-
-		_current_idx--;
-
-		while (true) {
-			if (_current_idx > _parent_vector->_first_index) {
-				return;  // reached the begin
-			}
-
-			if (nodes[_current_idx].is_deleted == false) {
-				return;  // element found
-			}
-
-			_current_idx++;
-		}
+		_current_idx = _parent_vector->_prevAlive(_current_idx);
 	}
 };
 
@@ -213,17 +201,40 @@ public:
 // made specifically for holding primitive data
 // deletions are cheap as they don't have to reallocate the whole vector
 // preserves indexes but traversals can skip mai not be required to be in order
+//
+// deleted slots are chained into a free list stored inside the nodes themselves so recycling is O(1),
+// which elements are alive is kept in a bitmap so iteration can skip 64 deleted elements at a time
+//
+// nodes are stored in fixed size chunks that never get reallocated, so growing never copies existing
+// elements and pointers to elements remain valid until the element is erased or the vector cleared
 template<typename T>
 class SparseVector {
 public:
+	// chunks are about 256KB, but never smaller than one bitmap word
+	static constexpr uint32_t _calcChunkShift()
+	{
+		uint32_t shift = 6;
+		while ((sizeof(DeferredVectorNode<T>) << (shift + 1)) <= 256 * 1024) {
+			shift++;
+		}
+		return shift;
+	}
+	static constexpr uint32_t _chunk_shift = _calcChunkShift();
+	static constexpr uint32_t _chunk_size = 1 << _chunk_shift;
+	static constexpr uint32_t _chunk_mask = _chunk_size - 1;
+
+
 	uint32_t _size;  // current used size without deleted elements
 
 	// first element in vector may be deleted so keep track so you don't have to skip on each begin
 	uint32_t _first_index;
 	uint32_t _last_index;
 
-	std::vector<DeferredVectorNode<T>> nodes;
-	std::vector<uint32_t> deleted;
+	uint32_t _count;  // number of nodes in use (deleted or not)
+	std::vector<std::vector<DeferredVectorNode<T>>> _chunks;
+
+	uint32_t _first_deleted;  // head of the free list, 0xFFFF'FFFF if nothing to recycle
+	std::vector<uint64_t> _alive_bits;  // bit set means element at that index is not deleted
 
 public:
 	SparseVector()
@@ -231,151 +242,481 @@ public:
 		_size = 0;
 		_first_index = 0;
 		_last_index = 0;
+		_count = 0;
+		_first_deleted = 0xFFFF'FFFF;
+	}
 
-		//elems();
-		//deleted();
+	SparseVector(const SparseVector& other)
+	{
+		*this = other;
 	}
 
+	SparseVector(SparseVector&& other) = default;
+
+	SparseVector& operator=(const SparseVector& other)
+	{
+		_size = other._size;
+		_first_index = other._first_index;
+		_last_index = other._last_index;
+		_count = other._count;
+		_chunks = other._chunks;
+		_first_deleted = other._first_deleted;
+		_alive_bits = other._alive_bits;
+
+		// the copy only allocates what is used, reserve the full chunk so that it does not move later
+		for (auto& chunk : _chunks) {
+			chunk.reserve(_chunk_size);
+		}
+
+		return *this;
+	}
+
+	SparseVector& operator=(SparseVector&& other) = default;
+
+	inline DeferredVectorNode<T>& _node(uint32_t idx)
+	{
+		return _chunks[idx >> _chunk_shift][idx & _chunk_mask];
+	}
+
+	inline const DeferredVectorNode<T>& _node(uint32_t idx) const
+	{
+		return _chunks[idx >> _chunk_shift][idx & _chunk_mask];
+	}
+
+	inline uint32_t _getNextDeleted(uint32_t idx)
+	{
+		if constexpr (is_intrusive_node<T>) {
+			uint32_t next_deleted;
+			std::memcpy(&next_deleted, static_cast<void*>(&_node(idx).elem), sizeof(uint32_t));
+			return next_deleted;
+		}
+		else {
+			return _node(idx).next_deleted;
+		}
+	}
+
+	inline void _setNextDeleted(uint32_t idx, uint32_t next_deleted)
+	{
+		if constexpr (is_intrusive_node<T>) {
+			std::memcpy(static_cast<void*>(&_node(idx).elem), &next_deleted, sizeof(uint32_t));
+		}
+		else {
+			_node(idx).next_deleted = next_deleted;
+		}
+	}
+
+	// Bitmap /////////////////////////////////////////////////////
+
+	inline void _setAlive(uint32_t idx)
+	{
+		_alive_bits[idx >> 6] |= 1ULL << (idx & 63);
+	}
+
+	inline void _setDeleted(uint32_t idx)
+	{
+		_alive_bits[idx >> 6] &= ~(1ULL << (idx & 63));
+	}
+
+	// returns the index of the first alive element starting with (and including) idx,
+	// or end index if there are no more
+	uint32_t _nextAlive(uint32_t idx)
+	{
+		uint32_t end_idx = _last_index + 1;
+
+		if (idx >= end_idx) {
+			return end_idx;
+		}
+
+		uint32_t word_idx = idx >> 6;
+		uint64_t word = _alive_bits[word_idx] & (~0ULL << (idx & 63));
+
+		while (word == 0) {
+			word_idx++;
+
+			// last index is alive so the scan always stops before running off the bitmap
+			word = _alive_bits[word_idx];
+		}
+
+		unsigned long bit;
+		_BitScanForward64(&bit, word);
+
+		return (word_idx << 6) + bit;
+	}
+
+	// returns the index of the first alive element before idx,
+	// or first index if there are no more
+	uint32_t _prevAlive(uint32_t idx)
+	{
+		if (idx <= _first_index) {
+			return _first_index;
+		}
+
+		idx--;
+
+		uint32_t word_idx = idx >> 6;
+		uint64_t word = _alive_bits[word_idx] & (~0ULL >> (63 - (idx & 63)));
+
+		while (word == 0) {
+			word_idx--;
+			word = _alive_bits[word_idx];
+		}
+
+		unsigned long bit;
+		_BitScanReverse64(&bit, word);
+
+		return (word_idx << 6) + bit;
+	}
+
+	// Memory /////////////////////////////////////////////////////
+
+	// all the elements up to the new size are considered as alive
 	void resize(uint32_t new_size)
 	{
-		nodes.resize(new_size);
+		_chunks.resize((new_size + _chunk_mask) >> _chunk_shift);
+
+		for (uint32_t i = 0; i < _chunks.size(); i++) {
+
+			auto& chunk = _chunks[i];
+			chunk.reserve(_chunk_size);
+
+			uint32_t chunk_begin = i << _chunk_shift;
+			uint32_t chunk_count = new_size - chunk_begin;
+			chunk.resize(chunk_count < _chunk_size ? chunk_count : _chunk_size);
+		}
+
+		_count = new_size;
+
+		_alive_bits.assign((new_size + 63) / 64, ~0ULL);
+
+		// clear bits past the end
+		if (new_size & 63) {
+			_alive_bits.back() = (1ULL << (new_size & 63)) - 1;
+		}
 
 		_size = new_size;
-		_last_index = new_size - 1;
+		_first_index = 0;
+		_last_index = new_size ? new_size - 1 : 0;
+		_first_deleted = 0xFFFF'FFFF;
 	}
 
+	// chunks are allocated as needed, only the bookkeeping is reserved up front
 	void reserve(uint32_t new_capacity)
 	{
-		nodes.reserve(new_capacity);
+		_chunks.reserve((new_capacity + _chunk_mask) >> _chunk_shift);
+		_alive_bits.reserve((new_capacity + 63) / 64);
 	}
 
 	T& emplace(uint32_t& r_index)
 	{
-		// try reuse deleted
-		for (uint32_t& deleted_idx : deleted) {
+		uint32_t idx;
 
-			if (deleted_idx != 0xFFFF'FFFF) {
+		// reuse deleted
+		if (_first_deleted != 0xFFFF'FFFF) {
 
-				// mark node as available
-				DeferredVectorNode<T>& recycled_node = nodes[deleted_idx];
-				recycled_node.is_deleted = false;
+			idx = _first_deleted;
+			_first_deleted = _getNextDeleted(idx);
+		}
+		// create new node
+		else {
+			idx = _count;
+			_count++;
 
-				// bounds update
-				if (deleted_idx < _first_index) {
-					_first_index = deleted_idx;
-				}
-				else if (deleted_idx > _last_index) {
-					_last_index = deleted_idx;
-				}
+			if ((idx & _chunk_mask) == 0) {
+				_chunks.emplace_back().reserve(_chunk_size);
+			}
+			_chunks.back().emplace_back();
 
-				// remove from deleted list
-				deleted_idx = 0xFFFF'FFFF;
+			if ((idx & 63) == 0) {
+				_alive_bits.push_back(0);
+			}
+		}
 
-				_size++;
+		_setAlive(idx);
 
-				return recycled_node.elem;
-			}
+		// bounds update
+		if (_size == 0) {
+			_first_index = idx;
+			_last_index = idx;
+		}
+		else if (idx < _first_index) {
+			_first_index = idx;
+		}
+		else if (idx > _last_index) {
+			_last_index = idx;
 		}
 
-		// Create new node
-		_last_index = _size;
 		_size++;
 
-		r_index = nodes.size();
-
-		DeferredVectorNode<T>& new_node = nodes.emplace_back();
-		return new_node.elem;
+		r_index = idx;
+		return _node(idx).elem;
 	}
 
 	void erase(uint32_t index)
 	{
-		DeferredVectorNode<T>& node = nodes[index];
-		if (node.is_deleted == false) {
+		if (isDeleted(index)) {
+			return;
+		}
+
+		_setDeleted(index);
+		_size--;
+
+		// add to free list
+		_setNextDeleted(index, _first_deleted);
+		_first_deleted = index;
+
+		if (_size == 0) {
+			_first_index = 0;
+			_last_index = 0;
+		}
+		// seek forward new first index
+		else if (index == _first_index) {
+			_first_index = _nextAlive(index + 1);
+		}
+		// seek backward new last index
+		else if (index == _last_index) {
+			_last_index = _prevAlive(index);
+		}
+	}
+
+	// Compaction /////////////////////////////////////////////////
+
+	// builds a table of old index -> new index as if there where no deleted elements,
+	// deleted elements map to 0xFFFF'FFFF
+	void buildCompactionRemap(std::vector<uint32_t>& r_remap)
+	{
+		uint32_t word_count = _alive_bits.size();
+
+		// where each bitmap word starts in the compacted vector
+		std::vector<uint32_t> word_offsets(word_count);
+		{
+			uint32_t offset = 0;
+			for (uint32_t i = 0; i < word_count; i++) {
+				word_offsets[i] = offset;
+				offset += (uint32_t)__popcnt64(_alive_bits[i]);
+			}
+		}
+
+		r_remap.resize(_count);
 
-			node.is_deleted = true;
+		concurrency::parallel_for(0u, word_count, [&](uint32_t word_idx) {
 
-			if (nodes.size() > 1) {
+			uint64_t word = _alive_bits[word_idx];
+			uint32_t new_idx = word_offsets[word_idx];
 
-				// seek forward new first index
-				if (index == _first_index) {
+			uint32_t begin = word_idx << 6;
+			uint32_t end = begin + 64 < _count ? begin + 64 : _count;
 
-					uint32_t i = index + 1;
+			for (uint32_t i = begin; i < end; i++) {
 
-					while (true) {
-						if (i == _last_index || nodes[i].is_deleted == false) {
-							_first_index = i;
-							break;
-						}
-						i++;
-					}
+				if (word & (1ULL << (i & 63))) {
+					r_remap[i] = new_idx;
+					new_idx++;
 				}
-				// seek backward new last index
-				else if (index == _last_index && index > 1) {
-
-					uint32_t i = index - 1;
-
-					while (true) {
-						if (i == _first_index || nodes[i].is_deleted == false) {
-							_last_index = i;
-							break;
-						}
-						i--;
-					}
+				else {
+					r_remap[i] = 0xFFFF'FFFF;
 				}
-			}	
+			}
+		});
+	}
 
-			_size--;
+	// moves all elements to the indexes given by the remap table, leaving no deleted elements behind
+	// fixup is called on every moved element to rewrite the indexes it may hold
+	template<typename Fixup>
+	void compact(std::vector<uint32_t>& remap, Fixup fixup)
+	{
+		SparseVector<T> packed;
+		packed.resize(_size);
 
-			// add to delete list
-			for (uint32_t& deleted_idx : deleted) {
-				if (deleted_idx == 0xFFFF'FFFF) {
-					deleted_idx = index;
-					return;
-				}
+		concurrency::parallel_for(0u, (uint32_t)_alive_bits.size(), [&](uint32_t word_idx) {
+
+			uint64_t word = _alive_bits[word_idx];
+
+			while (word) {
+				unsigned long bit;
+				_BitScanForward64(&bit, word);
+				word &= word - 1;
+
+				uint32_t idx = (word_idx << 6) + bit;
+
+				T& elem = packed._node(remap[idx]).elem;
+				elem = std::move(_node(idx).elem);
+				fixup(elem);
+			}
+		});
+
+		*this = std::move(packed);
+	}
+
+	// Parallel ///////////////////////////////////////////////////
+
+	// bitmap words handed to a worker at a time, small enough for the scheduler to balance
+	// the load when the deleted elements are clustered
+	static constexpr uint32_t _words_per_range = 16;
+
+	uint32_t _rangeCount()
+	{
+		if (_size == 0) {
+			return 0;
+		}
+
+		uint32_t word_count = (_last_index >> 6) - (_first_index >> 6) + 1;
+		return (word_count + _words_per_range - 1) / _words_per_range;
+	}
+
+	// calls func(range_idx, begin_word, end_word) from multiple threads, the ranges cover all alive elements
+	template<typename Func>
+	void _parallelForEachRange(Func& func)
+	{
+		uint32_t first_word = _first_index >> 6;
+		uint32_t end_word = (_last_index >> 6) + 1;
+
+		concurrency::parallel_for(0u, _rangeCount(), [&](uint32_t range_idx) {
+
+			uint32_t begin = first_word + range_idx * _words_per_range;
+			uint32_t end = begin + _words_per_range < end_word ? begin + _words_per_range : end_word;
+
+			func(range_idx, begin, end);
+		});
+	}
+
+	template<typename Func>
+	void _forEachInWords(uint32_t begin_word, uint32_t end_word, Func& func)
+	{
+		for (uint32_t word_idx = begin_word; word_idx < end_word; word_idx++) {
+
+			uint64_t word = _alive_bits[word_idx];
+
+			while (word) {
+				unsigned long bit;
+				_BitScanForward64(&bit, word);
+				word &= word - 1;
+
+				uint32_t idx = (word_idx << 6) + bit;
+				func(_node(idx).elem, idx);
 			}
+		}
+	}
+
+	// calls func(T& elem, uint32_t index) for every alive element from multiple threads,
+	// func must not add or remove elements
+	template<typename Func>
+	void parallelForEach(Func func)
+	{
+		auto range_func = [&](uint32_t, uint32_t begin_word, uint32_t end_word) {
+			_forEachInWords(begin_word, end_word, func);
+		};
+		_parallelForEachRange(range_func);
+	}
 
-			uint32_t& new_deleted_index = deleted.emplace_back();
-			new_deleted_index = index;
+	// same as parallelForEach but calls func(T& elem, uint32_t index, uint32_t rank)
+	// where rank is the position of the element counting only alive elements, used to fill dense arrays
+	template<typename Func>
+	void parallelForEachRanked(Func func)
+	{
+		std::vector<uint32_t> range_offsets(_rangeCount());
+
+		auto count_func = [&](uint32_t range_idx, uint32_t begin_word, uint32_t end_word) {
+
+			uint32_t count = 0;
+			for (uint32_t word_idx = begin_word; word_idx < end_word; word_idx++) {
+				count += (uint32_t)__popcnt64(_alive_bits[word_idx]);
+			}
+			range_offsets[range_idx] = count;
+		};
+		_parallelForEachRange(count_func);
+
+		uint32_t offset = 0;
+		for (uint32_t& range_offset : range_offsets) {
+			uint32_t count = range_offset;
+			range_offset = offset;
+			offset += count;
 		}
+
+		auto range_func = [&](uint32_t range_idx, uint32_t begin_word, uint32_t end_word) {
+
+			uint32_t rank = range_offsets[range_idx];
+
+			auto ranked_func = [&](T& elem, uint32_t idx) {
+				func(elem, idx, rank);
+				rank++;
+			};
+			_forEachInWords(begin_word, end_word, ranked_func);
+		};
+		_parallelForEachRange(range_func);
+	}
+
+	// folds every alive element into a per thread accumulator using func(R& acc, T& elem, uint32_t index),
+	// the accumulators are then merged in to the result using combine(R& result, const R& acc)
+	template<typename R, typename Func, typename Combine>
+	R parallelReduce(R identity, Func func, Combine combine)
+	{
+		concurrency::combinable<R> accs([&]() { return identity; });
+
+		auto range_func = [&](uint32_t, uint32_t begin_word, uint32_t end_word) {
+
+			R& acc = accs.local();
+
+			auto fold_func = [&](T& elem, uint32_t idx) {
+				func(acc, elem, idx);
+			};
+			_forEachInWords(begin_word, end_word, fold_func);
+		};
+		_parallelForEachRange(range_func);
+
+		R result = identity;
+		accs.combine_each([&](const R& acc) {
+			combine(result, acc);
+		});
+
+		return result;
 	}
 
 	void clear()
 	{
-		nodes.clear();
-		deleted.clear();
+		_chunks.clear();
+		_alive_bits.clear();
 
 		_size = 0;
 		_first_index = 0;
 		_last_index = 0;
+		_count = 0;
+		_first_deleted = 0xFFFF'FFFF;
 	}
 
-	bool isDeleted(uint32_t idx)
+	bool isDeleted(uint32_t idx) const
 	{
-		return nodes[idx].is_deleted;
+		return (_alive_bits[idx >> 6] & (1ULL << (idx & 63))) == 0;
 	}
 
 	T& operator[](uint32_t idx)
 	{	
 		assert_cond(_first_index <= idx && idx <= _last_index, "out of bounds access");
-		assert_cond(nodes[idx].is_deleted == false, "accessed element marked as deleted");
-		return nodes[idx].elem;
+		assert_cond(isDeleted(idx) == false, "accessed element marked as deleted");
+		return _node(idx).elem;
+	}
+
+	const T& operator[](uint32_t idx) const
+	{
+		assert_cond(_first_index <= idx && idx <= _last_index, "out of bounds access");
+		assert_cond(isDeleted(idx) == false, "accessed element marked as deleted");
+		return _node(idx).elem;
 	}
 
 	T& front()
 	{
-		return nodes[_first_index].elem;
+		return _node(_first_index).elem;
 	}
 
 	T& back()
 	{
-		return nodes[_last_index].elem;
+		return _node(_last_index).elem;
 	}
 
 	DeferredVectorIterator<T> begin()
 	{
 		DeferredVectorIterator<T> iter;
 		iter._parent_vector = this;
-		iter._current_idx = _first_index;
+		iter._current_idx = _size ? _first_index : _last_index + 1;
 
 		return iter;
 	}
@@ -383,9 +724,7 @@ public:
 	// skips first N elements
 	DeferredVectorIterator<T> begin(uint32_t skip_count)
 	{
-		DeferredVectorIterator<T> iter;
-		iter._parent_vector = this;
-		iter._current_idx = _first_index;
+		DeferredVectorIterator<T> iter = begin();
 
 		for (uint32_t i = 0; i < skip_count; i++) {
 			iter.next();
@@ -404,23 +743,25 @@ public:
 	}
 
 	// ease of refactoring
-	inline uint32_t size()
+	inline uint32_t size() const
 	{
 		return _size;
 	}
 
-	inline uint32_t firstIndex()
+	inline uint32_t firstIndex() const
 	{
 		return _first_index;
 	}
 
-	inline uint32_t lastIndex()
+	inline uint32_t lastIndex() const
 	{
 		return _last_index;
 	}
 
-	inline uint32_t capacity()
+	// number of index slots handed out so far, deleted or not, every index is below it,
+	// GPU buffers and instance counts are sized from this so it must not include unused chunk space
+	inline uint32_t capacity() const
 	{
-		return nodes.capacity();
+		return _count;
 	}
 };
@@ -0,0 +1,472 @@
+
+// Header
+#include "Tests.hpp"
+
+
+using namespace scme;
+using namespace tests;
+
+
+static bool isFinite(SculptMesh& mesh)
+{
+	for (const glm::vec3& pos : mesh.vert_positions) {
+		if (std::isfinite(pos.x) == false || std::isfinite(pos.y) == false || std::isfinite(pos.z) == false) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// renderer lists that would otherwise grow with every call
+static void clearUpdates(SculptMesh& mesh)
+{
+	mesh.modified_verts.clear();
+	mesh.modified_polys.clear();
+	mesh.refitAABBs();
+	mesh.refitPolyBVH();
+}
+
+// mean and deviation of the distance of the vertices to the origin
+static glm::vec2 radiusStats(SculptMesh& mesh)
+{
+	double sum = 0;
+	double sum_sqr = 0;
+
+	for (auto iter = mesh.verts.begin(); iter != mesh.verts.end(); iter.next()) {
+		float radius = glm::length(mesh.vert_positions[iter.index()]);
+		sum += radius;
+		sum_sqr += radius * radius;
+	}
+
+	double mean = sum / mesh.verts.size();
+	return { (float)mean, (float)std::sqrt(std::max(sum_sqr / mesh.verts.size() - mean * mean, 0.0)) };
+}
+
+void tests::testStrokes()
+{
+	SculptMesh mesh;
+	createTestSphere(mesh, 512);
+
+	std::vector<glm::vec3> start_positions = mesh.vert_positions;
+
+	StandardBrushInfo info = {};
+	info.diameter = 0.15f;
+	info.focus = 0.3f;
+	info.strength = 0.05f;
+
+	// frames of cursor samples across the top of the sphere, applied without a renderer in between
+	BrushStroke stroke;
+	std::vector<Ray> cursor_rays(8);
+	std::vector<glm::vec3> dab_centers;
+	double ms = 0;
+	uint32_t frame_count = 20;
+
+	for (uint32_t frame = 0; frame < frame_count; frame++) {
+
+		for (uint32_t i = 0; i < cursor_rays.size(); i++) {
+
+			float x = -0.5f + (frame * cursor_rays.size() + i) * 0.006f;
+
+			cursor_rays[i].origin = { x, 0.05f, 3.f };
+			cursor_rays[i].direction = { 0, 0, -1 };
+		}
+
+		ms += timeMs([&]() {
+			mesh.standardBrushStroke(stroke, info, cursor_rays);
+		});
+
+		for (uint32_t i = 0; i < stroke.dab_rays.size(); i++) {
+
+			const RayHit& hit = stroke.dab_hits[i];
+
+			if (hit.poly != 0xFFFF'FFFF) {
+				dab_centers.push_back(stroke.dab_rays[i].origin + stroke.dab_rays[i].direction * hit.distance);
+			}
+		}
+	}
+	printf("standardBrushStroke %.2f ms per frame, %zu dabs \n", ms / frame_count, dab_centers.size());
+
+	// the walked distance carries over between frames so the dabs stay evenly spaced across them
+	float dab_spacing = stroke.spacing * info.diameter;
+	bool evenly_spaced = dab_centers.size() > 1;
+
+	for (uint32_t i = 1; i < dab_centers.size(); i++) {
+
+		float dist = glm::distance(dab_centers[i - 1], dab_centers[i]);
+		evenly_spaced &= dist > dab_spacing * 0.8f && dist < dab_spacing * 1.2f;
+	}
+	check(evenly_spaced, "the stroke places dabs at its spacing");
+
+	// only the vertices under a dab moved
+	uint32_t moved_count = 0;
+	bool moved_under_dabs = true;
+
+	for (auto iter = mesh.verts.begin(); iter != mesh.verts.end(); iter.next()) {
+
+		uint32_t vertex_idx = iter.index();
+
+		if (mesh.vert_positions[vertex_idx] == start_positions[vertex_idx]) {
+			continue;
+		}
+
+		moved_count++;
+
+		float min_dist = FLT_MAX;
+		for (glm::vec3& dab_center : dab_centers) {
+			min_dist = std::min(min_dist, glm::distance(start_positions[vertex_idx], dab_center));
+		}
+
+		// dabs later in the stroke see the surface moved by the earlier ones
+		moved_under_dabs &= min_dist <= info.diameter / 2 + info.strength * info.diameter;
+	}
+
+	check(isFinite(mesh) && moved_count > 0 && moved_under_dabs, "strokes move only the vertices under their dabs");
+	check(isOctreeConsistent(mesh, { 0, 0, 1 }, 0.4f), "the octree follows the stroke");
+
+	// the next stroke raycasts the moved surface
+	QueryContext context;
+	mesh.buildPolyBVH();
+
+	std::vector<RayHit> hits;
+	mesh.raycastBatch(cursor_rays, hits);
+
+	bool hits_match = true;
+
+	for (uint32_t i = 0; i < cursor_rays.size(); i++) {
+
+		uint32_t poly;
+		glm::vec3 pos;
+		mesh.raycastPolys(context, cursor_rays[i].origin, cursor_rays[i].direction, poly, pos);
+
+		float brute_distance = FLT_MAX;
+
+		for (auto iter = mesh.polys.begin(); iter != mesh.polys.end(); iter.next()) {
+
+			glm::vec3 hit_pos;
+			if (mesh.raycastPoly(cursor_rays[i].origin, cursor_rays[i].direction, iter.index(), hit_pos)) {
+				brute_distance = std::min(brute_distance, glm::distance(cursor_rays[i].origin, hit_pos));
+			}
+		}
+
+		hits_match &= std::abs(hits[i].distance - brute_distance) < 1e-4f;
+	}
+	check(hits_match, "the poly BVH follows the stroke");
+}
+
+void tests::testSmoothing()
+{
+	SculptMesh mesh;
+	createTestSphere(mesh, 256);
+
+	// noise along the radius that smoothing must remove
+	std::mt19937 rng(7);
+	std::uniform_real_distribution<float> noise(-0.01f, 0.01f);
+
+	for (auto iter = mesh.verts.begin(); iter != mesh.verts.end(); iter.next()) {
+		mesh.vert_positions[iter.index()] *= 1.f + noise(rng);
+	}
+	mesh.recreateAABBs();
+	mesh.invalidatePolyBVH();
+	mesh.buildPolyBVH();
+
+	std::vector<glm::vec3> noisy_positions = mesh.vert_positions;
+	glm::vec2 noisy = radiusStats(mesh);
+
+	// one dab
+	StandardBrushInfo info = {};
+	info.end_pos = glm::normalize(glm::vec3(0.3f, 0.2f, 1.f));
+	info.diameter = 0.5f;
+	info.focus = 0.5f;
+	info.strength = 1.f;
+
+	SmoothSettings settings;
+	settings.iterations = 4;
+
+	double ms = timeMs([&]() {
+		mesh.smoothBrush(info, settings);
+	});
+	printf("smoothBrush %.2f ms \n", ms);
+
+	float noisy_error = 0;
+	float smooth_error = 0;
+	bool only_inside = true;
+
+	for (auto iter = mesh.verts.begin(); iter != mesh.verts.end(); iter.next()) {
+
+		uint32_t vertex_idx = iter.index();
+		glm::vec3 noisy_pos = noisy_positions[vertex_idx];
+		float dist = glm::distance(noisy_pos, info.end_pos);
+
+		if (dist > info.diameter / 2) {
+			only_inside &= mesh.vert_positions[vertex_idx] == noisy_pos;
+		}
+		else if (dist < info.focus * info.diameter / 2) {
+			noisy_error += std::abs(glm::length(noisy_pos) - 1.f);
+			smooth_error += std::abs(glm::length(mesh.vert_positions[vertex_idx]) - 1.f);
+		}
+	}
+	check(smooth_error < noisy_error / 2, "smoothBrush removes the noise under the dab");
+	check(only_inside, "smoothBrush leaves the vertices outside the dab");
+
+	// whole mesh
+	mesh.vert_positions = noisy_positions;
+	clearUpdates(mesh);
+
+	settings.iterations = 8;
+
+	ms = timeMs([&]() {
+		mesh.relax(settings);
+	});
+	printf("relax %.2f ms for %u verts \n", ms, mesh.verts.size());
+
+	glm::vec2 relaxed = radiusStats(mesh);
+
+	check(relaxed.y < noisy.y / 2, "relax removes the noise");
+	check(std::abs(relaxed.x - noisy.x) < 0.01f, "Taubin relax keeps the size");
+	check(isOctreeConsistent(mesh, { 0, 1, 0 }, 0.5f), "the octree follows relax");
+}
+
+void tests::testGrab()
+{
+	SculptMesh mesh;
+	createTestSphere(mesh, 512);
+
+	StandardBrushInfo info = {};
+	info.end_pos = mesh.vert_positions[mesh.verts.size() / 3];
+	info.diameter = 0.4f;
+	info.focus = 0.5f;
+
+	std::vector<glm::vec3> start_positions = mesh.vert_positions;
+	glm::vec3 delta = { 0.05f, 0.1f, -0.02f };
+
+	// the first brush on a mesh builds its adjacency, keep it out of the timing
+	GrabBrush grab;
+	mesh.beginGrab(grab, info);
+
+	double begin_ms = timeMs([&]() {
+		mesh.beginGrab(grab, info);
+	});
+
+	// the drag goes past the end and back, every frame starts from the captured positions
+	uint32_t frame_count = 10;
+	double drag_ms = 0;
+
+	for (uint32_t frame = 1; frame <= frame_count; frame++) {
+
+		glm::vec3 grab_pos = info.end_pos + delta * (1.5f * frame / frame_count);
+
+		drag_ms += timeMs([&]() {
+			mesh.grabBrush(grab, grab_pos);
+		});
+	}
+	mesh.grabBrush(grab, info.end_pos + delta);
+
+	printf("beginGrab %.2f ms, grabBrush %.3f ms per frame for %zu verts \n",
+		begin_ms, drag_ms / frame_count, grab.verts.size());
+
+	bool grab_matches = true;
+
+	for (auto iter = mesh.verts.begin(); iter != mesh.verts.end(); iter.next()) {
+
+		uint32_t vertex_idx = iter.index();
+		float dist = glm::distance(start_positions[vertex_idx], info.end_pos);
+		glm::vec3 moved = mesh.vert_positions[vertex_idx] - start_positions[vertex_idx];
+
+		if (dist > info.diameter / 2) {
+			grab_matches &= moved == glm::vec3(0);
+		}
+		else if (dist < info.focus * info.diameter / 2) {
+			grab_matches &= glm::distance(moved, delta) < 1e-5f;
+		}
+		else {
+			// the falloff moves the rest part of the way
+			grab_matches &= glm::length(moved) <= glm::length(delta) + 1e-5f;
+		}
+	}
+	check(grab_matches, "grab drags the focus with the cursor and leaves the rest");
+	check(isOctreeConsistent(mesh, info.end_pos, 0.5f), "the octree follows grab");
+}
+
+void tests::testKernelBrushes()
+{
+	const char* names[] = { "inflate", "pinch", "crease", "flatten", "clay" };
+
+	for (uint32_t type_idx = 0; type_idx < 5; type_idx++) {
+
+		BrushKernelType type = (BrushKernelType)type_idx;
+
+		SculptMesh mesh;
+		createTestSphere(mesh, 512);
+
+		StandardBrushInfo info = {};
+		info.end_pos = glm::normalize(glm::vec3(0.2f, 0.1f, 1.f));
+		info.diameter = 0.3f;
+		info.focus = 0.3f;
+		info.strength = 0.2f;
+
+		std::vector<glm::vec3> start_positions = mesh.vert_positions;
+		mesh.kernelBrush(type, info);
+
+		// on the unit sphere the area normal under the dab is close to the direction of its center
+		glm::vec3 normal = info.end_pos;
+		uint32_t moved_count = 0;
+		float growth = 0;  // of the distance to the center of the sphere
+		bool inside_dab = true;
+		bool moves_as_expected = true;
+		glm::vec2 start_heights = { FLT_MAX, -FLT_MAX };
+		glm::vec2 end_heights = { FLT_MAX, -FLT_MAX };
+
+		for (auto iter = mesh.verts.begin(); iter != mesh.verts.end(); iter.next()) {
+
+			uint32_t vertex_idx = iter.index();
+			glm::vec3 start = start_positions[vertex_idx];
+			glm::vec3 end = mesh.vert_positions[vertex_idx];
+
+			if (start == end) {
+				continue;
+			}
+
+			moved_count++;
+			inside_dab &= glm::distance(start, info.end_pos) <= info.diameter / 2;
+
+			switch (type) {
+			case BrushKernelType::INFLATE: {
+				moves_as_expected &= glm::length(end) >= glm::length(start) - 1e-6f;
+				growth += glm::length(end) - glm::length(start);
+				break;
+			}
+			case BrushKernelType::PINCH: {
+				moves_as_expected &= glm::distance(end, info.end_pos) <= glm::distance(start, info.end_pos);
+				break;
+			}
+			case BrushKernelType::CREASE: {
+				moves_as_expected &= glm::dot(end - start, normal) <= 1e-6f;
+				growth += glm::length(end) - glm::length(start);
+				break;
+			}
+			case BrushKernelType::FLATTEN: {
+				// checked below, the heights along the normal must spread less
+				float start_height = glm::dot(start, normal);
+				float end_height = glm::dot(end, normal);
+
+				start_heights = { std::min(start_heights.x, start_height), std::max(start_heights.y, start_height) };
+				end_heights = { std::min(end_heights.x, end_height), std::max(end_heights.y, end_height) };
+				break;
+			}
+			case BrushKernelType::CLAY: {
+				// only builds up
+				moves_as_expected &= glm::dot(end - start, normal) > -1e-6f;
+				break;
+			}
+			}
+		}
+
+		if (type == BrushKernelType::INFLATE) {
+			moves_as_expected &= growth > 0;
+		}
+		else if (type == BrushKernelType::CREASE) {
+			moves_as_expected &= growth < 0;
+		}
+		else if (type == BrushKernelType::FLATTEN) {
+			moves_as_expected = end_heights.y - end_heights.x < start_heights.y - start_heights.x;
+		}
+
+		char name[64];
+		snprintf(name, sizeof(name), "%s moves the vertices under the dab as expected", names[type_idx]);
+		check(isFinite(mesh) && moved_count > 0 && inside_dab && moves_as_expected, name);
+
+		// Timing
+		// a big dab of low strength so that the surface barely changes between dabs
+		info.diameter = 0.8f;
+		info.strength = 0.001f;
+		clearUpdates(mesh);
+
+		uint32_t dab_count = 20;
+		double ms = 0;
+
+		for (uint32_t i = 0; i < dab_count; i++) {
+
+			ms += timeMs([&]() {
+				mesh.kernelBrush(type, info);
+			});
+			clearUpdates(mesh);
+		}
+
+		uint32_t dab_vert_count = mesh.brush_scratch.verts.size();
+		printf("%s %.2f ms per dab, %.1f ns per vertex, %u verts \n", names[type_idx],
+			ms / dab_count, ms * 1e6 / dab_count / dab_vert_count, dab_vert_count);
+	}
+}
+
+void tests::testStandardBrush()
+{
+	SculptMesh mesh;
+	createTestSphere(mesh, 512);
+
+	StandardBrushInfo info = {};
+	info.end_pos = glm::normalize(glm::vec3(0.2f, 0.1f, 1.f));
+	info.diameter = 0.3f;
+	info.focus = 0.3f;
+	info.strength = 0.2f;
+
+	std::vector<glm::vec3> start_positions = mesh.vert_positions;
+	mesh.standardBrush(info);
+
+	// every vertex moves along the same area normal by at most strength times the radius,
+	// the vertices inside the focus move the whole way
+	float max_length = info.strength * info.diameter / 2;
+	float longest = 0;
+	glm::vec3 direction = { 0, 0, 0 };
+	uint32_t moved_count = 0;
+	bool inside_dab = true;
+	bool moves_as_expected = true;
+
+	for (auto iter = mesh.verts.begin(); iter != mesh.verts.end(); iter.next()) {
+
+		uint32_t vertex_idx = iter.index();
+		glm::vec3 start = start_positions[vertex_idx];
+		glm::vec3 displacement = mesh.vert_positions[vertex_idx] - start;
+		float length = glm::length(displacement);
+
+		// the smallest weights of the falloff round to no movement
+		if (length < 1e-6f) {
+			continue;
+		}
+
+		if (moved_count == 0) {
+			direction = displacement / length;
+		}
+
+		moved_count++;
+		inside_dab &= glm::distance(start, info.end_pos) <= info.diameter / 2;
+		moves_as_expected &= glm::dot(displacement / length, direction) > 0.9999f && length <= max_length * 1.0001f;
+		longest = std::max(longest, length);
+	}
+
+	// on the unit sphere the area normal under the dab is close to the direction of its center
+	moves_as_expected &= glm::dot(direction, info.end_pos) > 0.99f && longest > max_length * 0.9999f;
+
+	check(isFinite(mesh) && moved_count > 0 && inside_dab && moves_as_expected,
+		"standard brush moves the vertices under the dab along the area normal");
+
+	// Timing
+	// the same dabs as the brush kernels
+	info.diameter = 0.8f;
+	info.strength = 0.001f;
+	clearUpdates(mesh);
+
+	uint32_t dab_count = 20;
+	double ms = 0;
+
+	for (uint32_t i = 0; i < dab_count; i++) {
+
+		ms += timeMs([&]() {
+			mesh.standardBrush(info);
+		});
+		clearUpdates(mesh);
+	}
+
+	uint32_t dab_vert_count = mesh.brush_scratch.verts.size();
+	printf("standard %.2f ms per dab, %.1f ns per vertex, %u verts \n",
+		ms / dab_count, ms * 1e6 / dab_count / dab_vert_count, dab_vert_count);
+}
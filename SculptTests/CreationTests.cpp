@@ -0,0 +1,211 @@
+
+// Header
+#include "Tests.hpp"
+
+
+using namespace scme;
+using namespace tests;
+
+
+// rebuilds the octree the way it was done before the radix sort rebuild,
+// from an empty root leaf with the same bounds by inserting the vertices one at a time
+static void insertVertsIntoAABBs(SculptMesh& mesh)
+{
+	VertexBoundingBox old_root = mesh.aabbs[mesh.root_aabb_idx];
+
+	mesh.aabbs.resize(1);
+	mesh.root_aabb_idx = 0;
+	mesh.aabb_vert_indexes.clear();
+	mesh.unused_aabb_vert_count = 0;
+	mesh._clearRefitAABBs();
+	mesh._free_aabb_blocks.clear();
+
+	VertexBoundingBox& root = mesh.aabbs[0];
+	root.parent = 0xFFFF'FFFF;
+	root.children[0] = 0xFFFF'FFFF;
+	root.aabb = old_root.aabb;
+	root.mid = old_root.mid;
+	root.verts_begin = 0;
+	root.verts_end = 0;
+	root.verts_capacity_end = 0;
+
+	for (auto iter = mesh.verts.begin(); iter != mesh.verts.end(); iter.next()) {
+		iter.get().aabb = 0xFFFF'FFFF;
+	}
+
+	for (auto iter = mesh.verts.begin(); iter != mesh.verts.end(); iter.next()) {
+		mesh.moveVertexInAABBs(iter.index());
+	}
+}
+
+// every leaf holds at most max_vertices_in_AABB vertices, all inside its bounds,
+// the radix sort rebuild places vertices by 21 bit Morton cells so a vertex within a float rounding
+// of an octant boundary may land in the neighbouring leaf, one cell of slack is allowed for that
+static bool areLeafsWithinLimits(SculptMesh& mesh)
+{
+	float cell_size = mesh.aabbs[mesh.root_aabb_idx].aabb.sizeX() / (1 << 21);
+
+	for (uint32_t aabb_idx = 0; aabb_idx < mesh.aabbs.size(); aabb_idx++) {
+
+		VertexBoundingBox& aabb = mesh.aabbs[aabb_idx];
+		if (aabb.isLeaf() == false) {
+			continue;
+		}
+
+		// insertion subdivides a full leaf before adding, so a leaf may end one vertex over the limit
+		if (aabb.vertexCount() > mesh.max_vertices_in_AABB + 1) {
+			return false;
+		}
+
+		for (uint32_t i = aabb.verts_begin; i < aabb.verts_end; i++) {
+
+			glm::vec3& pos = mesh.vert_positions[mesh.aabb_vert_indexes[i]];
+
+			if (glm::any(glm::lessThan(pos, aabb.aabb.min - cell_size)) ||
+				glm::any(glm::greaterThan(pos, aabb.aabb.max + cell_size)))
+			{
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+void tests::testWelding()
+{
+	// a grid of quads spaced closer than the weld distance,
+	// welding must thin it out instead of collapsing the whole grid into one vertex
+	float distance = 1.f;
+	float spacing = 0.9f * distance;
+	uint32_t size = 32;
+
+	std::vector<uint32_t> tris_indexes;
+	std::vector<uint32_t> quad_indexes;
+	std::vector<glm::vec3> positions;
+	std::vector<glm::vec3> normals;
+
+	for (uint32_t y = 0; y < size; y++) {
+		for (uint32_t x = 0; x < size; x++) {
+			positions.push_back({ x * spacing, y * spacing, 0 });
+			normals.push_back({ 0, 0, 1 });
+		}
+	}
+
+	for (uint32_t y = 0; y + 1 < size; y++) {
+		for (uint32_t x = 0; x + 1 < size; x++) {
+
+			uint32_t corner = y * size + x;
+			quad_indexes.insert(quad_indexes.end(), { corner, corner + 1, corner + size + 1, corner + size });
+		}
+	}
+
+	SculptMesh mesh;
+	mesh.createFromLists(tris_indexes, quad_indexes, positions, normals, 64);
+
+	double ms = timeMs([&]() {
+		mesh.mergeByDistance(distance);
+	});
+	printf("mergeByDistance %.2f ms for %zu verts \n", ms, positions.size());
+
+	std::vector<glm::vec3> kept;
+
+	for (auto iter = mesh.verts.begin(); iter != mesh.verts.end(); iter.next()) {
+		kept.push_back(mesh.vert_positions[iter.index()]);
+	}
+
+	// a kept vertex has no other kept vertex in range and every vertex has a kept vertex in range
+	bool kept_apart = true;
+
+	for (uint32_t i = 0; i < kept.size(); i++) {
+		for (uint32_t j = i + 1; j < kept.size(); j++) {
+			kept_apart &= glm::distance(kept[i], kept[j]) > distance;
+		}
+	}
+
+	bool all_covered = true;
+
+	for (glm::vec3& pos : positions) {
+
+		float min_dist = FLT_MAX;
+		for (glm::vec3& kept_pos : kept) {
+			min_dist = std::min(min_dist, glm::distance(pos, kept_pos));
+		}
+		all_covered &= min_dist <= distance;
+	}
+
+	check(kept.size() > 1 && kept.size() < positions.size() && kept_apart && all_covered,
+		"mergeByDistance does not chain vertices closer than the distance");
+
+	// duplicates of every vertex in a triangle list are welded back exactly
+	std::vector<uint32_t> indexes;
+	std::vector<glm::vec3> split_positions;
+	std::vector<glm::vec3> split_normals;
+
+	for (uint32_t i = 0; i < quad_indexes.size(); i += 4) {
+		for (uint32_t corner : { 0, 1, 2, 0, 2, 3 }) {
+
+			indexes.push_back(split_positions.size());
+			split_positions.push_back(positions[quad_indexes[i + corner]]);
+			split_normals.push_back(normals[quad_indexes[i + corner]]);
+		}
+	}
+
+	SculptMesh::weldByDistance(spacing * 0.1f, indexes, split_positions, split_normals);
+
+	check(split_positions.size() == positions.size() && indexes.size() == (size - 1) * (size - 1) * 6,
+		"weldByDistance merges the split corners of a triangle list");
+}
+
+// the generated sphere must be closed, so every edge has two polys and V - E + F = 2
+void tests::testSphereCreation()
+{
+	for (auto [rows, columns] : { std::pair{ 256u, 256u }, { 512u, 1024u }, { 1024u, 1024u }, { 2048u, 2048u } }) {
+
+		SculptMesh mesh;
+
+		double ms = timeMs([&]() {
+			mesh.createAsUV_Sphere(2.f, rows, columns, 64);
+		});
+		printf("createAsUV_Sphere %ux%u %.2f ms, %u verts, %.1f ns per vertex \n",
+			rows, columns, ms, mesh.verts.size(), ms * 1e6 / mesh.verts.size());
+
+		bool all_edges_shared = true;
+
+		for (auto iter = mesh.edges.begin(); iter != mesh.edges.end(); iter.next()) {
+
+			Edge& edge = iter.get();
+			all_edges_shared &= edge.p0 != 0xFFFF'FFFF && edge.p1 != 0xFFFF'FFFF;
+		}
+
+		int64_t euler = (int64_t)mesh.verts.size() - mesh.edges.size() + mesh.polys.size();
+
+		char check_name[128];
+		snprintf(check_name, sizeof(check_name), "createAsUV_Sphere %ux%u is closed", rows, columns);
+		check(all_edges_shared && euler == 2, check_name);
+	}
+}
+
+void tests::testOctreeRebuild()
+{
+	for (uint32_t rows : { 1024u, 2048u }) {
+
+		SculptMesh mesh;
+		mesh.createAsUV_Sphere(2.f, rows, rows, 64);
+
+		double insert_ms = timeMs([&]() {
+			insertVertsIntoAABBs(mesh);
+		});
+		bool inserted_valid = areLeafsWithinLimits(mesh) && isOctreeConsistent(mesh, glm::vec3(0.5f, 0.5f, 0.5f), 0.5f);
+
+		double radix_ms = timeMs([&]() {
+			mesh.recreateAABBs();
+		});
+		bool radix_valid = areLeafsWithinLimits(mesh) && isOctreeConsistent(mesh, glm::vec3(0.5f, 0.5f, 0.5f), 0.5f);
+
+		printf("%u verts octree rebuild: inserting %.2f ms, radix sort %.2f ms \n",
+			mesh.verts.size(), insert_ms, radix_ms);
+
+		check(inserted_valid && radix_valid, "both octree rebuilds keep every vertex in a leaf that contains it");
+	}
+}
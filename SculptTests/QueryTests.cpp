@@ -0,0 +1,291 @@
+
+// Header
+#include "Tests.hpp"
+
+
+using namespace scme;
+using namespace tests;
+
+
+static bool isBitSet(const std::vector<uint64_t>& bits, uint32_t idx)
+{
+	return (bits[idx >> 6] & (1ULL << (idx & 63))) != 0;
+}
+
+// even-odd rule
+static bool isInsidePolygon(const std::vector<glm::vec2>& polygon, const glm::vec2& point)
+{
+	bool inside = false;
+
+	for (uint32_t i = 0, j = polygon.size() - 1; i < polygon.size(); j = i++) {
+
+		const glm::vec2& a = polygon[i];
+		const glm::vec2& b = polygon[j];
+
+		if ((a.y > point.y) != (b.y > point.y) &&
+			point.x < (b.x - a.x) * (point.y - a.y) / (b.y - a.y) + a.x)
+		{
+			inside = !inside;
+		}
+	}
+
+	return inside;
+}
+
+void tests::testRaycasts()
+{
+	SculptMesh mesh;
+	createTestSphere(mesh, 512);
+
+	std::mt19937 rng(7);
+	std::uniform_real_distribution<float> unit(-1.f, 1.f);
+
+	// rays from around the sphere toward points near its center
+	std::vector<Ray> rays(1 << 20);
+
+	for (Ray& ray : rays) {
+		ray.origin = glm::normalize(glm::vec3(unit(rng), unit(rng), unit(rng)) + 1e-3f) * 3.f;
+		ray.direction = glm::normalize(glm::vec3(unit(rng), unit(rng), unit(rng)) * 0.5f - ray.origin);
+	}
+
+	std::vector<RayHit> hits;
+	double ms = timeMs([&]() {
+		mesh.raycastBatch(rays, hits);
+	});
+	printf("raycastBatch %.2f Mrays/s \n", rays.size() / (ms * 1000));
+
+	QueryContext context;
+	uint32_t mismatches = 0;
+
+	ms = timeMs([&]() {
+		for (uint32_t i = 0; i < rays.size(); i += 97) {
+
+			uint32_t poly;
+			glm::vec3 pos;
+			bool hit = mesh.raycastPolys(context, rays[i].origin, rays[i].direction, poly, pos);
+
+			if (hit != (hits[i].poly != 0xFFFF'FFFF) ||
+				(hit && std::abs(glm::distance(rays[i].origin, pos) - hits[i].distance) > 1e-4f))
+			{
+				mismatches++;
+			}
+		}
+	});
+	printf("raycastPolys on one thread %.2f Mrays/s \n", (rays.size() / 97) / (ms * 1000));
+
+	check(mismatches == 0, "raycastBatch matches raycastPolys");
+}
+
+void tests::testRangeQueries()
+{
+	SculptMesh mesh;
+	createTestSphere(mesh, 512);
+
+	std::mt19937 rng(7);
+	std::uniform_real_distribution<float> unit(-1.f, 1.f);
+
+	QueryContext context;
+	std::vector<uint32_t> found_verts;
+	std::vector<float> dist_sqrs;
+
+	bool sphere_matches = true;
+	bool capsule_matches = true;
+	double sphere_ms = 0;
+	double capsule_ms = 0;
+
+	for (uint32_t i = 0; i < 20; i++) {
+
+		glm::vec3 start = glm::normalize(glm::vec3(unit(rng), unit(rng), unit(rng)) + 1e-3f);
+		glm::vec3 end = glm::normalize(start + glm::vec3(unit(rng), unit(rng), unit(rng)) * 0.2f);
+
+		sphere_ms += timeMs([&]() {
+			mesh.sphereQuery(context, start, 0.1f, found_verts, dist_sqrs);
+		});
+		sphere_matches &= isOctreeConsistent(mesh, start, 0.1f) && found_verts.size() > 0;
+
+		capsule_ms += timeMs([&]() {
+			mesh.capsuleQuery(context, start, end, 0.05f, found_verts, dist_sqrs);
+		});
+
+		uint32_t count = 0;
+
+		for (auto iter = mesh.verts.begin(); iter != mesh.verts.end(); iter.next()) {
+
+			glm::vec3 pos = mesh.vert_positions[iter.index()];
+			float t = glm::clamp(glm::dot(pos - start, end - start) / glm::dot(end - start, end - start), 0.f, 1.f);
+
+			count += glm::distance(pos, start + (end - start) * t) <= 0.05f;
+		}
+		capsule_matches &= found_verts.size() == count;
+	}
+
+	printf("sphereQuery %.3f ms, capsuleQuery %.3f ms \n", sphere_ms / 20, capsule_ms / 20);
+	check(sphere_matches, "sphereQuery matches brute force");
+	check(capsule_matches, "capsuleQuery matches brute force");
+}
+
+void tests::testSelections()
+{
+	SculptMesh mesh;
+	createTestSphere(mesh, 512);
+
+	QueryContext context;
+
+	// orthographic view down z with clip z from 0 to w
+	glm::mat4 local_to_clip = glm::mat4(1);
+	local_to_clip[0][0] = 0.5f;
+	local_to_clip[1][1] = 0.5f;
+	local_to_clip[2][2] = 0.1f;
+	local_to_clip[3][2] = 0.5f;
+
+	AxisBoundingBox3D<> box;
+	box.min = { -0.3f, -0.1f, 0.2f };
+	box.max = { 0.4f, 0.5f, 1.5f };
+
+	glm::vec2 rect_min = { -0.3f, -0.2f };
+	glm::vec2 rect_max = { 0.25f, 0.35f };
+
+	std::vector<glm::vec2> lasso = {
+		{ -0.4f, -0.3f }, { 0.3f, -0.2f }, { 0.1f, 0.4f }, { 0.f, 0.f }, { -0.2f, 0.3f }
+	};
+
+	std::vector<uint64_t> in_box;
+	std::vector<uint64_t> in_rect;
+	std::vector<uint64_t> in_lasso;
+
+	double box_ms = timeMs([&]() {
+		mesh.selectVertsInBox(context, box, in_box);
+	});
+	double rect_ms = timeMs([&]() {
+		mesh.selectVertsInRect(context, local_to_clip, rect_min, rect_max, nullptr, in_rect);
+	});
+	double lasso_ms = timeMs([&]() {
+		mesh.selectVertsInLasso(context, local_to_clip, lasso, nullptr, in_lasso);
+	});
+	printf("select box %.2f ms, rect %.2f ms, lasso %.2f ms \n", box_ms, rect_ms, lasso_ms);
+
+	bool box_matches = true;
+	bool rect_matches = true;
+	bool lasso_matches = true;
+
+	for (auto iter = mesh.verts.begin(); iter != mesh.verts.end(); iter.next()) {
+
+		uint32_t vertex_idx = iter.index();
+		glm::vec3 pos = mesh.vert_positions[vertex_idx];
+		glm::vec2 ndc = glm::vec2(local_to_clip * glm::vec4(pos, 1));
+
+		bool inside_box = glm::all(glm::greaterThanEqual(pos, box.min)) && glm::all(glm::lessThanEqual(pos, box.max));
+		bool inside_rect = glm::all(glm::greaterThanEqual(ndc, rect_min)) && glm::all(glm::lessThanEqual(ndc, rect_max));
+
+		box_matches &= isBitSet(in_box, vertex_idx) == inside_box;
+		rect_matches &= isBitSet(in_rect, vertex_idx) == inside_rect;
+		lasso_matches &= isBitSet(in_lasso, vertex_idx) == isInsidePolygon(lasso, ndc);
+	}
+
+	check(box_matches, "selectVertsInBox matches brute force");
+	check(rect_matches, "selectVertsInRect matches brute force");
+	check(lasso_matches, "selectVertsInLasso matches brute force");
+
+	std::vector<uint64_t> selected_polys;
+	mesh.selectPolysFromVerts(in_box, selected_polys);
+
+	bool polys_match = true;
+
+	for (auto iter = mesh.polys.begin(); iter != mesh.polys.end(); iter.next()) {
+
+		Poly* poly = &iter.get();
+		bool all_selected = true;
+
+		if (poly->is_tris) {
+			std::array<uint32_t, 3> vs;
+			mesh.getTrisPrimitives(poly, vs);
+
+			for (uint32_t vertex_idx : vs) {
+				all_selected &= isBitSet(in_box, vertex_idx);
+			}
+		}
+		else {
+			std::array<uint32_t, 4> vs;
+			mesh.getQuadPrimitives(poly, vs);
+
+			for (uint32_t vertex_idx : vs) {
+				all_selected &= isBitSet(in_box, vertex_idx);
+			}
+		}
+
+		polys_match &= isBitSet(selected_polys, iter.index()) == all_selected;
+	}
+	check(polys_match, "selectPolysFromVerts matches brute force");
+
+	std::vector<uint64_t> selected_edges;
+	mesh.selectEdgesFromVerts(in_box, selected_edges);
+
+	bool edges_match = true;
+
+	for (auto iter = mesh.edges.begin(); iter != mesh.edges.end(); iter.next()) {
+
+		Edge& edge = iter.get();
+		bool both_selected = isBitSet(in_box, edge.v0) && isBitSet(in_box, edge.v1);
+
+		edges_match &= isBitSet(selected_edges, iter.index()) == both_selected;
+	}
+	check(edges_match, "selectEdgesFromVerts matches brute force");
+
+	// a lasso without area selects nothing but still sizes the bitset for every vertex
+	std::vector<glm::vec2> line = { { 0.f, 0.f }, { 0.5f, 0.5f } };
+	mesh.selectVertsInLasso(context, local_to_clip, line, nullptr, in_lasso);
+
+	bool all_clear = in_lasso.size() == in_box.size();
+
+	for (uint64_t word : in_lasso) {
+		all_clear &= word == 0;
+	}
+	check(all_clear, "a lasso without area clears the whole bitset");
+}
+
+void tests::testClosestPoints()
+{
+	SculptMesh mesh;
+	createTestSphere(mesh, 512);
+
+	std::mt19937 rng(7);
+	std::uniform_real_distribution<float> unit(-1.f, 1.f);
+
+	std::vector<glm::vec3> positions(1 << 18);
+
+	for (glm::vec3& pos : positions) {
+		pos = glm::vec3(unit(rng), unit(rng), unit(rng)) * 2.f;
+	}
+
+	std::vector<ClosestPoint> closest;
+	double ms = timeMs([&]() {
+		mesh.closestPointBatch(positions, FLT_MAX, closest);
+	});
+	printf("closestPointBatch %.2f Mpoints/s \n", positions.size() / (ms * 1000));
+
+	// the faceted sphere is within 1e-3 of the unit sphere at 512 rows
+	float max_error = 0;
+
+	for (uint32_t i = 0; i < positions.size(); i++) {
+		max_error = std::max(max_error, std::abs(closest[i].distance - std::abs(glm::length(positions[i]) - 1.f)));
+	}
+	check(max_error < 1e-3f, "closestPointBatch finds the distance to the sphere");
+
+	// a max distance leaves the farther points without a poly
+	QueryContext context;
+	bool limit_respected = true;
+
+	for (uint32_t i = 0; i < positions.size(); i += 97) {
+
+		ClosestPoint limited;
+		bool found = mesh.closestPoint(context, positions[i], 0.25f, limited);
+
+		if (closest[i].distance <= 0.24f) {
+			limit_respected &= found && std::abs(limited.distance - closest[i].distance) < 1e-5f;
+		}
+		else if (closest[i].distance > 0.26f) {
+			limit_respected &= found == false && limited.poly == 0xFFFF'FFFF;
+		}
+	}
+	check(limit_respected, "closestPoint stops at the max distance");
+}
@@ -0,0 +1,274 @@
+
+// Header
+#include "Tests.hpp"
+
+
+using namespace scme;
+using namespace tests;
+
+
+// large enough to hold the free list link inside the element like Edge and Poly
+struct IntrusiveElement {
+	uint32_t value;
+	uint32_t padding[7];
+};
+
+// too small for the link so the node stores it beside the element
+struct SeparateLinkElement {
+	uint8_t value;
+};
+
+// fills the vector, erases a fraction of it at random then erases and re-adds elements in turns,
+// the alive elements are checked against a plain list after each step
+template<typename T>
+static void churnSparseVector(const char* name, float fragmentation)
+{
+	uint32_t count = 1'000'000;
+	uint32_t churn_count = 1'000'000;
+
+	std::mt19937 rng(7);
+
+	SparseVector<T> vec;
+	std::vector<uint8_t> is_alive(count, 0);
+	std::vector<uint32_t> alive_idxs;
+
+	double emplace_ms = timeMs([&]() {
+		for (uint32_t i = 0; i < count; i++) {
+
+			uint32_t idx;
+			T& elem = vec.emplace(idx);
+			elem.value = (decltype(T::value))idx;
+		}
+	});
+
+	for (uint32_t i = 0; i < count; i++) {
+		is_alive[i] = 1;
+		alive_idxs.push_back(i);
+	}
+
+	// random erase order picked up front to time only the erase
+	std::shuffle(alive_idxs.begin(), alive_idxs.end(), rng);
+
+	uint32_t erase_count = (uint32_t)(count * fragmentation);
+
+	double erase_ms = timeMs([&]() {
+		for (uint32_t i = 0; i < erase_count; i++) {
+			vec.erase(alive_idxs[count - 1 - i]);
+		}
+	});
+
+	for (uint32_t i = 0; i < erase_count; i++) {
+		is_alive[alive_idxs[count - 1 - i]] = 0;
+	}
+	alive_idxs.resize(count - erase_count);
+
+	auto matches_reference = [&]() -> bool {
+
+		uint32_t visited = 0;
+		uint32_t prev_idx = 0;
+		bool matches = vec.size() == alive_idxs.size();
+
+		for (auto iter = vec.begin(); iter != vec.end(); iter.next()) {
+
+			uint32_t idx = iter.index();
+			matches &= is_alive[idx] && (visited == 0 || idx > prev_idx) &&
+				iter.get().value == (decltype(T::value))idx;
+
+			prev_idx = idx;
+			visited++;
+		}
+
+		return matches && visited == alive_idxs.size();
+	};
+
+	uint32_t iterated = 0;
+	double iterate_ms = timeMs([&]() {
+		for (auto iter = vec.begin(); iter != vec.end(); iter.next()) {
+			iterated += iter.get().value != 0;
+		}
+	});
+
+	bool fragmented_matches = matches_reference();
+
+	// Churn
+	// the free list hands back the slot erased in the same turn so the alive elements stay the same
+	std::vector<uint32_t> erase_idxs(churn_count);
+	std::uniform_int_distribution<uint32_t> pick(0, alive_idxs.size() - 1);
+
+	for (uint32_t i = 0; i < churn_count; i++) {
+		erase_idxs[i] = alive_idxs[pick(rng)];
+	}
+
+	bool reuses_slots = true;
+
+	double churn_ms = timeMs([&]() {
+		for (uint32_t i = 0; i < churn_count; i++) {
+
+			vec.erase(erase_idxs[i]);
+
+			uint32_t idx;
+			T& elem = vec.emplace(idx);
+			elem.value = (decltype(T::value))idx;
+
+			reuses_slots &= idx == erase_idxs[i];
+		}
+	});
+
+	bool churned_matches = matches_reference() && vec.capacity() == count;
+
+	printf("%s %.0f%% deleted: emplace %.1f, erase %.1f, churn %.1f Mops/s, iterate %.2f ms \n",
+		name, fragmentation * 100, count / (emplace_ms * 1000), erase_count / (erase_ms * 1000),
+		churn_count / (churn_ms * 1000), iterate_ms);
+
+	char check_name[96];
+	snprintf(check_name, sizeof(check_name), "%s %.0f%% deleted iterates the alive elements in order",
+		name, fragmentation * 100);
+	check(fragmented_matches && iterated <= alive_idxs.size(), check_name);
+
+	snprintf(check_name, sizeof(check_name), "%s %.0f%% deleted reuses the freed slots without growing",
+		name, fragmentation * 100);
+	check(reuses_slots && churned_matches, check_name);
+}
+
+void tests::testSparseVectorChurn()
+{
+	for (float fragmentation : { 0.1f, 0.5f, 0.9f }) {
+		churnSparseVector<IntrusiveElement>("SparseVector<32 bytes>", fragmentation);
+		churnSparseVector<SeparateLinkElement>("SparseVector<1 byte>", fragmentation);
+	}
+}
+
+// the vertex as it was stored before the position and normal columns, inside its SparseVector node
+struct InterleavedVertexNode {
+	bool is_deleted;
+
+	glm::vec3 pos;
+	glm::vec3 normal;
+
+	uint32_t edge;
+	uint32_t aabb;
+	uint32_t idx_in_aabb;
+};
+
+// the position sweeps of bounds computation, position upload packing and normal renormalization
+// over the interleaved nodes and over the columns, on one thread to compare only the memory traffic
+void tests::testVertexLayouts()
+{
+	std::mt19937 rng(7);
+	std::uniform_real_distribution<float> unit(-1.f, 1.f);
+
+	for (uint32_t vertex_count : { 1'000'000u, 10'000'000u }) {
+
+		std::vector<InterleavedVertexNode> nodes(vertex_count);
+		std::vector<glm::vec3> positions(vertex_count);
+		std::vector<glm::vec3> normals(vertex_count);
+
+		for (uint32_t i = 0; i < vertex_count; i++) {
+
+			InterleavedVertexNode& node = nodes[i];
+			node.is_deleted = false;
+			node.pos = { unit(rng), unit(rng), unit(rng) };
+			node.normal = node.pos;
+
+			positions[i] = node.pos;
+			normals[i] = node.normal;
+		}
+
+		std::vector<glm::vec3> packed(vertex_count);
+
+		glm::vec3 aos_min = glm::vec3(FLT_MAX);
+		glm::vec3 aos_max = glm::vec3(-FLT_MAX);
+		glm::vec3 soa_min = glm::vec3(FLT_MAX);
+		glm::vec3 soa_max = glm::vec3(-FLT_MAX);
+
+		double aos_bounds_ms = timeMs([&]() {
+			for (InterleavedVertexNode& node : nodes) {
+				if (node.is_deleted == false) {
+					aos_min = glm::min(aos_min, node.pos);
+					aos_max = glm::max(aos_max, node.pos);
+				}
+			}
+		});
+		double soa_bounds_ms = timeMs([&]() {
+			for (glm::vec3& pos : positions) {
+				soa_min = glm::min(soa_min, pos);
+				soa_max = glm::max(soa_max, pos);
+			}
+		});
+
+		double aos_pack_ms = timeMs([&]() {
+			for (uint32_t i = 0; i < vertex_count; i++) {
+				packed[i] = nodes[i].pos;
+			}
+		});
+		double soa_pack_ms = timeMs([&]() {
+			std::copy(positions.begin(), positions.end(), packed.begin());
+		});
+
+		double aos_normals_ms = timeMs([&]() {
+			for (InterleavedVertexNode& node : nodes) {
+				node.normal = glm::normalize(node.normal);
+			}
+		});
+		double soa_normals_ms = timeMs([&]() {
+			for (glm::vec3& normal : normals) {
+				normal = glm::normalize(normal);
+			}
+		});
+
+		printf("%u verts interleaved / columns: bounds %.2f / %.2f ms, pack %.2f / %.2f ms, normals %.2f / %.2f ms \n",
+			vertex_count, aos_bounds_ms, soa_bounds_ms, aos_pack_ms, soa_pack_ms, aos_normals_ms, soa_normals_ms);
+
+		check(aos_min == soa_min && aos_max == soa_max,
+			"both vertex layouts find the same bounds");
+	}
+}
+
+// the traversals that only walk the edge and poly topology,
+// timed on one thread so the numbers follow the size of the Edge and Poly records
+void tests::testTopologyTraversals()
+{
+	SculptMesh mesh;
+	createTestSphere(mesh, 1024);
+
+	double normals_ms = timeMs([&]() {
+		for (auto iter = mesh.verts.begin(); iter != mesh.verts.end(); iter.next()) {
+			mesh.calcVertexNormal(iter.index());
+		}
+	});
+
+	uint32_t wrong_edges = 0;
+
+	double find_edges_ms = timeMs([&]() {
+		for (auto iter = mesh.edges.begin(); iter != mesh.edges.end(); iter.next()) {
+
+			Edge& edge = iter.get();
+			wrong_edges += mesh.findEdgeBetween(edge.v1, edge.v0) != iter.index();
+		}
+	});
+
+	std::mt19937 rng(7);
+	std::uniform_real_distribution<float> unit(-1.f, 1.f);
+
+	uint32_t ray_count = 10'000;
+	uint32_t misses = 0;
+
+	double raycasts_ms = timeMs([&]() {
+		for (uint32_t i = 0; i < ray_count; i++) {
+
+			glm::vec3 origin = glm::normalize(glm::vec3(unit(rng), unit(rng), unit(rng)) + 1e-3f) * 3.f;
+			glm::vec3 direction = glm::normalize(-origin);
+
+			uint32_t poly;
+			glm::vec3 pos;
+			misses += mesh.raycastPolys(origin, direction, poly, pos) == false;
+		}
+	});
+
+	printf("%u verts: calcVertexNormal %.1f ns/vert, findEdgeBetween %.1f ns/edge, raycastPolys %.2f us/ray \n",
+		mesh.verts.size(), normals_ms * 1e6 / mesh.verts.size(), find_edges_ms * 1e6 / mesh.edges.size(),
+		raycasts_ms * 1e3 / ray_count);
+
+	check(wrong_edges == 0, "findEdgeBetween finds every edge from its vertices");
+	check(misses == 0, "raycastPolys hits the sphere from every side");
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+// Standard
+#include <random>
+
+#include "SculptMesh.hpp"
+
+
+// checks of the mesh code without a window or a renderer,
+// each test prints its checks against brute force and its timings
+
+namespace tests {
+
+	void check(bool passed, const char* name);
+
+	uint32_t failedChecks();
+
+	template<typename Func>
+	double timeMs(Func func)
+	{
+		SteadyTime start = std::chrono::steady_clock::now();
+		func();
+
+		return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	// the sphere has a radius of 1 around the origin
+	void createTestSphere(scme::SculptMesh& mesh, uint32_t rows);
+
+	// the octree answers a sphere query with the same vertices as testing all of them
+	bool isOctreeConsistent(scme::SculptMesh& mesh, const glm::vec3& center, float radius);
+
+
+	// StorageTests.cpp
+	void testSparseVectorChurn();
+	void testVertexLayouts();
+	void testTopologyTraversals();
+
+	// CreationTests.cpp
+	void testWelding();
+	void testSphereCreation();
+	void testOctreeRebuild();
+
+	// QueryTests.cpp
+	void testRaycasts();
+	void testRangeQueries();
+	void testSelections();
+	void testClosestPoints();
+
+	// BrushTests.cpp
+	void testStrokes();
+	void testSmoothing();
+	void testGrab();
+	void testStandardBrush();
+	void testKernelBrushes();
+}
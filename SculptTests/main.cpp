@@ -0,0 +1,68 @@
+
+// Header
+#include "Tests.hpp"
+
+
+static uint32_t failed_checks = 0;
+
+void tests::check(bool passed, const char* name)
+{
+	printf("%s %s \n", passed ? "pass" : "FAIL", name);
+
+	if (passed == false) {
+		failed_checks++;
+	}
+}
+
+uint32_t tests::failedChecks()
+{
+	return failed_checks;
+}
+
+void tests::createTestSphere(scme::SculptMesh& mesh, uint32_t rows)
+{
+	mesh.createAsUV_Sphere(2.f, rows, rows, 64);
+	mesh.buildPolyBVH();
+}
+
+bool tests::isOctreeConsistent(scme::SculptMesh& mesh, const glm::vec3& center, float radius)
+{
+	scme::QueryContext context;
+	std::vector<uint32_t> found_verts;
+	std::vector<float> dist_sqrs;
+	mesh.sphereQuery(context, center, radius, found_verts, dist_sqrs);
+
+	uint32_t count = 0;
+
+	for (auto iter = mesh.verts.begin(); iter != mesh.verts.end(); iter.next()) {
+		count += glm::distance(mesh.vert_positions[iter.index()], center) <= radius;
+	}
+
+	return found_verts.size() == count;
+}
+
+// returns the number of failed checks
+int main(int, char**)
+{
+	tests::testSparseVectorChurn();
+	tests::testVertexLayouts();
+	tests::testTopologyTraversals();
+
+	tests::testWelding();
+	tests::testSphereCreation();
+	tests::testOctreeRebuild();
+
+	tests::testRaycasts();
+	tests::testRangeQueries();
+	tests::testSelections();
+	tests::testClosestPoints();
+	tests::testStrokes();
+	tests::testSmoothing();
+	tests::testGrab();
+	tests::testStandardBrush();
+	tests::testKernelBrushes();
+
+	printf("%u failed checks \n", tests::failedChecks());
+
+	return tests::failedChecks();
+}